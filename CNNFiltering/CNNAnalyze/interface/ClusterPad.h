@@ -0,0 +1,89 @@
+#ifndef CNNFiltering_CNNAnalyze_ClusterPad_h
+#define CNNFiltering_CNNAnalyze_ClusterPad_h
+
+#include <vector>
+
+/** Rasterization of a pixel cluster into the padSize x padSize pad used by
+ *  the doublet and track CNNs.
+ *
+ *  The result is identical to the former per-hit histogram
+ *
+ *    TH2F hClust("hClust","hClust",padSize,x()-padHalfSize,x()+padHalfSize,
+ *                                  padSize,y()-padHalfSize,y()+padHalfSize);
+ *    hClust.SetBinContent(hClust.FindBin(pixel.x,pixel.y),pixel.adc);   // each pixel
+ *
+ *  read back with n = (ny+2)*(padSize+2)-2-2-nx-padSize, ny from padSize to
+ *  1 and nx from 0 to padSize-1: the pad is row major, the first row is the
+ *  last y bin and the first column the last x bin. The bin of a pixel is
+ *  computed as TAxis::FindBin does (same bounds, rounded to float as the
+ *  TH2F constructor arguments, same operation order), pixels out of the
+ *  pad are dropped and a later pixel in the same bin overwrites an earlier one.
+ *
+ *  Optionally (pad - mean)/sigma is applied while writing, as done with
+ *  padMean and padSigma by CNNInference, so no second pass is needed.
+ *  Cluster is SiPixelCluster or any class with x(), y(), size() and
+ *  pixel(k) returning x, y and adc.
+ */
+
+namespace clusterPad {
+
+  template<typename Cluster>
+  inline void fill(const Cluster& cluster, const int padSize, const float padHalfSize, float * pad,
+                   const double mean = 0., const double sigma = 1.) {
+    const double xMin = cluster.x()-padHalfSize, xMax = cluster.x()+padHalfSize;
+    const double yMin = cluster.y()-padHalfSize, yMax = cluster.y()+padHalfSize;
+
+    const float zero = (0.-mean)/sigma;
+    for (int i = 0; i < padSize*padSize; ++i) pad[i] = zero;
+
+    for (int k = 0; k < int(cluster.size()); ++k) {
+      const auto pixel = cluster.pixel(k);
+      const double x = float(pixel.x), y = float(pixel.y);
+      if (x < xMin || !(x < xMax) || y < yMin || !(y < yMax)) continue;
+      const int binX = 1 + int(padSize*(x-xMin)/(xMax-xMin));
+      const int binY = 1 + int(padSize*(y-yMin)/(yMax-yMin));
+      if (binX > padSize || binY > padSize) continue; // overflow after rounding, never read back
+      pad[(padSize-binY)*padSize + padSize-binX] = (double(float(pixel.adc))-mean)/sigma;
+    }
+  }
+
+  /** Event scoped cache of the pads: a cluster shared by several doublets is
+   *  rasterized once into a contiguous pool, indexed by the cluster key
+   *  (ClusterRef::key(), i.e. the OmniClusterRef index, all the clusters must
+   *  come from the same collection). clear() at the beginning of each event
+   *  keeps the memory of the previous ones.
+   */
+  class Cache {
+  public:
+    Cache(int padSize, float padHalfSize, double mean = 0., double sigma = 1.):
+      padSize_(padSize), padHalfSize_(padHalfSize), mean_(mean), sigma_(sigma) {}
+
+    void clear() { slots_.clear(); pool_.clear(); }
+
+    /// the pad of the cluster, valid until the next call to get() or clear()
+    template<typename Cluster>
+    const float * get(unsigned int key, const Cluster& cluster) {
+      if (key >= slots_.size()) slots_.resize(key+1, -1);
+      if (slots_[key] < 0) {
+        slots_[key] = pool_.size();
+        pool_.resize(pool_.size() + padElements());
+        fill(cluster, padSize_, padHalfSize_, pool_.data() + slots_[key], mean_, sigma_);
+      }
+      return pool_.data() + slots_[key];
+    }
+
+    int padElements() const { return padSize_*padSize_; }
+    /// number of pads built since the last clear()
+    unsigned int size() const { return pool_.size()/padElements(); }
+
+  private:
+    int padSize_;
+    float padHalfSize_;
+    double mean_, sigma_;
+    std::vector<int> slots_;   // key -> offset in pool_, -1 if not built
+    std::vector<float> pool_;
+  };
+
+}
+
+#endif
@@ -64,7 +64,7 @@ Implementation:
 #include <string>
 #include <fstream>
 
-#include "TH2F.h"
+#include "CNNFiltering/CNNAnalyze/interface/ClusterPad.h"
 #include "TTree.h"
 #include "DataFormats/DetId/interface/DetId.h"
 #include "DataFormats/SiPixelDetId/interface/PXBDetId.h"
@@ -244,6 +244,9 @@ CNNAnalyze::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 
   float ax1, ax2, deltaADC = 0.0, deltaPhi = 0.0, deltaR = 0.0, deltaA = 0.0, deltaS = 0.0, deltaZ = 0.0, zZero = 0.0;
 
+  // each cluster pad is built once per event, whatever the number of doublets sharing it
+  clusterPad::Cache clusterPads(padSize, padHalfSize);
+
   for (std::vector<IntermediateHitDoublets::LayerPairHitDoublets>::const_iterator lIt = iHd->layerSetsBegin(); lIt != iHd->layerSetsEnd(); ++lIt)
   {
     DetLayer const * innerLayer = lIt->doublets().detLayer(HitDoublets::inner);
@@ -369,32 +372,8 @@ CNNAnalyze::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
         hitPars[j].push_back((float)siHits[j]->isOnEdge()); //31
 
         //Cluster Pad
-        TH2F hClust("hClust","hClust",
-        padSize,
-        clusters[j]->x()-padHalfSize,
-        clusters[j]->x()+padHalfSize,
-        padSize,
-        clusters[j]->y()-padHalfSize,
-        clusters[j]->y()+padHalfSize);
-
-        //Initialization
-        for (int nx = 0; nx < padSize; ++nx)
-        for (int ny = 0; ny < padSize; ++ny)
-        hClust.SetBinContent(nx,ny,0.0);
-
-        for (int k = 0; k < clusters[j]->size(); ++k)
-        hClust.SetBinContent(hClust.FindBin((float)clusters[j]->pixel(k).x, (float)clusters[j]->pixel(k).y),(float)clusters[j]->pixel(k).adc);
-
-        //Linearizing the cluster
-
-        for (int ny = padSize; ny>0; --ny)
-        {
-          for(int nx = 0; nx<padSize; nx++)
-          {
-            int n = (ny+2)*(padSize + 2) - 2 -2 - nx - padSize; //see TH2 reference for clarification
-            hitPars[j].push_back(hClust.GetBinContent(n));
-          }
-        }
+        const float * pad = clusterPads.get(clusters[j].key(), *clusters[j]);
+        hitPars[j].insert(hitPars[j].end(), pad, pad + padSize*padSize);
 
 
         //ADC sum
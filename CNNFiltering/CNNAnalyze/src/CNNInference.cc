@@ -36,6 +36,7 @@ Implementation:
 
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
 #include "FWCore/Utilities/interface/StreamID.h"
+#include "FWCore/Utilities/interface/Exception.h"
 #include "FWCore/Framework/interface/GetterOfProducts.h"
 #include "FWCore/Framework/interface/ProcessMatch.h"
 #include "FWCore/ServiceRegistry/interface/ServiceRegistry.h"
@@ -58,13 +59,14 @@ Implementation:
 #include "DataFormats/VertexReco/interface/Vertex.h"
 
 #include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
 #include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
 
 #include <iostream>
 #include <string>
 #include <fstream>
 
-#include "TH2F.h"
+#include "CNNFiltering/CNNAnalyze/interface/ClusterPad.h"
 #include "TTree.h"
 #include "DataFormats/DetId/interface/DetId.h"
 #include "DataFormats/SiPixelDetId/interface/PXBDetId.h"
@@ -109,6 +111,9 @@ private:
 
   float padHalfSize;
   int padSize, tParams, cnnLayers, infoSize;
+  double padMean, padSigma;
+
+  std::unique_ptr<DoubletCNN> cnn_; // native inference on the two layer channels, if cnnModelFile (and cnnWeightsFile) is given
 
   TTree* cnntree;
 
@@ -151,6 +156,25 @@ tpMap_(consumes<ClusterTPAssociation>(iConfig.getParameter<edm::InputTag>("tpMap
   tParams = 26;
   cnnLayers = 10;
   infoSize = 67;
+  padMean = 13382.0011321;
+  padSigma = 10525.1252954;
+
+  if(iConfig.existsAs<std::string>("cnnModelFile") && !iConfig.getParameter<std::string>("cnnModelFile").empty())
+  {
+    // a Keras model (JSON and HDF5 weights) if cnnWeightsFile is given, the DoubletCNN text format otherwise (int8 if calibrated by quantizeDoubletCNN)
+    const std::string weightsFile = iConfig.existsAs<std::string>("cnnWeightsFile") ? iConfig.getParameter<std::string>("cnnWeightsFile") : "";
+    if(weightsFile.empty())
+      cnn_ = std::make_unique<DoubletCNN>(iConfig.getParameter<std::string>("cnnModelFile"));
+    else
+      cnn_ = std::make_unique<DoubletCNN>(DoubletCNN::fromKeras(iConfig.getParameter<std::string>("cnnModelFile"), weightsFile));
+    if(int(cnn_->padSize()) != padSize || int(cnn_->channels()) != cnnLayers*2 || int(cnn_->infoSize()) != infoSize)
+      throw cms::Exception("Configuration") << "CNNInference: the model " << iConfig.getParameter<std::string>("cnnModelFile")
+                                            << " has input " << cnn_->padSize() << " x " << cnn_->padSize() << " x " << cnn_->channels()
+                                            << " and " << cnn_->infoSize() << " features, expected " << padSize << " x " << padSize
+                                            << " x " << cnnLayers*2 << " and " << infoSize;
+    // trained on (pad - padMean)/padSigma unless the model says otherwise: folded in, the raw pads are given
+    if(!cnn_->padsNormalized()) cnn_->normalizePads(padMean, padSigma);
+  }
 }
 
 
@@ -185,8 +209,6 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
   using namespace edm;
 
-  double padMean = 13382.0011321, padSigma = 10525.1252954;
-
   // int detOnArr[10] = {0,1,2,3,14,15,16,29,30,31};
   // std::vector<int> detOn(detOnArr,detOnArr+sizeof(detOnArr)/sizeof(int));
 
@@ -260,16 +282,15 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
   // edm::FileInPath modelFilePath();
   //tensorflow::GraphDef* graphDef = tensorflow::loadGraphDef("/lustre/home/adrianodif/jpsiphi/MCs/QCDtoPhiML/CMSSW_10_2_1/tmp/test_graph_tfadd.pb");
   //tensorflow::Session* session = tensorflow::createSession(graphDef);
-  tensorflow::GraphDef* graphDef = tensorflow::loadGraphDef("/lustre/home/adrianodif/CNNDoublets/CMSSW/CMSSW_10_3_0_pre4/test.pb");
-  tensorflow::Session* session = tensorflow::createSession(graphDef);
+  tensorflow::GraphDef* graphDef = cnn_ ? nullptr : tensorflow::loadGraphDef("/lustre/home/adrianodif/CNNDoublets/CMSSW/CMSSW_10_3_0_pre4/test.pb");
+  tensorflow::Session* session = cnn_ ? nullptr : tensorflow::createSession(graphDef);
 
 
   float ax1, ax2, deltaADC = 0.0, deltaPhi = 0.0, deltaR = 0.0, deltaA = 0.0, deltaS = 0.0, deltaZ = 0.0, zZero = 0.0;
 
-  std::vector < float > zeroPad;
-  for (int nx = 0; nx < padSize; ++nx)
-    for (int ny = 0; ny < padSize; ++ny)
-      zeroPad.push_back(0.0);
+  // each cluster pad is built once per event, raw for the dump and the native CNN, normalized for TF
+  clusterPad::Cache rawPads(padSize, padHalfSize), cnnPads(padSize, padHalfSize, padMean, padSigma);
+  const int padElements = padSize*padSize;
 
   for (std::vector<IntermediateHitDoublets::LayerPairHitDoublets>::const_iterator lIt = iHd->layerSetsBegin(); lIt != iHd->layerSetsEnd(); ++lIt)
   {
@@ -288,7 +309,11 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 
     int numOfDoublets = int(lIt->doublets().size());
 
-    tensorflow::Tensor inputPads(tensorflow::DT_FLOAT, {numOfDoublets,padSize,padSize,cnnLayers*2});
+    // TF takes the dense pads of all the layer channels, the native CNN only the inner and outer pads and their channels
+    tensorflow::Tensor inputPads(tensorflow::DT_FLOAT, {cnn_ ? 0 : numOfDoublets,padSize,padSize,cnnLayers*2});
+    DoubletCNN::Input cnnInput;
+    if(cnn_) cnnInput.resize(*cnn_, numOfDoublets);
+    std::vector<float> cnnOutputs;
     tensorflow::Tensor inputFeat(tensorflow::DT_FLOAT, {numOfDoublets,infoSize});
     std::vector<tensorflow::Tensor> outputs;
     std::vector<float> labels;
@@ -296,6 +321,14 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
     float* vPad = inputPads.flat<float>().data();
     float* vLab = inputFeat.flat<float>().data();
 
+    // element channel*padSize*padSize + pixel of the dense normalized pads of doublet i
+    auto padValue = [&](size_t i, int element) {
+      if(!cnn_) return vPad[element + (padSize*padSize*cnnLayers*2)*i];
+      for(int j = 0; j < 2; ++j)
+        if(int(cnnInput.channel(i, j)) == element/padElements) return float((cnnInput.pad(i, j)[element%padElements]-padMean)/padSigma);
+      return 0.f;
+    };
+
     int padCounter = 0;
     int infoCounter = 0;
 
@@ -305,8 +338,7 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       std::vector <unsigned int> hitIds, subDetIds, detSeqs;
 
       std::vector< std::vector< float>> hitPars,hitLabs;
-      std::vector< std::vector< float>> hitPads,inHitPads,outHitPads;
-      std::vector< float > inHitPars, outHitPars, inPad, outPad;
+      std::vector< float > inHitPars, outHitPars;
       std::vector< float > inHitLabs, outHitLabs;
       std::vector< float > inTP, outTP, theTP;
 
@@ -327,14 +359,8 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       // std::cout << numOfDoublets << std::endl;
 
 
-      inHitPads.clear();
-      outHitPads.clear();
-
-      for(int i = 0; i < cnnLayers; ++i)
-      {
-        inHitPads.push_back(zeroPad);
-        outHitPads.push_back(zeroPad);
-      }
+      // only the inner and outer layer channels are filled below
+      if(!cnn_) std::fill(vPad + doubOffset, vPad + doubOffset + padElements*cnnLayers*2, 0.f);
 
 
       deltaPhi = 0.0;
@@ -379,9 +405,6 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       hitPars.push_back(inHitPars);
       hitPars.push_back(outHitPars);
 
-      hitPads.push_back(inPad);
-      hitPads.push_back(outPad);
-
       hitLabs.push_back(inHitLabs);
       hitLabs.push_back(outHitLabs);
 
@@ -498,34 +521,21 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
         hitLabs[j].push_back((float)siHits[j]->hasBadPixels());
         hitLabs[j].push_back((float)siHits[j]->isOnEdge()); //31
 
-        //Cluster Pad
-        TH2F hClust("hClust","hClust",
-        padSize,
-        clusters[j]->x()-padHalfSize,
-        clusters[j]->x()+padHalfSize,
-        padSize,
-        clusters[j]->y()-padHalfSize,
-        clusters[j]->y()+padHalfSize);
-
-        //Initialization
-        for (int nx = 0; nx < padSize; ++nx)
-        for (int ny = 0; ny < padSize; ++ny)
-        hClust.SetBinContent(nx,ny,0.0);
-
-        for (int k = 0; k < clusters[j]->size(); ++k)
-        hClust.SetBinContent(hClust.FindBin((float)clusters[j]->pixel(k).x, (float)clusters[j]->pixel(k).y),(float)clusters[j]->pixel(k).adc);
-
-        //Linearizing the cluster
-
-        for (int ny = padSize; ny>0; --ny)
+        //Cluster Pad, raw for the dump and normalized in the layer channel of the CNN input
+        const float * rawPad = rawPads.get(clusters[j].key(), *clusters[j]);
+        hitPars[j].insert(hitPars[j].end(), rawPad, rawPad + padElements);
+        const int channel = j*cnnLayers + (j == 0 ? innerLayerId : outerLayerId);
+        if(cnn_)
         {
-          for(int nx = 0; nx<padSize; nx++)
-          {
-            int n = (ny+2)*(padSize + 2) - 2 -2 - nx - padSize; //see TH2 reference for clarification
-            hitPars[j].push_back(hClust.GetBinContent(n));
-            hitPads[j].push_back(hClust.GetBinContent(n));
-          }
+          std::copy(rawPad, rawPad + padElements, cnnInput.pad(i, j));
+          cnnInput.setChannel(i, j, channel);
         }
+        else
+        {
+          const float * cnnPad = cnnPads.get(clusters[j].key(), *clusters[j]);
+          std::copy(cnnPad, cnnPad + padElements, vPad + doubOffset + channel*padElements);
+        }
+        padCounter += padElements*cnnLayers;
 
 
 
@@ -540,10 +550,6 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
         deltaPhi -= phi; deltaPhi *= -1.0;
       }
 
-      for (int nx = 0; nx < padSize*padSize; ++nx)
-          inHitPads[innerLayerId][nx] = (hitPads[0][nx]- padMean)/padSigma;
-      for (int nx = 0; nx < padSize*padSize; ++nx)
-          outHitPads[outerLayerId][nx] = (hitPads[1][nx]- padMean)/padSigma;
       //
       // std::cout << "inHitPads.size()=" << inHitPads.size() <<std::endl;
       // std::cout << "outHitPads.size()=" << outHitPads.size() <<std::endl;
@@ -551,29 +557,6 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       // std::cout << "inHitPads[innerLayerId].size()=" << inHitPads[innerLayerId].size() <<std::endl;
       // std::cout << "outHitPads[outerLayerId].size()=" << outHitPads[outerLayerId].size() <<std::endl;
 
-      int thisOffset = 0;
-
-      for (int jc = 0; jc < 10; jc++)
-      {
-        thisOffset = jc * padSize*padSize;
-        for (int nx = 0; nx < padSize*padSize; nx++)
-        {
-          vPad[thisOffset + nx + doubOffset] = inHitPads[jc][nx];
-          padCounter++;
-        }
-      }
-
-      for (int jc = 0; jc < 10; jc++)
-      {
-        thisOffset = jc * padSize*padSize + 10 * padSize*padSize;
-        for (int nx = 0; nx < padSize*padSize; nx++)
-        {
-          vPad[thisOffset + nx + doubOffset ] = outHitPads[jc][nx];
-          padCounter++;
-        }
-      }
-
-
       // std::cout << "Inner hit layer : " << innerLayer->seqNum() << " - " << innerLayerId<< std::endl;
       //
       // for(int i = 0; i < cnnLayers; ++i)
@@ -896,6 +879,7 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       vLab[ 2 * hitLabs[0].size() + 4 + infoOffset] = deltaPhi ; infoCounter++;
       vLab[ 2 * hitLabs[0].size() + 5 + infoOffset] = deltaZ   ; infoCounter++;
       vLab[ 2 * hitLabs[0].size() + 6 + infoOffset] = zZero    ; infoCounter++;
+      if(cnn_) std::copy(vLab + infoOffset, vLab + infoOffset + infoSize, cnnInput.info(i));
 
       for (int j = 0; j < 2; j++)
         for (size_t i = 0; i < hitPars[j].size(); i++)
@@ -922,7 +906,7 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
       outTFFile << bs.x0() << "\t" << bs.y0() << "\t" << bs.z0() << "\t" << bs.sigmaZ() << "\t";
 
       for (int jc = 0; jc < cnnLayers*2*padSize*padSize; jc++)
-        outTFFile << vPad[jc + doubOffset] << "\t";
+        outTFFile << padValue(i, jc) << "\t";
 
       for (int ji = 0; ji < infoSize; ji++)
         outTFFile << vLab[ji + infoOffset] << "\t";
@@ -933,11 +917,14 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 
     }//end single doublet
 
-    tensorflow::run(session, { { "hit_shape_input", inputPads }, { "info_input", inputFeat } },
-                  { "output/Softmax" }, &outputs);
+    if(cnn_)
+      (*cnn_)(cnnInput, cnnOutputs);
+    else
+      tensorflow::run(session, { { "hit_shape_input", inputPads }, { "info_input", inputFeat } },
+                    { "output/Softmax" }, &outputs);
 
     std::cout << "START" << std::endl;
-    std::cout << outputs[0].DebugString() << std::endl;
+    if(!cnn_) std::cout << outputs[0].DebugString() << std::endl;
     std::cout << outputs.size() << std::endl;
     std::cout << labels.size() << std::endl;
     std::cout << infoCounter << " - " << inputFeat.DebugString() << std::endl;
@@ -951,8 +938,8 @@ CNNInference::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 
     for (size_t i = 0; i < labels.size(); i++)
     {
-      float outs = outputs[0].matrix<float>()(i,0);
-      float outs2 = outputs[0].matrix<float>()(i,1);
+      float outs = cnn_ ? cnnOutputs[i*2] : outputs[0].matrix<float>()(i,0);
+      float outs2 = cnn_ ? cnnOutputs[i*2+1] : outputs[0].matrix<float>()(i,1);
       outInference << outs << " - " << outs2 << " - " << labels[i] << std::endl;
     }
 
@@ -64,7 +64,7 @@ Implementation:
 #include <string>
 #include <fstream>
 
-#include "TH2F.h"
+#include "CNNFiltering/CNNAnalyze/interface/ClusterPad.h"
 #include "TTree.h"
 #include "DataFormats/DetId/interface/DetId.h"
 #include "DataFormats/SiPixelDetId/interface/PXBDetId.h"
@@ -647,22 +647,6 @@ CNNTrackAnalyze::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup
           ovfy[i] =(double)clust->sizeY() > padSize;
           ratio[i] =(double)(clust->sizeY()) / (double)(clust->sizeX());
 
-          TH2F hClust("hClust","hClust",
-          padSize,
-          clust->x()-padHalfSize,
-          clust->x()+padHalfSize,
-          padSize,
-          clust->y()-padHalfSize,
-          clust->y()+padHalfSize);
-
-          //Initialization
-          for (int nx = 0; nx < padSize; ++nx)
-            for (int ny = 0; ny < padSize; ++ny)
-              hClust.SetBinContent(nx,ny,0.0);
-
-          for (int k = 0; k < clust->size(); ++k)
-            hClust.SetBinContent(hClust.FindBin((float)clust->pixel(k).x, (float)clust->pixel(k).y),(float)clust->pixel(k).adc);
-
 
           auto rangeIn = tpClust->equal_range(h->firstClusterRef());
 
@@ -692,17 +676,7 @@ CNNTrackAnalyze::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup
             }
 
 
-          int c = 0;
-          for (int ny = padSize; ny>0; --ny)
-          {
-            for(int nx = 0; nx<padSize; nx++)
-            {
-
-              int n = (ny+2)*(padSize + 2) - 2 -2 - nx - padSize; //see TH2 reference for clarification
-              hitPixels[i][c] = (double)hClust.GetBinContent(n);
-              c++;
-            }
-          }
+          clusterPad::fill(*clust, padSize, padHalfSize, hitPixels[i].data());
 
         }
     }
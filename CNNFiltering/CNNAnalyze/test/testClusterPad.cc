@@ -0,0 +1,132 @@
+// Regression test of clusterPad::fill: the pads are compared, element by
+// element, with the TH2F histograms formerly filled for each hit by
+// CNNInference, CNNAnalyze and the track analyzers, for both pad sizes in
+// use (16 with padHalfSize 8, 15 with padHalfSize 7.5). Random clusters with
+// fractional centers, pixels on the bin edges and out of the pad, and
+// repeated pixels are generated. The event cache (clusterPad::Cache) is
+// checked against fill. The first mismatch is reported and the test fails.
+
+#include "CNNFiltering/CNNAnalyze/interface/ClusterPad.h"
+
+#include "TH1.h"
+#include "TH2F.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+  struct Pixel { int x; int y; int adc; };
+
+  struct Cluster {
+    float cx, cy;
+    std::vector<Pixel> pixels;
+    float x() const { return cx; }
+    float y() const { return cy; }
+    int size() const { return pixels.size(); }
+    Pixel pixel(int k) const { return pixels[k]; }
+  };
+
+  // the former implementation, as in CNNAnalyze
+  std::vector<float> reference(const Cluster& cluster, int padSize, float padHalfSize, double mean, double sigma) {
+    TH2F hClust("hClust","hClust",
+                padSize,
+                cluster.x()-padHalfSize,
+                cluster.x()+padHalfSize,
+                padSize,
+                cluster.y()-padHalfSize,
+                cluster.y()+padHalfSize);
+
+    for (int nx = 0; nx < padSize; ++nx)
+      for (int ny = 0; ny < padSize; ++ny)
+        hClust.SetBinContent(nx,ny,0.0);
+
+    for (int k = 0; k < cluster.size(); ++k)
+      hClust.SetBinContent(hClust.FindBin((float)cluster.pixel(k).x, (float)cluster.pixel(k).y),(float)cluster.pixel(k).adc);
+
+    std::vector<float> pad;
+    for (int ny = padSize; ny>0; --ny)
+      for (int nx = 0; nx<padSize; nx++) {
+        int n = (ny+2)*(padSize + 2) - 2 -2 - nx - padSize;
+        pad.push_back((hClust.GetBinContent(n)-mean)/sigma);
+      }
+    return pad;
+  }
+
+  Cluster randomCluster(std::mt19937& gen, float padHalfSize) {
+    std::uniform_int_distribution<int> center(0, 400);
+    std::uniform_int_distribution<int> fraction(0, 8);
+    std::uniform_int_distribution<int> spread(-int(padHalfSize)-2, int(padHalfSize)+2);
+    std::uniform_int_distribution<int> nPixels(1, 40);
+    std::uniform_int_distribution<int> adc(1000, 60000);
+
+    Cluster cluster;
+    // centers on the pixel grid, on the half pixel and in between
+    cluster.cx = center(gen) + fraction(gen)/8.f;
+    cluster.cy = center(gen) + fraction(gen)/8.f;
+    const int n = nPixels(gen);
+    for (int k = 0; k < n; ++k)
+      cluster.pixels.push_back(Pixel{int(cluster.cx)+spread(gen), int(cluster.cy)+spread(gen), adc(gen)});
+    // same pixel twice: the last one wins
+    cluster.pixels.push_back(cluster.pixels.front());
+    cluster.pixels.back().adc += 1;
+    return cluster;
+  }
+
+  bool check(const Cluster& cluster, int padSize, float padHalfSize, double mean, double sigma) {
+    const auto expected = reference(cluster, padSize, padHalfSize, mean, sigma);
+    std::vector<float> pad(padSize*padSize, -1.f);
+    clusterPad::fill(cluster, padSize, padHalfSize, pad.data(), mean, sigma);
+    for (int i = 0; i < padSize*padSize; ++i) {
+      if (pad[i] != expected[i]) {
+        std::printf("mismatch: padSize %d center (%g, %g) element %d: %g expected %g\n",
+                    padSize, cluster.x(), cluster.y(), i, pad[i], expected[i]);
+        return false;
+      }
+    }
+    return true;
+  }
+
+}
+
+int main() {
+  TH1::AddDirectory(false);
+  std::mt19937 gen(12345);
+
+  const struct { int padSize; float padHalfSize; } pads[] = {{16, 8.f}, {15, 7.5f}};
+  unsigned int tested = 0;
+  for (const auto& p: pads) {
+    for (int i = 0; i < 2000; ++i) {
+      const auto cluster = randomCluster(gen, p.padHalfSize);
+      if (!check(cluster, p.padSize, p.padHalfSize, 0., 1.)) return 1;
+      // normalization as in CNNInference
+      if (!check(cluster, p.padSize, p.padHalfSize, 13382.0011321, 10525.1252954)) return 1;
+      ++tested;
+    }
+  }
+
+  // the cache builds each pad once and returns the same content as fill
+  std::vector<Cluster> clusters;
+  for (int i = 0; i < 50; ++i) clusters.push_back(randomCluster(gen, 8.f));
+  clusterPad::Cache cache(16, 8.f, 13382.0011321, 10525.1252954);
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int i = 49; i >= 0; i -= 1 + pass) {
+      std::vector<float> pad(16*16);
+      clusterPad::fill(clusters[i], 16, 8.f, pad.data(), 13382.0011321, 10525.1252954);
+      const float * cached = cache.get(2*i, clusters[i]);
+      if (!std::equal(pad.begin(), pad.end(), cached)) {
+        std::printf("cache mismatch: cluster %d pass %d\n", i, pass);
+        return 1;
+      }
+    }
+  }
+  if (cache.size() != 50) {
+    std::printf("cache built %u pads, expected 50\n", cache.size());
+    return 1;
+  }
+
+  std::printf("%u clusters compared, OK\n", tested);
+  return 0;
+}
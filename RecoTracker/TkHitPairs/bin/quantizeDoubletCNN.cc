@@ -0,0 +1,228 @@
+// Calibration of the int8 path of a DoubletCNN model on the doublets dumped
+// by CNNInference (outCNNFile, the *_dnn_doublets.txt files), and comparison
+// with the float model on doublets not used for the calibration.
+//
+// usage: quantizeDoubletCNN [-w weights.h5] [-f fraction] [-c coverage] [-t threshold] [-n doublets]
+//                           model output dump [dump ...]
+//
+// The model is a DoubletCNN text file, or the Keras JSON of the model if
+// its weights are given with -w. The first fraction (0.5 by default) of the
+// doublets read from the dumps calibrates the model, which is written to
+// output in the text format; the others are scored by the float and the int8
+// model. The model takes the raw pads, as in CNNInference: the pad
+// normalization of CNNInference is folded in if the model has none. The AUC,
+// the efficiency and fake rate at the threshold (0.5), the decisions changed,
+// the score differences and the time per doublet are reported. -n reads at
+// most that many doublets.
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  double nsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now()-start).count();
+  }
+
+  // dump layout, see CNNInference::analyze and CNNAnalyze/python/dataset.py
+  const int pixelDets[] = {0,1,2,3,14,15,16,29,30,31};
+  const unsigned int cnnLayers = 10;
+  const unsigned int headColumns = 10;       // run, event, lumi, PU, inner and outer seqNum, beam spot
+  const unsigned int hitFeatures = 29;       // position, module, orientation and cluster features
+  const unsigned int differences = 7;        // deltaA, deltaADC, deltaS, deltaR, deltaPhi, deltaZ, zZero
+  const double padMean = 13382.0011321, padSigma = 10525.1252954;
+
+  struct Doublets {
+    unsigned int padElements = 0, infoSize = 0;
+    std::vector<float> pads;                 // raw pads, inner and outer
+    std::vector<unsigned int> channels;
+    std::vector<float> info;
+    std::vector<char> labels;
+    size_t size() const { return labels.size(); }
+  };
+
+  void read(const std::string& fileName, Doublets& doublets, size_t maxDoublets) {
+    std::ifstream file(fileName);
+    if(!file)
+      throw cms::Exception("quantizeDoubletCNN") << "cannot open " << fileName;
+    const unsigned int hitColumns = hitFeatures + doublets.padElements + 1;
+    const unsigned int labelColumn = headColumns + 2*hitColumns + differences;
+    std::string line;
+    std::vector<double> columns;
+    for(unsigned int lineNumber = 1; std::getline(file, line) && doublets.size() < maxDoublets; ++lineNumber) {
+      std::istringstream in(line);
+      columns.clear();
+      for(double x; in >> x;) columns.push_back(x);
+      if(columns.empty()) continue;
+      if(columns.size() <= labelColumn)
+        throw cms::Exception("quantizeDoubletCNN") << fileName << ":" << lineNumber << ": " << columns.size()
+                                                   << " columns, expected more than " << labelColumn;
+      const double *hits[2] = {columns.data() + headColumns, columns.data() + headColumns + hitColumns};
+      for(unsigned int j = 0; j != 2; ++j) {
+        const int seqNum = int(columns[4+j]);
+        const unsigned int layerId = std::find(pixelDets, pixelDets + cnnLayers, seqNum) - pixelDets;
+        if(layerId == cnnLayers)
+          throw cms::Exception("quantizeDoubletCNN") << fileName << ":" << lineNumber << ": layer " << seqNum << " is not a pixel layer";
+        doublets.channels.push_back(j*cnnLayers + layerId);
+        doublets.pads.insert(doublets.pads.end(), hits[j] + hitFeatures, hits[j] + hitFeatures + doublets.padElements);
+      }
+      // info_input: the features and the ADC sum of each hit, then the differences
+      for(unsigned int j = 0; j != 2; ++j) {
+        doublets.info.insert(doublets.info.end(), hits[j], hits[j] + hitFeatures);
+        doublets.info.push_back(hits[j][hitColumns-1]);
+      }
+      doublets.info.insert(doublets.info.end(), columns.begin() + labelColumn - differences, columns.begin() + labelColumn);
+      doublets.labels.push_back(columns[labelColumn] != -1.);
+    }
+  }
+
+  void fill(const DoubletCNN& model, const Doublets& doublets, size_t begin, size_t end, DoubletCNN::Input& input) {
+    input.resize(model, end-begin);
+    for(size_t i = begin; i != end; ++i) {
+      for(unsigned int j = 0; j != 2 && model.channels(); ++j) {
+        const float *pad = doublets.pads.data() + (2*i+j)*doublets.padElements;
+        std::copy_n(pad, doublets.padElements, input.pad(i-begin, j));
+        input.setChannel(i-begin, j, doublets.channels[2*i+j]);
+      }
+      std::copy_n(doublets.info.data() + i*doublets.infoSize, doublets.infoSize, input.info(i-begin));
+    }
+  }
+
+  // the last output, the probability of a true doublet
+  std::vector<float> scores(const DoubletCNN& model, const DoubletCNN::Input& input, double& ns) {
+    std::vector<float> outputs;
+    const auto start = Clock::now();
+    model(input, outputs);
+    ns = nsSince(start);
+    std::vector<float> result(input.size());
+    for(unsigned int i = 0; i != input.size(); ++i)
+      result[i] = outputs[(i+1)*model.outputs() - 1];
+    return result;
+  }
+
+  // area under the ROC curve, from the ranks of the true doublets (ties get their average rank)
+  double auc(const std::vector<float>& scores, const std::vector<char>& labels, size_t begin) {
+    std::vector<unsigned int> order(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return scores[a] < scores[b]; });
+    double rankSum = 0, positives = 0;
+    for(size_t i = 0; i != order.size();) {
+      size_t j = i;
+      while(j != order.size() && scores[order[j]] == scores[order[i]]) ++j;
+      const double rank = 0.5*(i+1 + j);
+      for(; i != j; ++i)
+        if(labels[begin + order[i]]) { rankSum += rank; ++positives; }
+    }
+    const double negatives = scores.size() - positives;
+    if(positives == 0 || negatives == 0) return 0;
+    return (rankSum - positives*(positives+1)/2)/(positives*negatives);
+  }
+
+  struct Rates { double efficiency = 0, fakeRate = 0; };
+
+  Rates rates(const std::vector<float>& scores, const std::vector<char>& labels, size_t begin, float threshold) {
+    double positives = 0, negatives = 0, truePassed = 0, fakePassed = 0;
+    for(size_t i = 0; i != scores.size(); ++i) {
+      const bool passed = scores[i] >= threshold;
+      if(labels[begin+i]) { ++positives; truePassed += passed; }
+      else { ++negatives; fakePassed += passed; }
+    }
+    Rates result;
+    result.efficiency = positives ? truePassed/positives : 0;
+    result.fakeRate = negatives ? fakePassed/negatives : 0;
+    return result;
+  }
+}
+
+int main(int argc, char ** argv) {
+  std::string weights;
+  double fraction = 0.5, coverage = 0.9999;
+  float threshold = 0.5f;
+  size_t maxDoublets = size_t(-1);
+  std::vector<std::string> files;
+  for(int i=1; i<argc; ++i) {
+    if(std::strcmp(argv[i], "-w") == 0 && i+1 < argc) weights = argv[++i];
+    else if(std::strcmp(argv[i], "-f") == 0 && i+1 < argc) fraction = std::atof(argv[++i]);
+    else if(std::strcmp(argv[i], "-c") == 0 && i+1 < argc) coverage = std::atof(argv[++i]);
+    else if(std::strcmp(argv[i], "-t") == 0 && i+1 < argc) threshold = std::atof(argv[++i]);
+    else if(std::strcmp(argv[i], "-n") == 0 && i+1 < argc) maxDoublets = std::max(1L, std::atol(argv[++i]));
+    else files.emplace_back(argv[i]);
+  }
+  if(files.size() < 3 || fraction <= 0 || fraction >= 1) {
+    std::cerr << "usage: quantizeDoubletCNN [-w weights.h5] [-f fraction] [-c coverage] [-t threshold] [-n doublets]"
+              << " model output dump [dump ...]" << std::endl;
+    return 1;
+  }
+
+  try {
+    DoubletCNN model = weights.empty() ? DoubletCNN(files[0]) : DoubletCNN::fromKeras(files[0], weights);
+    if(model.infoSize() != 2*(hitFeatures+1) + differences || (model.channels() && model.channels() != 2*cnnLayers))
+      throw cms::Exception("quantizeDoubletCNN") << files[0] << " has " << model.channels() << " channels and "
+                                                 << model.infoSize() << " features, expected " << 2*cnnLayers
+                                                 << " (or 0) and " << 2*(hitFeatures+1) + differences;
+    model.clearCalibration();
+    // as CNNInference, the raw pads
+    if(!model.padsNormalized()) model.normalizePads(padMean, padSigma);
+
+    Doublets doublets;
+    doublets.padElements = model.padSize()*model.padSize();
+    doublets.infoSize = model.infoSize();
+    for(size_t i = 2; i != files.size(); ++i)
+      read(files[i], doublets, maxDoublets);
+    const size_t calibrationSize = doublets.size()*fraction, testSize = doublets.size() - calibrationSize;
+    if(calibrationSize == 0 || calibrationSize == doublets.size())
+      throw cms::Exception("quantizeDoubletCNN") << doublets.size() << " doublets read, too few to split";
+
+    DoubletCNN::Input calibration, test;
+    fill(model, doublets, 0, calibrationSize, calibration);
+    fill(model, doublets, calibrationSize, doublets.size(), test);
+
+    double nsFloat = 0, nsInt8 = 0;
+    const std::vector<float> floatScores = scores(model, test, nsFloat);
+    model.calibrate(calibration, coverage);
+    const std::vector<float> int8Scores = scores(model, test, nsInt8);
+    model.write(files[1]);
+
+    size_t flips = 0;
+    double maxDiff = 0, sumDiff = 0;
+    for(size_t i = 0; i != floatScores.size(); ++i) {
+      flips += (floatScores[i] >= threshold) != (int8Scores[i] >= threshold);
+      const double diff = std::abs(int8Scores[i] - floatScores[i]);
+      maxDiff = std::max(maxDiff, diff);
+      sumDiff += diff;
+    }
+    const size_t trueDoublets = std::count(doublets.labels.begin() + calibrationSize, doublets.labels.end(), 1);
+    const Rates floatRates = rates(floatScores, doublets.labels, calibrationSize, threshold);
+    const Rates int8Rates = rates(int8Scores, doublets.labels, calibrationSize, threshold);
+
+    std::printf("quantizeDoubletCNN: %zu calibration doublets, %zu test doublets (%zu true), int8 kernel %s\n",
+                calibrationSize, testSize, trueDoublets, DoubletCNN::int8Kernel());
+    std::printf("                        float       int8\n");
+    std::printf("  AUC               %9.5f  %9.5f\n", auc(floatScores, doublets.labels, calibrationSize),
+                auc(int8Scores, doublets.labels, calibrationSize));
+    std::printf("  efficiency @ %.2f %9.5f  %9.5f\n", threshold, floatRates.efficiency, int8Rates.efficiency);
+    std::printf("  fake rate @ %.2f  %9.5f  %9.5f\n", threshold, floatRates.fakeRate, int8Rates.fakeRate);
+    std::printf("  ns/doublet        %9.1f  %9.1f\n", nsFloat/testSize, nsInt8/testSize);
+    std::printf("  decisions changed: %zu (%.4f%%), |score difference| max %.5f, mean %.6f\n",
+                flips, 100.*flips/testSize, maxDiff, sumDiff/testSize);
+    std::printf("  calibrated model written to %s\n", files[1].c_str());
+  } catch(cms::Exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
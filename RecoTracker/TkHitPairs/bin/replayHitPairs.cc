@@ -0,0 +1,110 @@
+// Offline replay of the doublet search on the inputs recorded by
+// HitPairEDProducer with recordFile set, no EventSetup or ROOT files needed.
+//
+// usage: replayHitPairs [-n repetitions] file [file ...]
+//
+// For every recorded layer pair the RecHitsSortedInPhi are rebuilt from the
+// recorded hit states and the doublets are searched again with the recorded
+// windows. The time spent and the number of doublets differing from the ones
+// found online are reported.
+
+#include "RecoTracker/TkHitPairs/interface/HitPairRecord.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  double nsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now()-start).count();
+  }
+
+  struct Summary {
+    long long events = 0, regions = 0, layerPairs = 0, outerHits = 0;
+    long long doublets = 0, mismatchedPairs = 0;
+    double nsBuild = 0, nsDoublets = 0;
+  };
+
+  void replay(const hitPairRecord::Event& event, int repetitions, Summary& summary) {
+    ++summary.events;
+    for(const auto& region: event.regions) {
+      ++summary.regions;
+
+      auto start = Clock::now();
+      std::vector<std::unique_ptr<RecHitsSortedInPhi> > maps;
+      for(const auto& layer: region.layers)
+        maps.emplace_back(std::make_unique<RecHitsSortedInPhi>(layer.hits, region.origin(), layer.barrel));
+      summary.nsBuild += nsSince(start);
+
+      for(const auto& pair: region.layerPairs) {
+        const RecHitsSortedInPhi& innerHitsMap = *maps.at(pair.inner);
+        const RecHitsSortedInPhi& outerHitsMap = *maps.at(pair.outer);
+        ++summary.layerPairs;
+        summary.outerHits += outerHitsMap.size();
+
+        HitDoublets result(innerHitsMap, outerHitsMap);
+        start = Clock::now();
+        for(int i=0; i!=repetitions; ++i) {
+          result.clear();
+          result.reserve(std::max(innerHitsMap.size(), outerHitsMap.size()));
+          hitPairRecord::doublets(innerHitsMap, outerHitsMap, pair.windows, pair.maxElement, pair.keepBest, result);
+        }
+        summary.nsDoublets += nsSince(start)/repetitions;
+        summary.doublets += result.size();
+
+        bool same = result.size() == pair.doublets.size();
+        for(size_t i=0; same && i!=result.size(); ++i)
+          same = result.innerHitId(i) == pair.doublets[i].first && result.outerHitId(i) == pair.doublets[i].second;
+        if(!same) {
+          ++summary.mismatchedPairs;
+          std::cout << "run " << event.run << " lumi " << event.lumi << " event " << event.event
+                    << ": layers " << region.layers[pair.inner].index << "," << region.layers[pair.outer].index
+                    << " replayed " << result.size() << " doublets, recorded " << pair.doublets.size() << std::endl;
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char ** argv) {
+  int repetitions = 1;
+  std::vector<std::string> files;
+  for(int i=1; i<argc; ++i) {
+    if(std::strcmp(argv[i], "-n") == 0 && i+1 < argc) repetitions = std::max(1, std::atoi(argv[++i]));
+    else files.emplace_back(argv[i]);
+  }
+  if(files.empty()) {
+    std::cerr << "usage: replayHitPairs [-n repetitions] file [file ...]" << std::endl;
+    return 1;
+  }
+
+  Summary summary;
+  try {
+    hitPairRecord::Event event;
+    for(const auto& file: files) {
+      hitPairRecord::Reader reader(file);
+      while(reader.read(event))
+        replay(event, repetitions, summary);
+    }
+  } catch(cms::Exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::printf("replayHitPairs: %lld events, %lld regions, %lld layer pairs, %.0f doublets/event\n",
+              summary.events, summary.regions, summary.layerPairs, double(summary.doublets)/std::max(summary.events, 1LL));
+  std::printf("  RecHitsSortedInPhi : %8.2f us/event\n", summary.nsBuild*1e-3/std::max(summary.events, 1LL));
+  std::printf("  doublets           : %8.2f us/event, %.2f ns/outer hit\n",
+              summary.nsDoublets*1e-3/std::max(summary.events, 1LL), summary.outerHits ? summary.nsDoublets/summary.outerHits : 0.);
+  std::printf("  layer pairs differing from the online doublets: %lld\n", summary.mismatchedPairs);
+  return summary.mismatchedPairs == 0 ? 0 : 2;
+}
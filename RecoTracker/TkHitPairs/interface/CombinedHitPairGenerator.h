@@ -18,6 +18,10 @@ namespace edm { class Event; class EventSetup; }
 
 /** \class CombinedHitPairGenerator
  * Hides set of HitPairGeneratorFromLayerPair generators.
+ * The layer maps are built once and the layer sets are processed concurrently,
+ * the doublets are concatenated in the layer-set order.
+ * With maxElementOverflow = "keepBest" (default "clear") each layer set keeps its best
+ * maxElement doublets instead of all the doublets being dropped when they reach maxElement.
  */
 
 class CombinedHitPairGenerator : public HitPairGenerator {
@@ -35,6 +39,10 @@ public:
 private:
   CombinedHitPairGenerator(const CombinedHitPairGenerator & cb); 
 
+  /// doublets of each layer set, in order
+  std::vector<std::unique_ptr<HitDoublets> > layerSetDoublets(const TrackingRegion& reg, const SeedingLayerSetsHits& layers,
+      const edm::Event& ev, const edm::EventSetup& es, LayerCacheType& layerCache);
+
   edm::EDGetTokenT<SeedingLayerSetsHits> theSeedingLayerToken;
 
   LayerCacheType   theLayerCache;
@@ -0,0 +1,222 @@
+#ifndef RecoTracker_TkHitPairs_DoubletCNN_h
+#define RecoTracker_TkHitPairs_DoubletCNN_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Native CPU inference of the doublet classifiers (layer map CNN and dense
+ * models), without a TensorFlow session.
+ *
+ * The models have an image input of padSize x padSize pixels and C
+ * channels (channels last, the first C/2 channels are the layers of the
+ * inner hit and the others the layers of the outer hit), a feature input
+ * (info_input), a chain of convolutions and max poolings on the image, then
+ * a chain of dense layers on the flattened image concatenated with the
+ * features. Models without image (C = 0) use the features only.
+ *
+ * Only two channels of the image are non zero for each doublet: the pad of
+ * the inner hit in the channel of its layer and the pad of the outer hit in
+ * the channel of its layer. The input is therefore given as these two pads
+ * and their channel indices, and the first layer (a convolution, or a dense
+ * layer on the flattened image) computes only their contribution, instead
+ * of running on C-2 channels of zeros.
+ *
+ * In the pads, most pixels are empty: 0, or (0 - mean)/sigma for normalized
+ * pads (Input::setBackground). The response of the first layer to a pad
+ * full of background is computed per channel when the model is loaded, and
+ * only the pixels different from the background are added, each scattering
+ * its value times the kernel into the outputs it reaches. Above
+ * scatterLimit() such pixels in the two pads, the first convolution is
+ * computed densely instead (im2col and matrix product).
+ *
+ * The model is read from a text file:
+ *   DoubletCNN 1
+ *   input padSize C F
+ * optionally followed by
+ *   normalize mean sigma
+ *   standardize
+ * the last with F means and F sigmas, the normalization of the pads and of
+ * the features in training (see normalizePads() and standardizeInfo()),
+ * then the layers, each as
+ *   conv k nin nout activation      ('same' padding, stride 1)
+ *   maxpool s                       ('same' padding, pool size and stride s)
+ *   dense nin nout activation
+ * where conv and dense are followed by their weights, in the order of the
+ * Keras kernels (k x k x nin x nout and nin x nout), and their nout biases.
+ * A layer can be followed by
+ *   affine n
+ * and n scales and n shifts, applied per channel (feature) to its outputs
+ * after the activation, and by
+ *   quantize min max
+ * the calibrated range of its inputs for the int8 path. The file ends with
+ *   end
+ * The activations are linear, relu, sigmoid and softmax. The convolutions
+ * and poolings must come before the dense layers.
+ *
+ * fromKeras() reads the Keras model (JSON topology, HDF5 weights) of the
+ * doublet classifiers directly: Dropout is dropped and BatchNormalization is
+ * folded in the weights of the preceding layer (linear activation) or of the
+ * following dense layer, otherwise it becomes the affine of the preceding
+ * layer, moved after a following max pooling when its scales are positive.
+ * write() saves the model in the text format.
+ *
+ * normalizePads() and standardizeInfo() fold the normalization of the
+ * inputs used in training, (x - mean)/sigma, into the weights and biases of
+ * the layer reading them, so that the model takes the raw pads and
+ * features. The pad weights of the first layer are divided by sigma and the
+ * mean is kept as an offset of the pads, added with the background maps
+ * above: the raw pads keep their empty pixels at 0 and need no pass over
+ * their pixels.
+ *
+ * calibrate() enables the int8 path for the convolutions and dense layers
+ * after the first one (the first one reads the sparse pads, see above):
+ * their inputs are quantized to 0..127 with a zero point over the range seen
+ * on a sample of doublets, their weights to -127..127 with one scale per
+ * output channel, the products are summed in int32 (AVX-VNNI or AVX512-VNNI,
+ * AVX2 or generic code, chosen at run time) and the outputs are float again.
+ * The 7 bit inputs keep the AVX2 pairwise sums below the int16 saturation.
+ */
+class DoubletCNN {
+public:
+  explicit DoubletCNN(const std::string& fileName);
+
+  enum class Activation { linear, relu, sigmoid, softmax };
+
+  struct Layer {
+    enum Type { conv, maxpool, dense };
+    Type type;
+    unsigned int size = 0;          ///< kernel size (conv), pool size (maxpool)
+    unsigned int nin = 0, nout = 0; ///< channels (conv), features (dense)
+    Activation activation = Activation::linear;
+    std::vector<float> weights;
+    std::vector<float> biases;
+    std::vector<float> scale, shift; ///< per output channel (feature) after the activation, empty if none
+    float inputMin = 0.f, inputMax = 0.f; ///< input range of the int8 path, float if equal
+  };
+
+  DoubletCNN(unsigned int padSize, unsigned int channels, unsigned int infoSize, std::vector<Layer> layers);
+
+  /// the model saved by Keras (model.to_json() and save() or save_weights())
+  static DoubletCNN fromKeras(const std::string& jsonFile, const std::string& h5File);
+  void write(const std::string& fileName) const;
+
+  /// a batch of doublets
+  class Input {
+  public:
+    Input() = default;
+    Input(const DoubletCNN& model, unsigned int size) { resize(model, size); }
+
+    void resize(const DoubletCNN& model, unsigned int size);
+    unsigned int size() const { return size_; }
+    unsigned int padElements() const { return padElements_; }
+    unsigned int infoSize() const { return infoSize_; }
+
+    /// pad of the inner (j = 0) or outer (j = 1) hit of doublet i, row major
+    float *pad(unsigned int i, unsigned int j) { return pads_.data() + (2*i+j)*padElements_; }
+    const float *pad(unsigned int i, unsigned int j) const { return pads_.data() + (2*i+j)*padElements_; }
+    /// image channel of the pad, the layer id of the inner hit and C/2 + the layer id of the outer hit
+    void setChannel(unsigned int i, unsigned int j, unsigned int channel) { channels_[2*i+j] = channel; }
+    unsigned int channel(unsigned int i, unsigned int j) const { return channels_[2*i+j]; }
+    /// value of the empty pixels of all the pads, 0 by default
+    void setBackground(float background) { background_ = background; }
+    float background() const { return background_; }
+    /// features of doublet i
+    float *info(unsigned int i) { return info_.data() + i*infoSize_; }
+    const float *info(unsigned int i) const { return info_.data() + i*infoSize_; }
+
+  private:
+    unsigned int size_ = 0, padElements_ = 0, infoSize_ = 0;
+    float background_ = 0.f;
+    std::vector<float> pads_;
+    std::vector<unsigned int> channels_;
+    std::vector<float> info_;
+  };
+
+  /// outputs()-many values for each doublet, e.g. the two softmax probabilities
+  void operator()(const Input& input, std::vector<float>& outputs) const;
+
+  unsigned int padSize() const { return padSize_; }
+  unsigned int channels() const { return channels_; }
+  unsigned int infoSize() const { return infoSize_; }
+  unsigned int outputs() const { return layers_.back().nout; }
+  const std::vector<Layer>& layers() const { return layers_; }
+
+  /// the model takes the raw pads, (pad - mean)/sigma in training
+  void normalizePads(float mean, float sigma);
+  bool padsNormalized() const { return padsNormalized_; }
+  /// the model takes the raw features, (info[f] - means[f])/sigmas[f] in training; drops the calibration of the layer reading them
+  void standardizeInfo(const std::vector<float>& means, const std::vector<float>& sigmas);
+
+  /// pixels different from the background in the two pads above which the first convolution is dense
+  unsigned int scatterLimit() const { return scatterLimit_; }
+  void setScatterLimit(unsigned int pixels) { scatterLimit_ = pixels; }
+
+  /// int8 inputs of the layers after the first, over the range of a fraction coverage of their values on the sample
+  void calibrate(const Input& sample, double coverage = 0.9999);
+  /// back to float for all the layers
+  void clearCalibration();
+  bool quantized() const { return !int8_.empty(); }
+
+  /// int8 dot product in use (vnni, avx2 or generic), for all the models; false if not available on this CPU
+  static const char *int8Kernel();
+  static bool setInt8Kernel(const std::string& name);
+
+private:
+  struct Workspace {
+    std::vector<float> a, b;        // activations
+    std::vector<float> columns;     // im2col of the two pads
+    std::vector<float> weights;     // first convolution weights of the two channels
+    std::vector<uint8_t> quantized; // int8 path: layer inputs
+    std::vector<uint8_t> patch;     // int8 path: convolution inputs of an output pixel
+  };
+
+  // int8 weights, output = scales[o]*dot(inputs, weights[o]) + offsets[o]
+  struct Int8Layer {
+    unsigned int depth = 0;         // inputs per output, padded to 32, 0 if float
+    float inputScale = 0.f;
+    int zero = 0;
+    std::vector<int8_t> weights;
+    std::vector<float> scales, offsets;
+  };
+
+  // sees the inputs of each layer
+  typedef void (*Observer)(void *context, unsigned int layer, const float *in, unsigned int n);
+
+  void init(const std::string& source);
+  void evaluate(const Input& input, unsigned int i, Workspace& work, float *output,
+                Observer observer = nullptr, void *context = nullptr) const;
+  void makeBackgroundMaps();
+  void quantize();
+
+  void firstConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background,
+                 Workspace& work, float *out) const;
+  void scatterConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background, float *out) const;
+  void im2colConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], Workspace& work, float *out) const;
+  void firstDense(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background,
+                  const float *info, float *out) const;
+  static void conv(const Layer& layer, const float *in, unsigned int size, float *out);
+  static void maxpool(const Layer& layer, const float *in, unsigned int size, unsigned int channels, float *out);
+  static void dense(const Layer& layer, const float *in, float *out);
+  static void activate(Activation activation, float *x, unsigned int n, unsigned int nout);
+  static void affine(const Layer& layer, float *x, unsigned int n);
+  static void int8Conv(const Layer& layer, const Int8Layer& q, const float *in, unsigned int size, Workspace& work, float *out);
+  static void int8Dense(const Layer& layer, const Int8Layer& q, const float *in, Workspace& work, float *out);
+
+  unsigned int padSize_ = 0;
+  unsigned int channels_ = 0;
+  unsigned int infoSize_ = 0;
+  unsigned int imageLayers_ = 0;  // conv and maxpool layers at the front
+  unsigned int flatSize_ = 0;     // flattened image after imageLayers_
+  unsigned int bufferSize_ = 0;   // largest activation
+  unsigned int scatterLimit_ = 0;
+  float padOffset_ = 0.f;         // added to the pads by the first layer, -mean after normalizePads()
+  bool padsNormalized_ = false;
+  std::vector<Layer> layers_;
+  // per channel, first layer outputs (without bias) for a pad with all the pixels at 1
+  std::vector<float> backgroundMaps_;
+  std::vector<Int8Layer> int8_;     // per layer, empty if no layer is quantized
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef RecoTracker_TkHitPairs_DoubletCellularAutomaton_h
+#define RecoTracker_TkHitPairs_DoubletCellularAutomaton_h
+
+#include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+
+#include <array>
+#include <vector>
+
+/**
+ * Cellular automaton on the doublets of one TrackingRegion, used by
+ * HitDoubletCAEDProducer.
+ *
+ * Each doublet is a cell. A cell is the inner neighbour of another cell if
+ * its outer hit is the inner hit of the other one and the three hits are
+ * aligned in RZ and compatible with a circle of at least the region ptMin.
+ * The neighbours are found through the list of the cells starting from each
+ * hit (CSR, built with a counting sort over the cells), so the work is
+ * linear in the number of cells and connections.
+ *
+ * The evolution assigns to each cell the length of the longest chain of
+ * cells ending on it, without limit, so that the states decrease by one
+ * along the chains. From each cell without outer neighbours the chains are
+ * followed inwards with decreasing state for at most maxHits-1 cells, and
+ * their hits are emitted as ntuplets if they are at least minHits: longer
+ * chains give the ntuplet of their outermost maxHits hits.
+ *
+ * Hits and cells are stored as structure of arrays; the hits of the maps
+ * used by the doublets are numbered map after map.
+ */
+class DoubletCellularAutomaton {
+public:
+  /// hits of an ntuplet, from the innermost, as indices for hit() and r()
+  struct Ntuplet {
+    unsigned int nHits;
+    std::array<unsigned int, 4> hits;
+  };
+
+  /// keep, if not null, tells for each doublet, starting from doubletOffset, if it is used;
+  /// doubletOffset is advanced by the number of doublets of layerPairs
+  void build(const std::vector<const HitDoublets *>& layerPairs, const std::vector<bool> *keep, unsigned int& doubletOffset);
+  /// invBz is 1/(c B) in cm/GeV (MagneticField::inverseBzAtOriginInGeV(), about 87.8 at 3.8 T)
+  void connect(float ptMin, float invBz, float thetaCut);
+  /// iterates until the states converge (at most nCells() iterations, in case of cycles)
+  void evolve();
+  /// appends the ntuplets of minHits to maxHits (at most 4) hits
+  void findNtuplets(unsigned int minHits, unsigned int maxHits, std::vector<Ntuplet>& ntuplets) const;
+
+  unsigned int nCells() const { return innerHit_.size(); }
+  RecHitsSortedInPhi::Hit hit(unsigned int h) const { return hits_[h]; }
+  float r(unsigned int h) const { return r_[h]; }
+
+private:
+  bool areAligned(unsigned int inner, unsigned int outer, float ptMin, float minRadius, float thetaCut) const;
+  void followInwards(unsigned int cell, unsigned int maxCells, std::vector<unsigned int>& path,
+                     unsigned int minHits, std::vector<Ntuplet>& ntuplets) const;
+
+  // hits
+  std::vector<const RecHitsSortedInPhi *> maps_;
+  std::vector<unsigned int> mapOffsets_;
+  std::vector<float> x_, y_, z_, r_;
+  std::vector<RecHitsSortedInPhi::Hit> hits_;
+
+  // cells
+  std::vector<unsigned int> innerHit_, outerHit_;
+  std::vector<unsigned int> state_, stateTmp_;
+
+  // cells starting from each hit (CSR)
+  std::vector<unsigned int> cellsFromHitOffsets_, cellsFromHit_;
+
+  // inner and outer neighbours of each cell (CSR)
+  std::vector<unsigned int> innerNeighbourOffsets_, innerNeighbours_;
+  std::vector<unsigned int> nOuterNeighbours_;
+};
+
+#endif
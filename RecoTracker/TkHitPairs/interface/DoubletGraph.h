@@ -0,0 +1,88 @@
+#ifndef RecoTracker_TkHitPairs_DoubletGraph_h
+#define RecoTracker_TkHitPairs_DoubletGraph_h
+
+#include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
+
+#include <vector>
+
+/**
+ * The doublets of an event as a directed graph, in CSR form.
+ *
+ * The nodes are the hits of the layer maps (RecHitsSortedInPhi) used by the
+ * doublets, one set of nodes per TrackingRegion, and the edges are the
+ * doublets, from the inner to the outer hit. The edges of node i are
+ * [edgeOffsets()[i], edgeOffsets()[i+1]), their outer nodes are in
+ * outerNodes(); edges of the same node keep the order of the layer pairs and
+ * of the doublets in IntermediateHitDoublets.
+ *
+ * Node features and edge origins are stored as structure of arrays, so that
+ * the consumers can loop over them without going through the
+ * region/layer-pair iterators.
+ */
+class DoubletGraph {
+public:
+  using Hit = RecHitsSortedInPhi::Hit;
+  using LayerIndex = SeedingLayerSetsHits::LayerIndex;
+
+  /// layer pair of a region, the edges refer to it with their layerPair index
+  struct LayerPair {
+    const TrackingRegion *region;
+    unsigned int regionIndex;
+    LayerIndex innerLayer;
+    LayerIndex outerLayer;
+  };
+
+  DoubletGraph() = default;
+  ~DoubletGraph() = default;
+
+  /// builds the graph in time linear in the number of hits and doublets
+  void fill(const IntermediateHitDoublets& doublets);
+  void clear();
+
+  unsigned int nNodes() const { return hits_.size(); }
+  unsigned int nEdges() const { return outerNodes_.size(); }
+  unsigned int nRegions() const { return regionNodeOffsets_.empty() ? 0 : regionNodeOffsets_.size()-1; }
+
+  /// nodes of region i are [regionNodeOffsets()[i], regionNodeOffsets()[i+1])
+  const std::vector<unsigned int>& regionNodeOffsets() const { return regionNodeOffsets_; }
+
+  // CSR adjacency
+  const std::vector<unsigned int>& edgeOffsets() const { return edgeOffsets_; }
+  const std::vector<unsigned int>& outerNodes() const { return outerNodes_; }
+  unsigned int degree(unsigned int node) const { return edgeOffsets_[node+1]-edgeOffsets_[node]; }
+
+  // node features
+  const std::vector<float>& x() const { return x_; }
+  const std::vector<float>& y() const { return y_; }
+  const std::vector<float>& z() const { return z_; }
+  const std::vector<float>& r() const { return r_; }
+  const std::vector<float>& phi() const { return phi_; }
+  const std::vector<LayerIndex>& layer() const { return layer_; }
+  const std::vector<Hit>& hits() const { return hits_; }
+
+  // edge origins
+  const std::vector<LayerPair>& layerPairs() const { return layerPairs_; }
+  /// index in layerPairs() of each edge
+  const std::vector<unsigned int>& edgeLayerPair() const { return edgeLayerPair_; }
+  /// index of each edge in the HitDoublets of its layer pair
+  const std::vector<unsigned int>& edgeDoublet() const { return edgeDoublet_; }
+  /// inner node of each edge, the inverse of edgeOffsets()
+  const std::vector<unsigned int>& innerNodes() const { return innerNodes_; }
+
+private:
+  std::vector<unsigned int> regionNodeOffsets_;
+
+  std::vector<unsigned int> edgeOffsets_;
+  std::vector<unsigned int> outerNodes_;
+
+  std::vector<float> x_, y_, z_, r_, phi_;
+  std::vector<LayerIndex> layer_;
+  std::vector<Hit> hits_;
+
+  std::vector<LayerPair> layerPairs_;
+  std::vector<unsigned int> edgeLayerPair_;
+  std::vector<unsigned int> edgeDoublet_;
+  std::vector<unsigned int> innerNodes_;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef RecoTracker_TkHitPairs_DoubletGraphClassifier_h
+#define RecoTracker_TkHitPairs_DoubletGraphClassifier_h
+
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Edge classifier for the DoubletGraph, an interaction network on the CPU.
+ *
+ * The node features (r, phi, z, scaled) are encoded into a hidden state of
+ * size H. Then, for a fixed number of iterations, an edge network gives a
+ * weight to each edge from the states of its two nodes and the edge
+ * features (dr, dphi, dz), and every node is updated from its state, its
+ * features and the weighted sums of the states of its inner and outer
+ * neighbours. The score of each edge is given by the edge network on the
+ * final states.
+ *
+ * All the arrays are feature major (element f*n+i for feature f of node or
+ * edge i), so that the dense layers loop contiguously over nodes and edges.
+ *
+ * The weights are read from a text file:
+ *   DoubletGraphClassifier 1
+ *   hidden H iterations N
+ *   scales r phi z
+ * followed by the dense layers nodeEncoder (3 -> H), edgeHidden (2H+3 -> H),
+ * edgeOutput (H -> 1), nodeHidden (3H+3 -> H), each as
+ *   dense nin nout
+ * and nout*nin weights (row major) and nout biases.
+ * acts/export_doublet_graph_classifier.py writes it from the trained weights.
+ */
+class DoubletGraphClassifier {
+public:
+  explicit DoubletGraphClassifier(const std::string& fileName);
+
+  /// scores in [0,1] for each edge of the graph, in the order of DoubletGraph::outerNodes()
+  void operator()(const DoubletGraph& graph, std::vector<float>& scores) const {
+    (*this)(graph.r(), graph.phi(), graph.z(), graph.edgeOffsets(), graph.innerNodes(), graph.outerNodes(), scores);
+  }
+
+  /// same for the graph given by the node features and the CSR edges, as in DoubletGraph
+  void operator()(const std::vector<float>& r, const std::vector<float>& phi, const std::vector<float>& z,
+                  const std::vector<unsigned int>& edgeOffsets, const std::vector<unsigned int>& innerNodes,
+                  const std::vector<unsigned int>& outerNodes, std::vector<float>& scores) const;
+
+  unsigned int hidden() const { return hidden_; }
+  unsigned int iterations() const { return iterations_; }
+
+  struct Dense {
+    unsigned int nin = 0, nout = 0;
+    std::vector<float> weights; // nout x nin
+    std::vector<float> biases;
+  };
+
+  enum class Activation { tanh, sigmoid };
+
+  /// out[o*n+i] = act(sum_f weights[o*nin+f]*in[f*n+i] + biases[o]), for i < n
+  static void dense(const Dense& layer, const float *in, unsigned int n, Activation activation, float *out);
+
+private:
+  void edgeNetwork(const std::vector<unsigned int>& innerNodes, const std::vector<unsigned int>& outerNodes,
+                   const std::vector<float>& nodes, const std::vector<float>& edgeFeatures,
+                   std::vector<float>& edgeInput, std::vector<float>& edgeHidden, std::vector<float>& weights) const;
+
+  unsigned int hidden_ = 0;
+  unsigned int iterations_ = 0;
+  float scales_[3] = {1.f, 1.f, 1.f};
+
+  Dense nodeEncoder_;
+  Dense edgeHidden_;
+  Dense edgeOutput_;
+  Dense nodeHidden_;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RecoTracker_TkHitPairs_DoubletOwners_h
+#define RecoTracker_TkHitPairs_DoubletOwners_h
+
+#include <utility>
+#include <vector>
+
+/**
+ * Regions owning each doublet kept by HitPairEDProducer with
+ * removeDuplicateDoublets, in CSR form.
+ *
+ * The doublets are the ones of IntermediateHitDoublets (and
+ * RegionsSeedingHitSets), in sequence, layer pair after layer pair. The
+ * regions are the indices of the TrackingRegions in the event; the owners of
+ * doublet i are [offsets()[i], offsets()[i+1]) in regions(), the first one is
+ * the region keeping the doublet, the others the regions from which it was
+ * removed as a duplicate, in increasing order.
+ */
+class DoubletOwners {
+public:
+  DoubletOwners() = default;
+  DoubletOwners(std::vector<unsigned int> offsets, std::vector<unsigned int> regions):
+    offsets_(std::move(offsets)), regions_(std::move(regions)) {}
+  ~DoubletOwners() = default;
+
+  unsigned int size() const { return offsets_.empty() ? 0 : offsets_.size()-1; }
+  unsigned int nOwners(unsigned int i) const { return offsets_[i+1]-offsets_[i]; }
+  /// region keeping doublet i
+  unsigned int keeper(unsigned int i) const { return regions_[offsets_[i]]; }
+
+  const std::vector<unsigned int>& offsets() const { return offsets_; }
+  const std::vector<unsigned int>& regions() const { return regions_; }
+
+private:
+  std::vector<unsigned int> offsets_;
+  std::vector<unsigned int> regions_;
+};
+
+#endif
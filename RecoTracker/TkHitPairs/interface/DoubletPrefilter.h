@@ -0,0 +1,71 @@
+#ifndef RecoTracker_TkHitPairs_DoubletPrefilter_h
+#define RecoTracker_TkHitPairs_DoubletPrefilter_h
+
+/** First stage of the doublet classification in HitPairEDProducer
+ *  (prefilterFile): cuts on cheap features, per layer pair, reject the
+ *  doublets clearly fake and accept the ones clearly good, only the others
+ *  (ambiguous) are classified by the neural network.
+ *
+ *  The features are differences between the outer and the inner hit, as
+ *  the last info features of the network, from values computed once per
+ *  hit (HitFeatures):
+ *    deltaA    cluster size (pixels)
+ *    deltaADC  cluster charge
+ *    deltaS    cluster shape, sizeY/sizeX
+ *    deltaR    radius
+ *    deltaPhi  phi, in [-pi, pi]
+ *    deltaZ    z
+ *    zZero     z at r = 0 of the straight line through the two hits in RZ
+ *
+ *  The cuts are read from a text file, one per line (# starts a comment):
+ *    reject inner outer feature min max
+ *    accept inner outer feature min max
+ *  with the layer names (e.g. BPix1 FPix1_pos), or * * for the layer pairs
+ *  without cuts of their own. A doublet is rejected if a feature of a
+ *  reject line is outside [min, max], else accepted if the layer pair has
+ *  accept lines and all their features are inside, else ambiguous.
+ */
+
+#include <array>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class DoubletPrefilter {
+public:
+  enum Feature { deltaA, deltaADC, deltaS, deltaR, deltaPhi, deltaZ, zZero, nFeatures };
+  static const char *name(Feature feature);
+
+  enum Decision { reject, accept, ambiguous };
+
+  using Features = std::array<float, nFeatures>;
+
+  struct HitFeatures {
+    float r, phi, z;
+    float size, charge, shape;
+  };
+
+  static Features features(const HitFeatures& inner, const HitFeatures& outer);
+
+  struct Cut {
+    Feature feature;
+    float min, max;
+    bool inside(const Features& x) const { return x[feature] >= min && x[feature] <= max; }
+  };
+
+  struct Cuts {
+    std::vector<Cut> reject, accept;
+    Decision decide(const Features& x) const;
+  };
+
+  explicit DoubletPrefilter(const std::string& fileName);
+
+  /// cuts of the layer pair, or of * *; null if none, all the doublets are ambiguous
+  const Cuts *cuts(const std::string& innerLayer, const std::string& outerLayer) const;
+
+private:
+  std::map<std::pair<std::string, std::string>, Cuts> cuts_;
+};
+
+#endif
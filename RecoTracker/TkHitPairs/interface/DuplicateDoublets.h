@@ -0,0 +1,72 @@
+#ifndef RecoTracker_TkHitPairs_DuplicateDoublets_h
+#define RecoTracker_TkHitPairs_DuplicateDoublets_h
+
+#include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletOwners.h"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Event-level removal of the doublets already kept for a previous
+ * TrackingRegion, for overlapping regions, used by HitPairEDProducer.
+ *
+ * A doublet is identified by its inner and outer hits. It is kept in the
+ * first region producing it, which is its first owner; the regions
+ * producing it later are recorded as its other owners and the doublet is
+ * removed from them. The doublets kept are numbered in the order they are
+ * kept, as they are filled in IntermediateHitDoublets.
+ */
+class DuplicateDoublets {
+public:
+  using Key = std::pair<const void *, const void *>;
+
+  void clear();
+
+  /// removes from doublets (and their scores, if given) the ones kept for another region
+  void remove(HitDoublets& doublets, unsigned int region, std::vector<float> *scores = nullptr) {
+    remove(doublets, region, [&doublets](size_t i) {
+        return Key(doublets.hit(i, HitDoublets::inner), doublets.hit(i, HitDoublets::outer));
+      }, scores);
+  }
+
+  /// same, with the key of doublet i given by keyOf(i)
+  template <typename KeyOf>
+  void remove(HitDoublets& doublets, unsigned int region, const KeyOf& keyOf, std::vector<float> *scores = nullptr);
+
+  size_t nremoved() const { return otherOwners_.size(); }
+  size_t nowned() const { return kept_.size(); }
+
+  /// owners of the doublets kept so far
+  DoubletOwners owners() const;
+
+private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<const void *>()(key.first) ^ (std::hash<const void *>()(key.second) * 0x9e3779b97f4a7c15ULL);
+    }
+  };
+  std::unordered_map<Key, unsigned int, KeyHash> kept_;          // first doublet kept with the key
+  std::vector<unsigned int> keptRegion_;                          // region of each doublet kept
+  std::vector<std::pair<unsigned int, unsigned int> > otherOwners_; // (doublet kept, region) of the duplicates removed
+};
+
+template <typename KeyOf>
+void DuplicateDoublets::remove(HitDoublets& doublets, unsigned int region, const KeyOf& keyOf, std::vector<float> *scores) {
+  size_t n = 0;
+  doublets.remove_if([&](size_t i) {
+      const unsigned int next = keptRegion_.size();
+      const unsigned int first = kept_.emplace(keyOf(i), next).first->second;
+      if(first != next && keptRegion_[first] != region) {
+        otherOwners_.emplace_back(first, region);
+        return true;
+      }
+      keptRegion_.push_back(region);
+      if(scores) (*scores)[n++] = (*scores)[i];
+      return false;
+    });
+  if(scores) scores->resize(n);
+}
+
+#endif
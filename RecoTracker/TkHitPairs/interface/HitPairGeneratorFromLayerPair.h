@@ -5,8 +5,11 @@
 #include "RecoTracker/TkHitPairs/interface/LayerHitMapCache.h"
 #include "TrackingTools/TransientTrackingRecHit/interface/SeedingLayerSetsHits.h"
 
+#include <string>
+
 class DetLayer;
 class TrackingRegion;
+namespace hitPairKernels { struct Counters; }
 
 class HitPairGeneratorFromLayerPair {
 
@@ -16,13 +19,24 @@ public:
   typedef SeedingLayerSetsHits::SeedingLayerSet Layers;
   typedef SeedingLayerSetsHits::SeedingLayer Layer;
 
+  /// what to do when a layer pair gives more than max doublets
+  enum class Overflow {
+    clear,    ///< drop all the doublets of the layer pair
+    keepBest  ///< keep the max doublets closest to the center of the phi and RZ windows
+  };
+
   HitPairGeneratorFromLayerPair(unsigned int inner,
                                 unsigned int outer,
                                 LayerCacheType* layerCache,
-				unsigned int max=0);
+				unsigned int max=0,
+                                Overflow overflow=Overflow::clear);
 
   ~HitPairGeneratorFromLayerPair();
 
+  /// Overflow from its name in the configuration ("clear" or "keepBest"), throws for other names
+  static Overflow overflow(const std::string& name);
+  Overflow overflow() const { return theOverflow; }
+
   HitDoublets doublets( const TrackingRegion& reg,
                         const edm::Event & ev,  const edm::EventSetup& es, Layers layers) {
     assert(theLayerCache);
@@ -42,6 +56,8 @@ public:
   HitDoublets doublets( const TrackingRegion& reg,
                         const edm::Event & ev,  const edm::EventSetup& es, const Layer& innerLayer, const Layer& outerLayer, LayerCacheType& layerCache);
   
+  /// appends the doublets to prs; with Overflow::clear prs is cleared when it reaches max pairs,
+  /// with Overflow::keepBest the best max doublets of the layer pair are appended
   void hitPairs( const TrackingRegion& reg, OrderedHitPairs & prs,
                  const edm::Event & ev,  const edm::EventSetup& es, Layers layers);
   static void doublets(
@@ -52,7 +68,12 @@ public:
 						      const RecHitsSortedInPhi & outerHitsMap,
 						      const edm::EventSetup& iSetup,
 						      const unsigned int theMaxElement,
-						      HitDoublets & result);
+						      HitDoublets & result,
+                                                      Overflow overflow=Overflow::clear,
+                                                      hitPairKernels::Counters * counters=nullptr);
+
+  /// if not null, the work done by the following searches is added to counters
+  void setCounters(hitPairKernels::Counters * counters) { theCounters = counters; }
 
   
   
@@ -64,6 +85,8 @@ private:
   const unsigned int theOuterLayer;
   const unsigned int theInnerLayer;
   const unsigned int theMaxElement;
+  const Overflow theOverflow;
+  hitPairKernels::Counters * theCounters = nullptr;
 };
 
 #endif
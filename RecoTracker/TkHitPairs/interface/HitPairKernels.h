@@ -0,0 +1,165 @@
+#ifndef RecoTracker_TkHitPairs_HitPairKernels_h
+#define RecoTracker_TkHitPairs_HitPairKernels_h
+
+/** Inner loop of the doublet search, shared by HitPairGeneratorFromLayerPair
+ *  and by the standalone benchmark/replay tools in test/.
+ *
+ *  For one outer hit the inner hits are selected in phi with
+ *  RecHitsSortedInPhi::doubleRange, checked in RZ and appended to a
+ *  HitDoublets. The RZ check is a callable so that the devirtualized
+ *  HitRZCompatibility kernels and replayed windows use the same loop.
+ */
+
+#include "RecoTracker/TkTrackingRegions/interface/HitRZCompatibility.h"
+#include "RecoTracker/TkTrackingRegions/interface/HitEtaCheck.h"
+#include "RecoTracker/TkTrackingRegions/interface/HitRCheck.h"
+#include "RecoTracker/TkTrackingRegions/interface/HitZCheck.h"
+#include "RecoTracker/TkMSParametrization/interface/PixelRecoRange.h"
+
+#include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <tuple>
+#include <vector>
+
+namespace hitPairKernels {
+
+  typedef PixelRecoRange<float> Range;
+
+  constexpr float nSigmaRZ = 3.46410161514f; // std::sqrt(12.f);
+  constexpr float nSigmaPhi = 3.f;
+
+  /// RZ compatibility of the inner hits [b,e) given the allowed range as a function of u
+  template<typename RangeFunc>
+  inline void rzCompatibility(RangeFunc const & range, int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) {
+    for (int i=b; i!=e; ++i) {
+      Range allowed = range(innerHitsMap.u[i]);
+      float vErr = nSigmaRZ * innerHitsMap.dv[i];
+      Range hitRZ(innerHitsMap.v[i]-vErr, innerHitsMap.v[i]+vErr);
+      Range crossRange = allowed.intersection(hitRZ);
+      ok[i-b] = ! crossRange.empty() ;
+    }
+  }
+
+  // devirtualizer
+  template<typename Algo>
+  struct Kernel {
+    using  Base = HitRZCompatibility;
+    void set(Base const * a) {
+      assert( a->algo()==Algo::me);
+      checkRZ=reinterpret_cast<Algo const *>(a);
+    }
+
+    void operator()(int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) const {
+      Algo const * algo = checkRZ;
+      rzCompatibility([algo](float u) { return algo->range(u); }, b, e, innerHitsMap, ok);
+    }
+    Algo const * checkRZ;
+
+  };
+
+  template<typename ... Args> using Kernels = std::tuple<Kernel<Args>...>;
+
+  /// dispatch to the kernel matching checkRZ->algo()
+  inline void checkRZ(HitRZCompatibility const * checkRZ, int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) {
+    Kernels<HitZCheck,HitRCheck,HitEtaCheck> kernels;
+    switch (checkRZ->algo()) {
+      case (HitRZCompatibility::zAlgo) :
+	std::get<0>(kernels).set(checkRZ);
+	std::get<0>(kernels)(b,e,innerHitsMap, ok);
+	break;
+      case (HitRZCompatibility::rAlgo) :
+	std::get<1>(kernels).set(checkRZ);
+	std::get<1>(kernels)(b,e,innerHitsMap, ok);
+	break;
+      case (HitRZCompatibility::etaAlgo) :
+	std::get<2>(kernels).set(checkRZ);
+	std::get<2>(kernels)(b,e,innerHitsMap, ok);
+	break;
+    }
+  }
+
+  /// work done by the search, filled only if requested (HitPairStats)
+  struct Counters {
+    unsigned long long outerHits = 0;   // outer hits searched
+    unsigned long long candidates = 0;  // inner hits in the phi windows
+    unsigned long long rzAccepted = 0;  // of which compatible in RZ
+  };
+
+  /** Appends (inner,io) for all inner hits in [phiMin,phiMax] accepted by rz(b,e,innerHitsMap,ok).
+   *  Returns false (leaving result partially filled) as soon as maxElement would be exceeded;
+   *  maxElement==0 means no limit.
+   */
+  template<typename RZCheck>
+  inline bool addDoublets(int io, float phiMin, float phiMax, RZCheck const & rz,
+			  const RecHitsSortedInPhi & innerHitsMap, const unsigned int maxElement,
+			  HitDoublets & result, Counters * counters=nullptr) {
+    auto innerRange = innerHitsMap.doubleRange(phiMin, phiMax);
+    if (counters) ++counters->outerHits;
+    for(int j=0; j<3; j+=2) {
+      auto b = innerRange[j]; auto e=innerRange[j+1];
+      if (b==e) continue;
+      bool ok[e-b];
+      rz(b,e,innerHitsMap, ok);
+      if (counters) {
+        counters->candidates += e-b;
+        counters->rzAccepted += std::count(ok, ok+(e-b), true);
+      }
+      for (int i=0; i!=e-b; ++i) {
+	if (!ok[i]) continue;
+	if (maxElement!=0 && result.size() >= maxElement) return false;
+	result.add(b+i,io);
+      }
+    }
+    return true;
+  }
+
+  /** Compatibility residual of the doublets [b,result.size()) of one outer hit, appended to scores:
+   *  squared distances from the centers of the phi and RZ windows, in units of their half widths
+   *  (0 best, up to about 2 at the corners).
+   */
+  template<typename RangeFunc>
+  inline void residuals(float phiMin, float phiMax, RangeFunc const & range, size_t b,
+                        const HitDoublets & result, std::vector<float> & scores) {
+    const RecHitsSortedInPhi & innerHitsMap = result.innerLayer();
+    const float phiCenter = 0.5f*(phiMin+phiMax);
+    const float phiHalf = std::max(0.5f*(phiMax-phiMin), 1.e-6f);
+    for (size_t j=b; j<result.size(); ++j) {
+      const int i = result.innerHitId(j);
+      float dphi = innerHitsMap.phi(i)-phiCenter;
+      if (dphi > float(M_PI)) dphi -= 2.f*float(M_PI);
+      else if (dphi < -float(M_PI)) dphi += 2.f*float(M_PI);
+      const Range allowed = range(innerHitsMap.u[i]);
+      const float vHalf = 0.5f*std::abs(allowed.max()-allowed.min()) + nSigmaRZ*innerHitsMap.dv[i];
+      const float dv = innerHitsMap.v[i]-0.5f*(allowed.min()+allowed.max());
+      scores.push_back((dphi*dphi)/(phiHalf*phiHalf) + (dv*dv)/std::max(vHalf*vHalf, 1.e-12f));
+    }
+  }
+
+  /** Keeps the k doublets with the lowest score (ties resolved in favour of the earlier doublets),
+   *  in their original order, and their scores. k==0 means no limit.
+   *  Applied again after appending more doublets it gives the same result as once on all of them,
+   *  so that the doublets can be kept in a buffer of bounded size during the search.
+   */
+  inline void keepBest(HitDoublets & result, std::vector<float> & scores, const unsigned int k) {
+    assert(scores.size() == result.size());
+    if (k==0 || result.size() <= k) return;
+    std::vector<float> sorted(scores);
+    std::nth_element(sorted.begin(), sorted.begin()+(k-1), sorted.end());
+    const float kth = sorted[k-1];
+    unsigned int ties = k - std::count_if(scores.begin(), scores.end(), [kth](float s) { return s < kth; });
+    size_t n = 0;
+    result.remove_if([&](size_t i) {
+        bool keep = scores[i] < kth;
+        if (!keep && scores[i] == kth && ties > 0) { --ties; keep = true; }
+        if (keep) scores[n++] = scores[i];
+        return !keep;
+      });
+    scores.resize(n);
+  }
+
+}
+
+#endif
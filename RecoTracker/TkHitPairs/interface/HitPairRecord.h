@@ -0,0 +1,111 @@
+#ifndef RecoTracker_TkHitPairs_HitPairRecord_h
+#define RecoTracker_TkHitPairs_HitPairRecord_h
+
+/** Compact binary record of the inputs of the doublet search, used to replay
+ *  and profile HitPairGeneratorFromLayerPair offline without EventSetup or
+ *  input ROOT files (see bin/replayHitPairs.cc).
+ *
+ *  Per event and TrackingRegion the hit states of every layer used are stored
+ *  in RecHitsSortedInPhi order. Per layer pair the phi window and the RZ window
+ *  of every outer hit, which need the EventSetup to be computed, are stored
+ *  together with the doublets produced online.
+ *
+ *  The RZ window is stored as the affine extrapolation of the
+ *  HitRZCompatibility range between the extreme u of the inner layer; it is
+ *  exact up to rounding for the z and eta checks.
+ *
+ *  The file is written in native byte order. Version 2 (magic "HPR2") adds
+ *  the maxElementOverflow policy of each layer pair; version 1 files are
+ *  read with the clear policy.
+ */
+
+#include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TrackingRegion;
+namespace edm { class EventSetup; }
+
+namespace hitPairRecord {
+
+  /// phi and RZ window of one outer hit; skipped() if the outer hit gives no doublets
+  struct Window {
+    float phiMin, phiMax;
+    float lo0, lo1, hi0, hi1; // allowed v range at u: [lo0+lo1*u, hi0+hi1*u]
+
+    bool skipped() const { return phiMax < phiMin; }
+    static Window skip() { return Window{1.f, 0.f, 0.f, 0.f, 0.f, 0.f}; }
+  };
+
+  struct Layer {
+    int index;   // SeedingLayerSetsHits::LayerIndex
+    int seqNum;  // DetLayer::seqNum()
+    bool barrel;
+    std::vector<RecHitsSortedInPhi::HitGlobalState> hits;
+  };
+
+  struct LayerPair {
+    unsigned int inner, outer;  // positions in Region::layers
+    unsigned int maxElement;
+    bool keepBest;               // maxElementOverflow keepBest, clear otherwise
+    std::vector<Window> windows; // one per outer hit
+    std::vector<std::pair<int,int> > doublets; // (inner,outer) indices found online
+  };
+
+  struct Region {
+    float originX, originY, originZ;
+    float ptMin, originRBound, originZBound;
+    std::vector<Layer> layers;
+    std::vector<LayerPair> layerPairs;
+
+    GlobalPoint origin() const { return GlobalPoint(originX, originY, originZ); }
+  };
+
+  struct Event {
+    unsigned int run, lumi;
+    unsigned long long event;
+    std::vector<Region> regions;
+  };
+
+  class Writer {
+  public:
+    explicit Writer(const std::string& fileName);
+    void write(const Event& event);
+  private:
+    std::ofstream out_;
+  };
+
+  class Reader {
+  public:
+    explicit Reader(const std::string& fileName);
+    /// returns false at the end of the file
+    bool read(Event& event);
+  private:
+    std::ifstream in_;
+    unsigned int version_;
+  };
+
+  /// hit states of a layer, in the order of the map
+  Layer makeLayer(int index, int seqNum, const RecHitsSortedInPhi& hits);
+
+  /// region parameters (origin, ptMin, bounds), no layers
+  Region makeRegion(const TrackingRegion& region);
+
+  /// windows of all outer hits as seen by HitPairGeneratorFromLayerPair::doublets
+  void fillWindows(const TrackingRegion& region,
+                   const DetLayer& innerHitDetLayer, const DetLayer& outerHitDetLayer,
+                   const RecHitsSortedInPhi& innerHitsMap, const RecHitsSortedInPhi& outerHitsMap,
+                   const edm::EventSetup& iSetup,
+                   std::vector<Window>& windows);
+
+  /// doublet search on recorded windows, same semantics of HitPairGeneratorFromLayerPair::doublets
+  /// with Overflow::keepBest if keepBest, Overflow::clear otherwise
+  void doublets(const RecHitsSortedInPhi& innerHitsMap, const RecHitsSortedInPhi& outerHitsMap,
+                const std::vector<Window>& windows, const unsigned int maxElement, const bool keepBest,
+                HitDoublets& result);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef RecoTracker_TkHitPairs_HitPairStats_h
+#define RecoTracker_TkHitPairs_HitPairStats_h
+
+/** Statistics of the doublet search per TrackingRegion type and layer pair,
+ *  collected by HitPairEDProducer (collectStats). Each stream fills its own
+ *  HitPairStats, the streams are merged at the end of the job and printed as
+ *  a table and/or written as JSON.
+ */
+
+#include "RecoTracker/TkHitPairs/interface/HitPairKernels.h"
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <tuple>
+
+class HitPairStats {
+public:
+  struct Counters {
+    unsigned long long calls = 0;       ///< layer pairs processed
+    unsigned long long outerHits = 0;   ///< outer hits with a non empty phi window and RZ compatibility
+    unsigned long long candidates = 0;  ///< inner hits tested (in the phi windows)
+    unsigned long long rzAccepted = 0;  ///< inner hits accepted by the RZ compatibility
+    unsigned long long doublets = 0;    ///< doublets from the search (after maxElement)
+    unsigned long long inferred = 0;    ///< doublets classified by the network (after the prefilter)
+    unsigned long long kept = 0;        ///< doublets kept after inference and duplicate removal
+    double time = 0;                    ///< seconds spent, search and inference
+
+    Counters& operator+=(const Counters& other);
+  };
+
+  /// region type (TrackingRegion::name()), inner and outer layer names
+  using Key = std::tuple<std::string, std::string, std::string>;
+
+  void add(const std::string& region, const std::string& innerLayer, const std::string& outerLayer,
+           const hitPairKernels::Counters& search, unsigned long long doublets, unsigned long long inferred,
+           unsigned long long kept, double time);
+
+  void merge(const HitPairStats& other);
+
+  bool empty() const { return counters_.empty(); }
+  const std::map<Key, Counters>& counters() const { return counters_; }
+
+  /// one line per region type and layer pair, sorted, with the totals
+  void printTable(std::ostream& out) const;
+  void writeJson(std::ostream& out) const;
+
+private:
+  std::map<Key, Counters> counters_;
+};
+
+#endif
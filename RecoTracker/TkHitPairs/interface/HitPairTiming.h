@@ -0,0 +1,74 @@
+#ifndef RecoTracker_TkHitPairs_HitPairTiming_h
+#define RecoTracker_TkHitPairs_HitPairTiming_h
+
+/** Timing of the stages of HitPairEDProducer (collectTiming).
+ *  The durations of each stage are accumulated per stream in a histogram
+ *  with logarithmic bins (20 per decade from 100 ns to 1000 s), the streams
+ *  are merged at the end of the job and the median, 95% and 99% quantiles
+ *  are reported. TraceWriter writes the individual measurements in the
+ *  Chrome trace format (chrome://tracing, Perfetto), one file per stream.
+ */
+
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+
+class HitPairTiming {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  enum Stage { doublets, prefilter, cnnData, cnnInference, cnnPush, fill, nStages };
+  static const char *name(Stage stage);
+
+  static Clock::time_point now() { return Clock::now(); }
+
+  void add(Stage stage, double seconds);
+  void add(Stage stage, Clock::time_point start, Clock::time_point end) {
+    add(stage, std::chrono::duration<double>(end - start).count());
+  }
+
+  void merge(const HitPairTiming& other);
+
+  unsigned long long entries(Stage stage) const { return stages_[stage].entries; }
+  double total(Stage stage) const { return stages_[stage].total; }
+  double max(Stage stage) const { return stages_[stage].max; }
+  /// upper edge of the bin containing the q quantile, 0 if no entries
+  double quantile(Stage stage, double q) const;
+
+  /// one line per stage: entries, mean, p50, p95, p99, max
+  void printTable(std::ostream& out) const;
+
+  class TraceWriter {
+  public:
+    /// the timestamps are relative to origin, thread is the stream id
+    TraceWriter(const std::string& fileName, Clock::time_point origin, unsigned int thread);
+    ~TraceWriter();
+
+    void write(Stage stage, Clock::time_point start, Clock::time_point end, unsigned long long event);
+
+  private:
+    std::ofstream out_;
+    Clock::time_point origin_;
+    unsigned int thread_;
+    bool first_ = true;
+  };
+
+private:
+  static constexpr int binsPerDecade = 20;
+  static constexpr int minDecade = -7;
+  static constexpr int nDecades = 10;
+  static constexpr int nBins = binsPerDecade*nDecades + 2; // with underflow and overflow
+
+  struct Histogram {
+    std::array<unsigned long long, nBins> bins{};
+    unsigned long long entries = 0;
+    double total = 0;
+    double max = 0;
+  };
+
+  std::array<Histogram, nStages> stages_;
+};
+
+#endif
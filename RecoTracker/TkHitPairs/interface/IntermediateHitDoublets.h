@@ -44,13 +44,14 @@ namespace ihd {
    * Helper class to provide nice interface to loop over the layer sets of a region
    *
    * \tparam T Concrete type in a vector<T> actually holding the layer sets
+   * \tparam Iterator Iterator over the layer sets, if not vector<T>::const_iterator
    *
    * Templatized because used here and in RegionSeedingHitSets
    */
-  template <typename T>
+  template <typename T, typename Iterator = typename std::vector<T>::const_iterator>
   class RegionLayerSets {
   public:
-    using const_iterator = typename std::vector<T>::const_iterator;
+    using const_iterator = Iterator;
 
     // Taking T* to have compatible interface with IntermediateHitTriplets::RegionLayerSets
     template <typename TMP>
@@ -26,6 +26,7 @@ private:
     SimpleCache& operator=(SimpleCache&&) = default;
     ~SimpleCache() { clear(); }
     void resize(int size) { theContainer.resize(size); }
+    unsigned int size() const { return theContainer.size(); }
     const ValueType*  get(KeyType key) const { return theContainer[key].get();}
     /// add object to cache. It is caller responsibility to check that object is not yet there.
     void add(KeyType key, ValueType * value) {
@@ -71,6 +72,19 @@ public:
     return ptr;
   }
   
+  /// nullptr if the layer is not in the cache
+  const RecHitsSortedInPhi * get(const SeedingLayerSetsHits::SeedingLayer& layer) const {
+    return layer.index() < theCache.size() ? theCache.get(layer.index()) : nullptr;
+  }
+
+  /// builds the map of a layer without touching any cache, can be called concurrently
+  static std::unique_ptr<RecHitsSortedInPhi> makeHitMap(const SeedingLayerSetsHits::SeedingLayer& layer, const TrackingRegion & region,
+                                                        const edm::EventSetup & iSetup) {
+    auto tmp = std::make_unique<RecHitsSortedInPhi>(region.hits(iSetup,layer), region.origin(), layer.detLayer());
+    tmp->theOrigin = region.origin();
+    return tmp;
+  }
+
   const RecHitsSortedInPhi &
   operator()(const SeedingLayerSetsHits::SeedingLayer& layer, const TrackingRegion & region,
 	     const edm::EventSetup & iSetup) {
@@ -78,9 +92,7 @@ public:
     assert (key>=0);
     const RecHitsSortedInPhi * lhm = theCache.get(key);
     if (lhm==nullptr) {
-      auto tmp = add(layer, std::make_unique<RecHitsSortedInPhi>(region.hits(iSetup,layer), region.origin(), layer.detLayer()));
-      tmp->theOrigin = region.origin();
-      lhm = tmp;
+      lhm = add(layer, makeHitMap(layer, region, iSetup));
       LogDebug("LayerHitMapCache")<<" I got"<< lhm->all().second-lhm->all().first<<" hits in the cache for: "<<layer.detLayer();
     }
     else{
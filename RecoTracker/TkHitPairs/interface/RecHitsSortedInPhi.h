@@ -42,6 +42,17 @@ public:
   
   RecHitsSortedInPhi(const std::vector<Hit>& hits, GlobalPoint const & origin, DetLayer const * il);
 
+  // Global position and errors of a hit, as in BaseTrackerRecHit::globalState()
+  struct HitGlobalState {
+    float x, y, z;
+    float errorR, errorZ, errorRPhi;
+  };
+
+  // Build the map from precomputed hit states without RecHit objects (hit() returns nullptr
+  // and layer is nullptr). Hits with equal phi keep their input order.
+  // Meant for standalone benchmarks and replay of recorded doublet inputs.
+  RecHitsSortedInPhi(const std::vector<HitGlobalState>& hits, GlobalPoint const & origin, bool barrel);
+
   bool empty() const { return theHits.empty(); }
   std::size_t size() const { return theHits.size();}
 
@@ -117,6 +128,10 @@ public:
     for (HitIter i = range.first; i != range.second; i++) result.push_back( i->hit());
   }
 
+private:
+  void setColumns(unsigned int i, GlobalPoint const & position, float errorR, float errorZ, float errorRPhi,
+                  GlobalPoint const & origin);
+
 };
 
 
@@ -152,6 +167,15 @@ public:
     indeces.emplace_back(il,ol);
   }
 
+  /// removes the doublets i for which pred(i) is true, keeping the order of the others
+  template<typename Pred>
+  void remove_if(Pred pred) {
+    std::size_t n=0;
+    for (std::size_t i=0, size=indeces.size(); i!=size; ++i)
+      if (!pred(i)) indeces[n++] = indeces[i];
+    indeces.resize(n);
+  }
+
   int index(int i, layer l) const { return l==inner ? innerHitId(i) : outerHitId(i);}
   DetLayer const * detLayer(layer l) const { return layers[l]->layer; }
   HitLayer const & innerLayer() const { return *layers[inner];}
@@ -3,19 +3,82 @@
 
 #include "RecoTracker/TkSeedingLayers/interface/SeedingHitSet.h"
 #include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
+#include "RecoTracker/TkHitPairs/interface/RecHitsSortedInPhi.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <iterator>
+#include <utility>
 
 /**
  * Class to store SeedingHitSets (doublet/triplet/quadruplet) per TrackingRegion
  *
+ * In the compact storage mode only doublets can be stored, as two hit
+ * pointers each instead of a full SeedingHitSet. In both modes the hit
+ * sets are accessed as SeedingHitSet, returned by value by the iterator.
+ *
  * Defined in this package instead of RecoTracker/TkSeedingLayers to avoid circular dependencies
  */
 class RegionsSeedingHitSets {
 public:
+  enum class Storage { full, compactDoublets };
+
+  using HitPair = std::array<SeedingHitSet::ConstRecHitPointer, 2>;
+
+  /**
+   * Input iterator over the hit sets of either storage mode (with += and - in constant time).
+   * The hit sets of the compact mode are built on dereference, so operator* returns them by
+   * value and operator-> a proxy holding one: there is no reference into the storage.
+   */
+  class HitSetIterator {
+  public:
+    class Pointer {
+    public:
+      explicit Pointer(SeedingHitSet hitSet): hitSet_(std::move(hitSet)) {}
+      const SeedingHitSet *operator->() const { return &hitSet_; }
+    private:
+      SeedingHitSet hitSet_;
+    };
+
+    using iterator_category = std::input_iterator_tag;
+    using value_type = SeedingHitSet;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Pointer;
+    using reference = SeedingHitSet;
+
+    HitSetIterator(): full_(nullptr), compact_(nullptr) {}
+    explicit HitSetIterator(const SeedingHitSet *full): full_(full), compact_(nullptr) {}
+    explicit HitSetIterator(const HitPair *compact): full_(nullptr), compact_(compact) {}
+
+    SeedingHitSet operator*() const {
+      return compact_ ? SeedingHitSet((*compact_)[0], (*compact_)[1]) : *full_;
+    }
+    Pointer operator->() const { return Pointer(operator*()); }
+
+    HitSetIterator& operator++() { advance(1); return *this; }
+    HitSetIterator operator++(int) { HitSetIterator clone(*this); advance(1); return clone; }
+    HitSetIterator& operator+=(difference_type n) { advance(n); return *this; }
+    HitSetIterator operator+(difference_type n) const { HitSetIterator clone(*this); clone.advance(n); return clone; }
+    difference_type operator-(const HitSetIterator& other) const {
+      return compact_ ? compact_ - other.compact_ : full_ - other.full_;
+    }
+
+    bool operator==(const HitSetIterator& other) const { return full_ == other.full_ && compact_ == other.compact_; }
+    bool operator!=(const HitSetIterator& other) const { return !operator==(other); }
+
+  private:
+    void advance(difference_type n) { if(compact_) compact_ += n; else full_ += n; }
+
+    const SeedingHitSet *full_;
+    const HitPair *compact_;
+  };
+
   /// Helper class containing a region and indices to hitSets_
   using RegionIndex = ihd::RegionIndex;
 
   /// Helper class providing nice interface to loop over hit sets of a region
-  using RegionSeedingHitSets = ihd::RegionLayerSets<SeedingHitSet>;
+  using RegionSeedingHitSets = ihd::RegionLayerSets<SeedingHitSet, HitSetIterator>;
 
   /// Iterator over regions
   using const_iterator = ihd::const_iterator<RegionSeedingHitSets, RegionsSeedingHitSets>;
@@ -27,16 +90,36 @@ public:
     explicit RegionFiller(RegionsSeedingHitSets* obj): obj_(obj) {}
 
     ~RegionFiller() {
-      if(obj_) obj_->regions_.back().setLayerSetsEnd(obj_->hitSets_.size());
+      if(obj_) obj_->regions_.back().setLayerSetsEnd(obj_->size());
     }
 
     bool valid() const { return obj_ != nullptr; }
 
     template <typename... Args>
     void emplace_back(Args&&... args) {
-      obj_->hitSets_.emplace_back(std::forward<Args>(args)...);
+      obj_->emplace_back(std::forward<Args>(args)...);
+    }
+
+    /// appends all the doublets, growing the storage at most once
+    void appendDoublets(const HitDoublets& doublets) {
+      if(obj_->storage_ == Storage::compactDoublets)
+        append(obj_->hitPairs_, doublets, [](RecHitsSortedInPhi::Hit inner, RecHitsSortedInPhi::Hit outer) { return HitPair{{inner, outer}}; });
+      else
+        append(obj_->hitSets_, doublets, [](RecHitsSortedInPhi::Hit inner, RecHitsSortedInPhi::Hit outer) { return SeedingHitSet(inner, outer); });
     }
+
   private:
+    template <typename T, typename F>
+    static void append(std::vector<T>& v, const HitDoublets& doublets, F make) {
+      const size_t size = doublets.size();
+      if(v.capacity() < v.size()+size)
+        v.reserve(std::max(v.size()+size, 2*v.capacity()));
+      const auto& innerHits = doublets.innerLayer().theHits;
+      const auto& outerHits = doublets.outerLayer().theHits;
+      for(size_t i=0; i<size; ++i)
+        v.push_back(make(innerHits[doublets.innerHitId(i)].hit(), outerHits[doublets.outerHitId(i)].hit()));
+    }
+
     RegionsSeedingHitSets *obj_;
   };
 
@@ -45,6 +128,7 @@ public:
 
   // constructors
   RegionsSeedingHitSets() = default;
+  explicit RegionsSeedingHitSets(Storage storage): storage_(storage) {}
   RegionsSeedingHitSets(const RegionsSeedingHitSets&) = delete;
   RegionsSeedingHitSets& operator=(const RegionsSeedingHitSets&) = delete;
   RegionsSeedingHitSets(RegionsSeedingHitSets&&) = default;
@@ -53,22 +137,25 @@ public:
 
   void reserve(size_t nregions, size_t nhitsets) {
     regions_.reserve(nregions);
-    hitSets_.reserve(nhitsets);
+    if(storage_ == Storage::compactDoublets) hitPairs_.reserve(nhitsets);
+    else hitSets_.reserve(nhitsets);
   }
 
   void shrink_to_fit() {
     regions_.shrink_to_fit();
     hitSets_.shrink_to_fit();
+    hitPairs_.shrink_to_fit();
   }
 
   RegionFiller beginRegion(const TrackingRegion *region) {
-    regions_.emplace_back(region, hitSets_.size());
+    regions_.emplace_back(region, size());
     return RegionFiller(this);
   }
 
+  Storage storage() const { return storage_; }
   bool empty() const { return regions_.empty(); }
   size_t regionSize() const { return regions_.size(); }
-  size_t size() const { return hitSets_.size(); }
+  size_t size() const { return storage_ == Storage::compactDoublets ? hitPairs_.size() : hitSets_.size(); }
 
   const_iterator begin() const { return const_iterator(this, regions_.begin()); }
   const_iterator cbegin() const { return begin(); }
@@ -76,12 +163,27 @@ public:
   const_iterator cend() const { return end(); }
 
   // used internally by the helper classes
-  std::vector<SeedingHitSet>::const_iterator layerSetsBegin() const { return hitSets_.begin(); }
-  std::vector<SeedingHitSet>::const_iterator layerSetsEnd() const { return hitSets_.end(); }
+  HitSetIterator layerSetsBegin() const {
+    return storage_ == Storage::compactDoublets ? HitSetIterator(hitPairs_.data()) : HitSetIterator(hitSets_.data());
+  }
+  HitSetIterator layerSetsEnd() const { return layerSetsBegin() + size(); }
 
 private:
-  std::vector<RegionIndex> regions_;    /// Container of regions, each element has indices pointing to hitSets_
-  std::vector<SeedingHitSet> hitSets_;  /// Container of hit sets for all regions
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    if(storage_ == Storage::compactDoublets) {
+      SeedingHitSet hits(std::forward<Args>(args)...);
+      assert(hits.size() == 2);
+      hitPairs_.push_back(HitPair{{hits[0], hits[1]}});
+    }
+    else
+      hitSets_.emplace_back(std::forward<Args>(args)...);
+  }
+
+  Storage storage_ = Storage::full;
+  std::vector<RegionIndex> regions_;    /// Container of regions, each element has indices pointing to hitSets_ or hitPairs_
+  std::vector<SeedingHitSet> hitSets_;  /// Container of hit sets for all regions (full storage)
+  std::vector<HitPair> hitPairs_;       /// Container of hit pairs for all regions (compact storage)
 };
 
 #endif
@@ -0,0 +1,74 @@
+#include "FWCore/Framework/interface/stream/EDProducer.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/EDGetToken.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/MakerMacros.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "DataFormats/Common/interface/Handle.h"
+
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletGraphClassifier.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Scores the edges of the DoubletGraph with DoubletGraphClassifier. The
+ * product is a vector of scores aligned with DoubletGraph::outerNodes(),
+ * used e.g. by HitDoubletCAEDProducer to prune the doublets of all the
+ * layer pairs at once.
+ */
+class DoubletGraphClassifierEDProducer: public edm::stream::EDProducer<> {
+public:
+  explicit DoubletGraphClassifierEDProducer(const edm::ParameterSet& iConfig);
+  ~DoubletGraphClassifierEDProducer() override = default;
+
+  static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
+
+  void produce(edm::Event& iEvent, const edm::EventSetup& iSetup) override;
+
+private:
+  static std::string modelFile(const edm::ParameterSet& iConfig);
+
+  edm::EDGetTokenT<DoubletGraph> graphToken_;
+  const DoubletGraphClassifier classifier_;
+};
+
+std::string DoubletGraphClassifierEDProducer::modelFile(const edm::ParameterSet& iConfig) {
+  auto fileName = iConfig.getParameter<std::string>("modelFile");
+  if(fileName.empty())
+    throw cms::Exception("Configuration") << "DoubletGraphClassifierEDProducer requires a modelFile";
+  return fileName;
+}
+
+DoubletGraphClassifierEDProducer::DoubletGraphClassifierEDProducer(const edm::ParameterSet& iConfig):
+  graphToken_(consumes<DoubletGraph>(iConfig.getParameter<edm::InputTag>("graph"))),
+  classifier_(modelFile(iConfig))
+{
+  produces<std::vector<float> >();
+}
+
+void DoubletGraphClassifierEDProducer::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+  edm::ParameterSetDescription desc;
+
+  desc.add<edm::InputTag>("graph", edm::InputTag("doubletGraphEDProducer"));
+  desc.add<std::string>("modelFile", "")->setComment("Weights of the edge classifier, see DoubletGraphClassifier.h for the format");
+
+  descriptions.add("doubletGraphClassifierEDProducer", desc);
+}
+
+void DoubletGraphClassifierEDProducer::produce(edm::Event& iEvent, const edm::EventSetup& iSetup) {
+  edm::Handle<DoubletGraph> hgraph;
+  iEvent.getByToken(graphToken_, hgraph);
+
+  auto scores = std::make_unique<std::vector<float> >();
+  classifier_(*hgraph, *scores);
+  LogDebug("DoubletGraphClassifierEDProducer") << "scored " << scores->size() << " edges";
+
+  iEvent.put(std::move(scores));
+}
+
+DEFINE_FWK_MODULE(DoubletGraphClassifierEDProducer);
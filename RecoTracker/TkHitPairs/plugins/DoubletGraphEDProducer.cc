@@ -0,0 +1,58 @@
+#include "FWCore/Framework/interface/stream/EDProducer.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/EDGetToken.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/MakerMacros.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "DataFormats/Common/interface/Handle.h"
+
+#include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+
+#include <memory>
+
+/**
+ * Exports the doublets of IntermediateHitDoublets as a DoubletGraph (CSR
+ * adjacency and node features), for graph based filtering and dumpers.
+ */
+class DoubletGraphEDProducer: public edm::stream::EDProducer<> {
+public:
+  explicit DoubletGraphEDProducer(const edm::ParameterSet& iConfig);
+  ~DoubletGraphEDProducer() override = default;
+
+  static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
+
+  void produce(edm::Event& iEvent, const edm::EventSetup& iSetup) override;
+
+private:
+  edm::EDGetTokenT<IntermediateHitDoublets> doubletToken_;
+};
+
+DoubletGraphEDProducer::DoubletGraphEDProducer(const edm::ParameterSet& iConfig):
+  doubletToken_(consumes<IntermediateHitDoublets>(iConfig.getParameter<edm::InputTag>("doublets")))
+{
+  produces<DoubletGraph>();
+}
+
+void DoubletGraphEDProducer::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+  edm::ParameterSetDescription desc;
+
+  desc.add<edm::InputTag>("doublets", edm::InputTag("hitPairEDProducer"))->setComment("IntermediateHitDoublets, e.g. from HitPairEDProducer with produceIntermediateHitDoublets");
+
+  descriptions.add("doubletGraphEDProducer", desc);
+}
+
+void DoubletGraphEDProducer::produce(edm::Event& iEvent, const edm::EventSetup& iSetup) {
+  edm::Handle<IntermediateHitDoublets> hdoublets;
+  iEvent.getByToken(doubletToken_, hdoublets);
+
+  auto graph = std::make_unique<DoubletGraph>();
+  graph->fill(*hdoublets);
+  LogDebug("DoubletGraphEDProducer") << "doublet graph with " << graph->nNodes() << " nodes and " << graph->nEdges() << " edges in " << graph->nRegions() << " regions";
+
+  iEvent.put(std::move(graph));
+}
+
+DEFINE_FWK_MODULE(DoubletGraphEDProducer);
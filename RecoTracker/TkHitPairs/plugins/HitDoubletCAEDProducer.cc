@@ -0,0 +1,200 @@
+#include "FWCore/Framework/interface/stream/EDProducer.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/EDGetToken.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/EventSetup.h"
+#include "FWCore/Framework/interface/ESHandle.h"
+#include "FWCore/Framework/interface/MakerMacros.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/RunningAverage.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "DataFormats/Common/interface/Handle.h"
+
+#include "MagneticField/Engine/interface/MagneticField.h"
+#include "MagneticField/Records/interface/IdealMagneticFieldRecord.h"
+
+#include "RecoTracker/TkTrackingRegions/interface/TrackingRegion.h"
+#include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
+#include "RecoTracker/TkHitPairs/interface/RegionsSeedingHitSets.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletCellularAutomaton.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Cellular automaton on the doublets of IntermediateHitDoublets, per
+ * TrackingRegion (DoubletCellularAutomaton): the ntuplets of
+ * minHitsPerNtuplet to maxHitsPerNtuplet hits are emitted as SeedingHitSets.
+ *
+ * With edgeScores set, the doublets whose DoubletGraph edge has a score
+ * below edgeScoreCut are dropped before building the cells. doubletScores
+ * does the same with scores aligned with the doublets themselves, e.g.
+ * those of HitPairEDProducer with produceScores.
+ */
+class HitDoubletCAEDProducer: public edm::stream::EDProducer<> {
+public:
+  explicit HitDoubletCAEDProducer(const edm::ParameterSet& iConfig);
+  ~HitDoubletCAEDProducer() override = default;
+
+  static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
+
+  void produce(edm::Event& iEvent, const edm::EventSetup& iSetup) override;
+
+private:
+  edm::EDGetTokenT<IntermediateHitDoublets> doubletToken_;
+  edm::EDGetTokenT<DoubletGraph> graphToken_;
+  edm::EDGetTokenT<std::vector<float> > edgeScoreToken_;
+  edm::EDGetTokenT<std::vector<float> > doubletScoreToken_;
+  const float edgeScoreCut_;
+  const float thetaCut_;
+  const unsigned int minHitsPerNtuplet_;
+  const unsigned int maxHitsPerNtuplet_;
+
+  edm::RunningAverage localRA_;
+};
+
+HitDoubletCAEDProducer::HitDoubletCAEDProducer(const edm::ParameterSet& iConfig):
+  doubletToken_(consumes<IntermediateHitDoublets>(iConfig.getParameter<edm::InputTag>("doublets"))),
+  edgeScoreCut_(iConfig.getParameter<double>("edgeScoreCut")),
+  thetaCut_(iConfig.getParameter<double>("CAThetaCut")),
+  minHitsPerNtuplet_(iConfig.getParameter<unsigned int>("minHitsPerNtuplet")),
+  maxHitsPerNtuplet_(iConfig.getParameter<unsigned int>("maxHitsPerNtuplet"))
+{
+  if(minHitsPerNtuplet_ < 3 || maxHitsPerNtuplet_ > 4 || minHitsPerNtuplet_ > maxHitsPerNtuplet_)
+    throw cms::Exception("Configuration") << "HitDoubletCAEDProducer supports 3 <= minHitsPerNtuplet <= maxHitsPerNtuplet <= 4, got " << minHitsPerNtuplet_ << " and " << maxHitsPerNtuplet_;
+
+  const auto& edgeScoreTag = iConfig.getParameter<edm::InputTag>("edgeScores");
+  if(!edgeScoreTag.label().empty()) {
+    graphToken_ = consumes<DoubletGraph>(iConfig.getParameter<edm::InputTag>("graph"));
+    edgeScoreToken_ = consumes<std::vector<float> >(edgeScoreTag);
+  }
+  const auto& doubletScoreTag = iConfig.getParameter<edm::InputTag>("doubletScores");
+  if(!doubletScoreTag.label().empty()) {
+    if(!edgeScoreTag.label().empty())
+      throw cms::Exception("Configuration") << "HitDoubletCAEDProducer: set either edgeScores or doubletScores, not both";
+    doubletScoreToken_ = consumes<std::vector<float> >(doubletScoreTag);
+  }
+
+  produces<RegionsSeedingHitSets>();
+}
+
+void HitDoubletCAEDProducer::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+  edm::ParameterSetDescription desc;
+
+  desc.add<edm::InputTag>("doublets", edm::InputTag("hitPairEDProducer"))->setComment("IntermediateHitDoublets, e.g. from HitPairEDProducer with produceIntermediateHitDoublets");
+  desc.add<edm::InputTag>("graph", edm::InputTag("doubletGraphEDProducer"))->setComment("DoubletGraph of the doublets, used with edgeScores");
+  desc.add<edm::InputTag>("edgeScores", edm::InputTag(""))->setComment("Scores of the DoubletGraph edges, e.g. from DoubletGraphClassifierEDProducer; empty to use all the doublets");
+  desc.add<edm::InputTag>("doubletScores", edm::InputTag(""))->setComment("Scores of the doublets in the order of IntermediateHitDoublets, e.g. from HitPairEDProducer with produceScores; empty to use all the doublets");
+  desc.add<double>("edgeScoreCut", 0.5)->setComment("Minimum score of the doublets, with edgeScores or doubletScores");
+  desc.add<double>("CAThetaCut", 0.002)->setComment("Maximum RZ bending of connected cells, at the region ptMin");
+  desc.add<unsigned int>("minHitsPerNtuplet", 3);
+  desc.add<unsigned int>("maxHitsPerNtuplet", 4);
+
+  descriptions.add("hitDoubletCAEDProducer", desc);
+}
+
+void HitDoubletCAEDProducer::produce(edm::Event& iEvent, const edm::EventSetup& iSetup) {
+  edm::Handle<IntermediateHitDoublets> hdoublets;
+  iEvent.getByToken(doubletToken_, hdoublets);
+  const auto& regionDoublets = *hdoublets;
+
+  edm::ESHandle<MagneticField> field;
+  iSetup.get<IdealMagneticFieldRecord>().get(field);
+  const float invBz = field->inverseBzAtOriginInGeV();
+
+  auto seedingHitSets = std::make_unique<RegionsSeedingHitSets>();
+  if(regionDoublets.empty()) {
+    iEvent.put(std::move(seedingHitSets));
+    return;
+  }
+  seedingHitSets->reserve(regionDoublets.regionSize(), localRA_.upper());
+
+  // doublets kept by the edge classifier, indexed as the doublets of all the layer pairs of the event in sequence
+  std::vector<bool> keep;
+  if(!edgeScoreToken_.isUninitialized()) {
+    edm::Handle<DoubletGraph> hgraph;
+    iEvent.getByToken(graphToken_, hgraph);
+    edm::Handle<std::vector<float> > hscores;
+    iEvent.getByToken(edgeScoreToken_, hscores);
+    const auto& graph = *hgraph;
+    const auto& scores = *hscores;
+
+    std::vector<unsigned int> layerPairOffsets;
+    unsigned int ndoublets = 0;
+    for(const auto& regionLayerPairs: regionDoublets) {
+      for(const auto& layerPair: regionLayerPairs) {
+        layerPairOffsets.push_back(ndoublets);
+        ndoublets += layerPair.doublets().size();
+      }
+    }
+    if(scores.size() != graph.nEdges() || graph.nEdges() != ndoublets || graph.layerPairs().size() != layerPairOffsets.size())
+      throw cms::Exception("LogicError") << "HitDoubletCAEDProducer: " << scores.size() << " edge scores and a graph of " << graph.nEdges() << " edges for "
+                                         << ndoublets << " doublets, the graph must be built from the same IntermediateHitDoublets";
+
+    keep.resize(ndoublets);
+    unsigned int nkept = 0;
+    for(unsigned int k=0; k<graph.nEdges(); ++k) {
+      const bool pass = scores[k] >= edgeScoreCut_;
+      keep[layerPairOffsets[graph.edgeLayerPair()[k]] + graph.edgeDoublet()[k]] = pass;
+      nkept += pass;
+    }
+    LogDebug("HitDoubletCAEDProducer") << nkept << " of " << ndoublets << " doublets above edgeScoreCut";
+  }
+  else if(!doubletScoreToken_.isUninitialized()) {
+    edm::Handle<std::vector<float> > hscores;
+    iEvent.getByToken(doubletScoreToken_, hscores);
+    const auto& scores = *hscores;
+
+    unsigned int ndoublets = 0;
+    for(const auto& regionLayerPairs: regionDoublets)
+      for(const auto& layerPair: regionLayerPairs)
+        ndoublets += layerPair.doublets().size();
+    if(scores.size() != ndoublets)
+      throw cms::Exception("LogicError") << "HitDoubletCAEDProducer: " << scores.size() << " doublet scores for " << ndoublets
+                                         << " doublets, the scores must come with the same IntermediateHitDoublets";
+
+    keep.resize(ndoublets);
+    unsigned int nkept = 0;
+    for(unsigned int k=0; k<ndoublets; ++k) {
+      keep[k] = scores[k] >= edgeScoreCut_;
+      nkept += keep[k];
+    }
+    LogDebug("HitDoubletCAEDProducer") << nkept << " of " << ndoublets << " doublets above edgeScoreCut";
+  }
+
+  DoubletCellularAutomaton ca;
+  std::vector<const HitDoublets *> layerPairs;
+  std::vector<DoubletCellularAutomaton::Ntuplet> ntuplets;
+  unsigned int doubletOffset = 0;
+  for(const auto& regionLayerPairs: regionDoublets) {
+    const TrackingRegion& region = regionLayerPairs.region();
+    auto filler = seedingHitSets->beginRegion(&region);
+
+    layerPairs.clear();
+    for(const auto& layerPair: regionLayerPairs) layerPairs.push_back(&layerPair.doublets());
+    ca.build(layerPairs, keep.empty() ? nullptr : &keep, doubletOffset);
+    ca.connect(region.ptMin(), invBz, thetaCut_);
+    ca.evolve();
+    ntuplets.clear();
+    ca.findNtuplets(minHitsPerNtuplet_, maxHitsPerNtuplet_, ntuplets);
+    for(const auto& ntuplet: ntuplets) {
+      const auto& h = ntuplet.hits;
+      if(ntuplet.nHits == 3)
+        filler.emplace_back(ca.hit(h[0]), ca.hit(h[1]), ca.hit(h[2]));
+      else
+        filler.emplace_back(ca.hit(h[0]), ca.hit(h[1]), ca.hit(h[2]), ca.hit(h[3]));
+    }
+
+    LogDebug("HitDoubletCAEDProducer") << "region with " << ca.nCells() << " cells";
+  }
+
+  seedingHitSets->shrink_to_fit();
+  localRA_.update(seedingHitSets->size());
+  iEvent.put(std::move(seedingHitSets));
+}
+
+DEFINE_FWK_MODULE(HitDoubletCAEDProducer);
@@ -6,6 +6,7 @@
 #include "FWCore/Utilities/interface/EDGetToken.h"
 #include "FWCore/Framework/interface/Event.h"
 #include "DataFormats/Common/interface/Handle.h"
+#include "DataFormats/Provenance/interface/ProductID.h"
 #include "FWCore/Utilities/interface/RunningAverage.h"
 
 #include "RecoTracker/TkTrackingRegions/interface/TrackingRegion.h"
@@ -16,6 +17,12 @@
 #include "RecoTracker/TkHitPairs/interface/HitPairGeneratorFromLayerPair.h"
 #include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
 #include "RecoTracker/TkHitPairs/interface/RegionsSeedingHitSets.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairRecord.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairStats.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairTiming.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletPrefilter.h"
+#include "RecoTracker/TkHitPairs/interface/DuplicateDoublets.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
 
 #include "PhysicsTools/TensorFlow/interface/TensorFlow.h"
 #include "tensorflow/core/graph/default_device.h"
@@ -27,7 +34,12 @@
 #include "DataFormats/SiPixelDetId/interface/PXFDetId.h"
 #include "TH2F.h"
 
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 // #include <algorithm>
 // #include <chrono>
@@ -45,16 +57,33 @@
 //
 // #include "NvUtils.h"
 
-namespace { class ImplBase; }
+namespace {
+  class ImplBase;
+
+  /// doublet statistics (collectStats) and timing (collectTiming) of all the streams, merged at endStream
+  struct StatsSummary {
+    bool collect;
+    std::string file;
+    bool collectTiming;
+    HitPairTiming::Clock::time_point origin; // of the timing traces
+    mutable std::mutex mutex;
+    mutable HitPairStats stats;
+    mutable HitPairTiming timing;
+  };
+}
 
-class HitPairEDProducer: public edm::stream::EDProducer<> {
+class HitPairEDProducer: public edm::stream::EDProducer<edm::GlobalCache<StatsSummary> > {
 public:
-  HitPairEDProducer(const edm::ParameterSet& iConfig);
+  HitPairEDProducer(const edm::ParameterSet& iConfig, const StatsSummary *stats);
   ~HitPairEDProducer() override = default;
 
   static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
 
+  static std::unique_ptr<StatsSummary> initializeGlobalCache(const edm::ParameterSet& iConfig);
+  static void globalEndJob(const StatsSummary *stats);
+
   void produce(edm::Event& iEvent, const edm::EventSetup& iSetup) override;
+  void endStream() override;
 
 private:
   edm::EDGetTokenT<bool> clusterCheckToken_;
@@ -63,6 +92,39 @@ private:
 };
 
 namespace {
+  /**
+   * Frozen TensorFlow graph of a doublet classifier (info_input to
+   * output/Softmax), loaded once per stream and shared by the layer pairs
+   * using it.
+   */
+  class DoubletModel {
+  public:
+    explicit DoubletModel(const std::string& graphFile):
+      graphDef_(tensorflow::loadGraphDef(graphFile)),
+      session_(tensorflow::createSession(graphDef_, 16))
+    {
+      for (int i = 0; i < graphDef_->node_size(); ++i)
+      {
+        auto node = graphDef_->mutable_node(i);
+        if (node->device().empty()) {
+          node->set_device("/device:GPU:0");
+        }
+      }
+    }
+    ~DoubletModel() {
+      tensorflow::closeSession(session_);
+      delete graphDef_;
+    }
+    DoubletModel(const DoubletModel&) = delete;
+    DoubletModel& operator=(const DoubletModel&) = delete;
+
+    tensorflow::Session *session() const { return session_; }
+
+  private:
+    tensorflow::GraphDef *graphDef_;
+    tensorflow::Session *session_;
+  };
+
   class ImplBase {
   public:
     ImplBase(const edm::ParameterSet& iConfig);
@@ -72,25 +134,173 @@ namespace {
 
     virtual void produce(const bool clusterCheckOk, edm::Event& iEvent, const edm::EventSetup& iSetup) = 0;
 
+    /// statistics of this stream, null if not collected
+    const HitPairStats *stats() const { return stats_.get(); }
+    /// timing of this stream, null if not collected
+    const HitPairTiming *timing() const { return timing_.get(); }
+    void setTimingOrigin(HitPairTiming::Clock::time_point origin) { timingOrigin_ = origin; }
+
   protected:
+    std::unique_ptr<hitPairRecord::Event> beginRecord(const edm::Event& iEvent);
+    void recordLayerPair(hitPairRecord::Region& record, const TrackingRegion& region,
+                         const SeedingLayerSetsHits::SeedingLayerSet& layerSet, LayerHitMapCache& layerCache,
+                         const HitDoublets& doublets, const edm::EventSetup& iSetup) const;
+    void endRecord(const hitPairRecord::Event& record) { recorder_->write(record); }
+
+    /// model and threshold classifying the doublets of a layer pair
+    struct LayerPairModel {
+      const DoubletModel *model;
+      float threshold;
+    };
+    /// the specialized model of the layer pair (layerPairModels), or the generic one (graphFile)
+    const LayerPairModel& layerPairModel(const std::string& innerLayer, const std::string& outerLayer) const;
+
+    void prefilter(const DoubletPrefilter::Cuts& cuts, const HitDoublets& doublets, std::vector<DoubletPrefilter::Decision>& decisions);
+
+    void beginTiming(const edm::Event& iEvent);
+    void time(HitPairTiming::Stage stage, HitPairTiming::Clock::time_point start, HitPairTiming::Clock::time_point end) {
+      if(timing_) timing_->add(stage, start, end);
+      if(trace_) trace_->write(stage, start, end, event_);
+    }
+
     edm::RunningAverage localRA_;
     const unsigned int maxElement_;
+    const RegionsSeedingHitSets::Storage seedingHitSetsStorage_;
 
     bool doInference_;
     float t_;
+    const bool produceScores_;
+    std::vector<float> layerPairScores_; // of the doublets kept in the current layer pair, if produceScores
 
     HitPairGeneratorFromLayerPair generator_;
     std::vector<unsigned> layerPairBegins_;
+
+    const std::string recordFile_;
+    std::unique_ptr<hitPairRecord::Writer> recorder_;
+
+    std::unique_ptr<DuplicateDoublets> duplicateDoublets_; // if removeDuplicateDoublets
+
+    std::map<std::string, std::unique_ptr<DoubletModel> > models_; // by graph file, if doInference
+    LayerPairModel genericModel_{nullptr, 0.f};
+    std::map<std::pair<std::string, std::string>, LayerPairModel> layerPairModels_; // by inner and outer layer name
+
+    std::unique_ptr<DoubletPrefilter> prefilter_; // if prefilterFile
+    std::vector<DoubletPrefilter::HitFeatures> hitFeatures_[2]; // of the inner and outer hits of the layer pair, size < 0 if not computed
+    std::vector<DoubletPrefilter::Decision> decisions_;
+
+    std::unique_ptr<HitPairStats> stats_; // if collectStats
+
+    std::unique_ptr<HitPairTiming> timing_; // if collectTiming
+    const std::string traceFile_;
+    std::unique_ptr<HitPairTiming::TraceWriter> trace_;
+    HitPairTiming::Clock::time_point timingOrigin_;
+    unsigned long long event_ = 0;
   };
   ImplBase::ImplBase(const edm::ParameterSet& iConfig):
     maxElement_(iConfig.getParameter<unsigned int>("maxElement")),
+    seedingHitSetsStorage_(iConfig.getParameter<bool>("compactSeedingHitSets") ? RegionsSeedingHitSets::Storage::compactDoublets : RegionsSeedingHitSets::Storage::full),
     doInference_(iConfig.existsAs<bool>("doInference") ? iConfig.getParameter<bool>("doInference") : true),
     t_(iConfig.existsAs<double>("thresh") ? iConfig.getParameter<double>("thresh") : 0.1),
-    generator_(0, 1, nullptr, maxElement_), // these indices are dummy, TODO: cleanup HitPairGeneratorFromLayerPair
-    layerPairBegins_(iConfig.getParameter<std::vector<unsigned> >("layerPairs"))
+    produceScores_(iConfig.getParameter<bool>("produceScores")),
+    generator_(0, 1, nullptr, maxElement_, HitPairGeneratorFromLayerPair::overflow(iConfig.getParameter<std::string>("maxElementOverflow"))), // these indices are dummy, TODO: cleanup HitPairGeneratorFromLayerPair
+    layerPairBegins_(iConfig.getParameter<std::vector<unsigned> >("layerPairs")),
+    recordFile_(iConfig.getParameter<std::string>("recordFile")),
+    duplicateDoublets_(iConfig.getParameter<bool>("removeDuplicateDoublets") ? std::make_unique<DuplicateDoublets>() : nullptr),
+    prefilter_(iConfig.getParameter<std::string>("prefilterFile").empty() ? nullptr : std::make_unique<DoubletPrefilter>(iConfig.getParameter<std::string>("prefilterFile"))),
+    stats_(iConfig.getParameter<bool>("collectStats") ? std::make_unique<HitPairStats>() : nullptr),
+    timing_(iConfig.getParameter<bool>("collectTiming") ? std::make_unique<HitPairTiming>() : nullptr),
+    traceFile_(iConfig.getParameter<std::string>("timingTraceFile"))
   {
     if(layerPairBegins_.empty())
       throw cms::Exception("Configuration") << "HitPairEDProducer requires at least index for layer pairs (layerPairs parameter), none was given";
+
+    if(doInference_) {
+      tensorflow::setLogging("0");
+      auto load = [&](const std::string& graphFile) {
+        auto& model = models_[graphFile];
+        if(!model) model = std::make_unique<DoubletModel>(graphFile);
+        return model.get();
+      };
+      genericModel_ = LayerPairModel{load(iConfig.getParameter<std::string>("graphFile")), t_};
+      for(const auto& pset: iConfig.getParameter<std::vector<edm::ParameterSet> >("layerPairModels")) {
+        const auto layers = std::make_pair(pset.getParameter<std::string>("innerLayer"), pset.getParameter<std::string>("outerLayer"));
+        const double thresh = pset.getParameter<double>("thresh");
+        if(!layerPairModels_.emplace(layers, LayerPairModel{load(pset.getParameter<std::string>("graphFile")), thresh < 0 ? t_ : float(thresh)}).second)
+          throw cms::Exception("Configuration") << "HitPairEDProducer: layer pair " << layers.first << "+" << layers.second << " appears more than once in layerPairModels";
+      }
+    }
+  }
+
+  const ImplBase::LayerPairModel& ImplBase::layerPairModel(const std::string& innerLayer, const std::string& outerLayer) const {
+    auto found = layerPairModels_.find(std::make_pair(innerLayer, outerLayer));
+    return found == layerPairModels_.end() ? genericModel_ : found->second;
+  }
+
+  std::unique_ptr<hitPairRecord::Event> ImplBase::beginRecord(const edm::Event& iEvent) {
+    if(recordFile_.empty())
+      return std::unique_ptr<hitPairRecord::Event>();
+    // one file per stream
+    if(!recorder_)
+      recorder_ = std::make_unique<hitPairRecord::Writer>(recordFile_ + "." + std::to_string(iEvent.streamID().value()));
+    return std::make_unique<hitPairRecord::Event>(hitPairRecord::Event{iEvent.id().run(), iEvent.id().luminosityBlock(), iEvent.id().event(), {}});
+  }
+
+  void ImplBase::beginTiming(const edm::Event& iEvent) {
+    event_ = iEvent.id().event();
+    // one file per stream
+    if(!traceFile_.empty() && !trace_)
+      trace_ = std::make_unique<HitPairTiming::TraceWriter>(traceFile_ + "." + std::to_string(iEvent.streamID().value()), timingOrigin_, iEvent.streamID().value());
+  }
+
+  void ImplBase::prefilter(const DoubletPrefilter::Cuts& cuts, const HitDoublets& doublets, std::vector<DoubletPrefilter::Decision>& decisions) {
+    const HitDoublets::layer layers[2] = {HitDoublets::inner, HitDoublets::outer};
+    const RecHitsSortedInPhi *hitLayers[2] = {&doublets.innerLayer(), &doublets.outerLayer()};
+    for(int j=0; j<2; ++j)
+      hitFeatures_[j].assign(hitLayers[j]->size(), DoubletPrefilter::HitFeatures{0, 0, 0, -1, 0, 0});
+
+    decisions.resize(doublets.size());
+    for(size_t i=0, size=doublets.size(); i<size; ++i) {
+      for(int j=0; j<2; ++j) {
+        auto& hit = hitFeatures_[j][doublets.index(i, layers[j])];
+        if(hit.size >= 0) continue;
+        hit.r = doublets.r(i, layers[j]);
+        hit.phi = doublets.phi(i, layers[j]);
+        hit.z = doublets.z(i, layers[j]);
+        hit.size = 0;
+        const auto *siHit = dynamic_cast<const SiPixelRecHit*>(doublets.hit(i, layers[j])->hit());
+        if(siHit) {
+          const auto& cluster = *siHit->cluster();
+          hit.size = cluster.size();
+          hit.charge = cluster.charge();
+          hit.shape = float(cluster.sizeY())/float(cluster.sizeX());
+        }
+      }
+      decisions[i] = cuts.decide(DoubletPrefilter::features(hitFeatures_[0][doublets.innerHitId(i)], hitFeatures_[1][doublets.outerHitId(i)]));
+    }
+  }
+
+  void ImplBase::recordLayerPair(hitPairRecord::Region& record, const TrackingRegion& region,
+                                 const SeedingLayerSetsHits::SeedingLayerSet& layerSet, LayerHitMapCache& layerCache,
+                                 const HitDoublets& doublets, const edm::EventSetup& iSetup) const {
+    unsigned int positions[2];
+    for(int i=0; i<2; ++i) {
+      auto found = std::find_if(record.layers.begin(), record.layers.end(), [&](const hitPairRecord::Layer& layer) {
+          return layer.index == layerSet[i].index();
+        });
+      positions[i] = found - record.layers.begin();
+      if(found == record.layers.end())
+        record.layers.push_back(hitPairRecord::makeLayer(layerSet[i].index(), layerSet[i].detLayer()->seqNum(), layerCache(layerSet[i], region, iSetup)));
+    }
+
+    hitPairRecord::LayerPair pair{positions[0], positions[1], maxElement_,
+                                  generator_.overflow() == HitPairGeneratorFromLayerPair::Overflow::keepBest, {}, {}};
+    hitPairRecord::fillWindows(region, *layerSet[0].detLayer(), *layerSet[1].detLayer(),
+                               layerCache(layerSet[0], region, iSetup), layerCache(layerSet[1], region, iSetup),
+                               iSetup, pair.windows);
+    pair.doublets.reserve(doublets.size());
+    for(size_t i=0, size=doublets.size(); i<size; ++i)
+      pair.doublets.emplace_back(doublets.innerHitId(i), doublets.outerHitId(i));
+    record.layerPairs.push_back(std::move(pair));
   }
 
   /////
@@ -107,40 +317,32 @@ namespace {
     void produces(edm::ProducerBase& producer) const override {
       T_SeedingHitSets::produces(producer);
       T_IntermediateHitDoublets::produces(producer);
+      if(produceScores_) producer.produces<std::vector<float> >();
+      if(duplicateDoublets_) producer.produces<DoubletOwners>();
     }
 
     // HitDoublets cnnInference( const TrackingRegion& region,
     //                           const edm::EventSetup& es,
     //                           HitDoublets& copyDoublets,SeedingLayerSetsHits::SeedingLayerSet layerSet,
     //                           LayerHitMapCache & layerCache) const
-    HitDoublets cnnInference(HitDoublets& thisDoublets)
+    // with decisions (prefilterFile) only the ambiguous doublets are classified, the accepted ones are kept;
+    // scores, if given, gets the score of each doublet kept (1 if accepted by the prefilter)
+    HitDoublets cnnInference(HitDoublets& thisDoublets, const LayerPairModel& model, const std::vector<DoubletPrefilter::Decision> *decisions = nullptr,
+                             std::vector<float> *scores = nullptr)
     {
       // const RecHitsSortedInPhi & innerHitsMap = layerCache(layerSet[0], region, es);
       // const RecHitsSortedInPhi& outerHitsMap = layerCache(layerSet[1], region, es);
       //
       // HitDoublets result(innerHitsMap,outerHitsMap); result.reserve(std::max(innerHitsMap.size(),outerHitsMap.size()));
 
-      auto startData = std::chrono::high_resolution_clock::now();
+      const auto startData = HitPairTiming::now();
 
       std::vector< float > inPad, outPad;
 
-      // Load graph
-      tensorflow::setLogging("0");
-      std::cout << "GPU" << std::endl;
       std::vector<int> pixelDets{0,1,2,3,14,15,16,29,30,31}, layerIds;
 
-      tensorflow::GraphDef* graphDef = tensorflow::loadGraphDef("/lustre/home/adrianodif/CNNDoublets/freeze_models/dense_pix_model_final.pb");
-      tensorflow::Session* session = tensorflow::createSession(graphDef,16);
-
-      for (int i = 0; i < graphDef->node_size(); ++i)
-      {
-        auto node = graphDef->mutable_node(i);
-        if (node->device().empty()) {
-          node->set_device("/device:GPU:0");
-        }
-      }
-
-      int numOfDoublets = thisDoublets.size(), padSize = 16, cnnLayers = 10, infoSize = 67;
+      int numOfDoublets = decisions ? std::count(decisions->begin(), decisions->end(), DoubletPrefilter::ambiguous) : thisDoublets.size();
+      int padSize = 16, cnnLayers = 10, infoSize = 67;
       float padHalfSize = 8.0;
       // tensorflow::Tensor inputPads(tensorflow::DT_FLOAT, {numOfDoublets,padSize,padSize,cnnLayers*2});
       tensorflow::Tensor inputFeat(tensorflow::DT_FLOAT, {numOfDoublets,infoSize});
@@ -177,8 +379,10 @@ namespace {
           zeroPad.push_back(0.0);
 
       std::vector<int> inIndex, outIndex;
-      for (int iD = 0; iD < numOfDoublets; iD++)
+      for (int iD = 0; iD < int(copyDoublets.size()); iD++)
       {
+        if(decisions && (*decisions)[iD] != DoubletPrefilter::ambiguous) continue;
+        const int iN = inIndex.size(); // row of the doublet in the network inputs
 
         //copyDoublets.add()
         std::vector <unsigned int> subDetIds, detIds ;
@@ -195,7 +399,7 @@ namespace {
         float deltaPhi = 0.0, deltaZ = 0.0, zZero = 0.0;
 
         int iLab = 0;
-        int doubOffset = (padSize*padSize*cnnLayers*2)*iD, infoOffset = (infoSize)*iD;
+        int doubOffset = (padSize*padSize*cnnLayers*2)*iN, infoOffset = (infoSize)*iN;
 
         std::vector< RecHitsSortedInPhi::Hit> hits;
         std::vector< const SiPixelRecHit*> siHits;
@@ -398,33 +602,36 @@ namespace {
       }
       // std::cout << "Making Inference" << std::endl;
 
-      auto finishData = std::chrono::high_resolution_clock::now();
+      const auto finishData = HitPairTiming::now();
+      time(HitPairTiming::cnnData, startData, finishData);
 
-      auto startInf = std::chrono::high_resolution_clock::now();
+      const auto startInf = finishData;
       // tensorflow::run(session, { { "hit_shape_input", inputPads }, { "info_input", inputFeat } },
       //               { "output/Softmax" }, &outputs);
-      tensorflow::run(session, { { "info_input", inputFeat } },
-                    { "output/Softmax" }, &outputs);
-      auto finishInf = std::chrono::high_resolution_clock::now();
+      if(numOfDoublets > 0)
+        tensorflow::run(model.model->session(), { { "info_input", inputFeat } },
+                      { "output/Softmax" }, &outputs);
+      const auto finishInf = HitPairTiming::now();
+      time(HitPairTiming::cnnInference, startInf, finishInf);
       // std::cout << "Cleaning doublets" << std::endl;
 
-      auto startPush = std::chrono::high_resolution_clock::now();
-      copyDoublets.clear();
-      float* score = outputs[0].flat<float>().data();
-      for (int i = 0; i < numOfDoublets; i++)
-        if(score[i*2 + 1]>t_)
-          copyDoublets.add(inIndex[i],outIndex[i]);
-      auto finishPush = std::chrono::high_resolution_clock::now();
-
-      std::chrono::duration<double> elapsedInf  = finishInf - startInf;
-      std::chrono::duration<double> elapsedData = finishData - startData;
-      std::chrono::duration<double> elapsedPush = finishPush - startPush;
-      //
-      // std::cout << "Staring size       : " << numOfDoublets << std::endl;
-      // std::cout << "New size           : " << copyDoublets.size() << std::endl;
-      // std::cout << "Elapsed time (data): " << elapsedData.count() << " s\n";
-      // std::cout << "Elapsed time (inf) : " << elapsedInf.count() << " s\n";
-      // std::cout << "Elapsed time (push): " << elapsedPush.count() << " s\n";
+      const auto startPush = finishInf;
+      const float* outputScores = numOfDoublets > 0 ? outputs[0].flat<float>().data() : nullptr;
+      int iN = 0;
+      if(scores) scores->clear();
+      copyDoublets.remove_if([&](size_t i) {
+          float score = 1.f;
+          if(decisions && (*decisions)[i] != DoubletPrefilter::ambiguous) {
+            if((*decisions)[i] == DoubletPrefilter::reject) return true;
+          } else {
+            score = outputScores[2*iN++ + 1];
+            if(!(score > model.threshold)) return true;
+          }
+          if(scores) scores->push_back(score);
+          return false;
+        });
+      time(HitPairTiming::cnnPush, startPush, HitPairTiming::now());
+      LogTrace("HitPairEDProducer") << " inference kept " << copyDoublets.size() << " doublets, " << numOfDoublets << " classified by the network";
 
       return copyDoublets;
 
@@ -434,47 +641,103 @@ namespace {
     void produce(const bool clusterCheckOk, edm::Event& iEvent, const edm::EventSetup& iSetup) override {
       auto regionsLayers = regionsLayers_.beginEvent(iEvent);
 
-      auto seedingHitSetsProducer = T_SeedingHitSets(&localRA_);
+      auto seedingHitSetsProducer = T_SeedingHitSets(&localRA_, seedingHitSetsStorage_);
       auto intermediateHitDoubletsProducer = T_IntermediateHitDoublets(regionsLayers.seedingLayerSetsHitsPtr());
 
+      // aligned with the doublets of intermediateHitDoubletsProducer, layer pair after layer pair
+      auto scores = produceScores_ ? std::make_unique<std::vector<float> >() : nullptr;
+
       if(!clusterCheckOk) {
         seedingHitSetsProducer.putEmpty(iEvent);
         intermediateHitDoubletsProducer.putEmpty(iEvent);
+        if(scores) iEvent.put(std::move(scores));
+        if(duplicateDoublets_) iEvent.put(std::make_unique<DoubletOwners>());
         return;
       }
 
       seedingHitSetsProducer.reserve(regionsLayers.regionsSize());
       intermediateHitDoubletsProducer.reserve(regionsLayers.regionsSize());
 
+      auto record = beginRecord(iEvent);
+      beginTiming(iEvent);
+
+      if(duplicateDoublets_) duplicateDoublets_->clear();
+      unsigned int regionIndex = 0;
+
       for(const auto& regionLayers: regionsLayers) {
         const TrackingRegion& region = regionLayers.region();
         auto hitCachePtr_filler_shs = seedingHitSetsProducer.beginRegion(&region, nullptr);
         auto hitCachePtr_filler_ihd = intermediateHitDoubletsProducer.beginRegion(&region, std::get<0>(hitCachePtr_filler_shs));
         auto hitCachePtr = std::get<0>(hitCachePtr_filler_ihd);
 
+        if(record) record->regions.push_back(hitPairRecord::makeRegion(region));
+
         for(SeedingLayerSetsHits::SeedingLayerSet layerSet: regionLayers.layerPairs()) {
+          hitPairKernels::Counters searchCounters;
+          if(stats_) generator_.setCounters(&searchCounters);
+          const auto start = HitPairTiming::now();
           auto doublets = generator_.doublets(region, iEvent, iSetup, layerSet, *hitCachePtr);
+          time(HitPairTiming::doublets, start, HitPairTiming::now());
           LogTrace("HitPairEDProducer") << " created " << doublets.size() << " doublets for layers " << layerSet[0].index() << "," << layerSet[1].index();
 
-          if(doublets.empty()) continue; // don't bother if no pairs from these layers
+          const size_t ndoublets = doublets.size();
+          auto addStats = [&](size_t inferred, size_t kept) {
+            if(!stats_) return;
+            generator_.setCounters(nullptr);
+            const std::chrono::duration<double> elapsed = HitPairTiming::now() - start;
+            stats_->add(region.name(), layerSet[0].name(), layerSet[1].name(), searchCounters, ndoublets, inferred, kept, elapsed.count());
+          };
+
+          if(record) recordLayerPair(record->regions.back(), region, layerSet, *hitCachePtr, doublets, iSetup);
+
+          if(doublets.empty()) { addStats(0, 0); continue; } // don't bother if no pairs from these layers
 
           if(doInference_ && layerSet[0].index() <10 && layerSet[0].index() > -1 && layerSet[1].index() < 10 && layerSet[1].index() > -1)
           {
             // std::cout << "HitPairEDProducer created " << doublets.size() << " doublets for layers " << layerSet[0].index() << "," << layerSet[1].index();
-            auto cleanDoublets = cnnInference(doublets);
+            const DoubletPrefilter::Cuts *cuts = prefilter_ ? prefilter_->cuts(layerSet[0].name(), layerSet[1].name()) : nullptr;
+            if(cuts) {
+              const auto startPrefilter = HitPairTiming::now();
+              prefilter(*cuts, doublets, decisions_);
+              time(HitPairTiming::prefilter, startPrefilter, HitPairTiming::now());
+            }
+            const size_t inferred = cuts ? std::count(decisions_.begin(), decisions_.end(), DoubletPrefilter::ambiguous) : doublets.size();
+            auto cleanDoublets = cnnInference(doublets, layerPairModel(layerSet[0].name(), layerSet[1].name()), cuts ? &decisions_ : nullptr,
+                                              scores ? &layerPairScores_ : nullptr);
+            if(duplicateDoublets_) duplicateDoublets_->remove(cleanDoublets, regionIndex, scores ? &layerPairScores_ : nullptr);
+            addStats(inferred, cleanDoublets.size());
+            if(duplicateDoublets_ && cleanDoublets.empty()) continue; // all owned by previous regions
+            const auto startFill = HitPairTiming::now();
+            if(scores) scores->insert(scores->end(), layerPairScores_.begin(), layerPairScores_.end());
             seedingHitSetsProducer.fill(std::get<1>(hitCachePtr_filler_shs), cleanDoublets);
             intermediateHitDoubletsProducer.fill(std::get<1>(hitCachePtr_filler_ihd), layerSet, std::move(cleanDoublets));
+            time(HitPairTiming::fill, startFill, HitPairTiming::now());
           }else
           {
+            if(duplicateDoublets_) duplicateDoublets_->remove(doublets, regionIndex);
+            addStats(0, doublets.size());
+            if(duplicateDoublets_ && doublets.empty()) continue; // all owned by previous regions
+            const auto startFill = HitPairTiming::now();
+            if(scores) scores->insert(scores->end(), doublets.size(), 1.f); // not classified
             seedingHitSetsProducer.fill(std::get<1>(hitCachePtr_filler_shs), doublets);
             intermediateHitDoubletsProducer.fill(std::get<1>(hitCachePtr_filler_ihd), layerSet, std::move(doublets));
+            time(HitPairTiming::fill, startFill, HitPairTiming::now());
           }
 
         }
+        ++regionIndex;
+      }
+
+      if(duplicateDoublets_) {
+        LogDebug("HitPairEDProducer") << "removed " << duplicateDoublets_->nremoved() << " doublets produced by more than one of the " << regionIndex << " regions, " << duplicateDoublets_->nowned() << " unique doublets";
+        iEvent.put(std::make_unique<DoubletOwners>(duplicateDoublets_->owners()));
       }
 
+      if(record) endRecord(*record);
+
       seedingHitSetsProducer.put(iEvent);
       intermediateHitDoubletsProducer.put(iEvent);
+      if(scores) iEvent.put(std::move(scores));
     }
 
   private:
@@ -485,7 +748,7 @@ namespace {
   class DoNothing {
   public:
     DoNothing(const SeedingLayerSetsHits *) {}
-    DoNothing(edm::RunningAverage *) {}
+    DoNothing(edm::RunningAverage *, RegionsSeedingHitSets::Storage) {}
 
     static void produces(edm::ProducerBase&) {};
 
@@ -505,8 +768,8 @@ namespace {
   /////
   class ImplSeedingHitSets {
   public:
-    ImplSeedingHitSets(edm::RunningAverage *localRA):
-      seedingHitSets_(std::make_unique<RegionsSeedingHitSets>()),
+    ImplSeedingHitSets(edm::RunningAverage *localRA, RegionsSeedingHitSets::Storage storage):
+      seedingHitSets_(std::make_unique<RegionsSeedingHitSets>(storage)),
       localRA_(localRA)
     {}
 
@@ -524,10 +787,7 @@ namespace {
     }
 
     void fill(RegionsSeedingHitSets::RegionFiller& filler, const HitDoublets& doublets) {
-      for(size_t i=0, size=doublets.size(); i<size; ++i) {
-        filler.emplace_back(doublets.hit(i, HitDoublets::inner),
-                            doublets.hit(i, HitDoublets::outer));
-      }
+      filler.appendDoublets(doublets);
     }
 
     void put(edm::Event& iEvent) {
@@ -632,44 +892,18 @@ namespace {
 
       EventTmp(const SeedingLayerSetsHits *seedingLayerSetsHits,
                const edm::OwnVector<TrackingRegion> *regions,
-               const std::vector<unsigned>& layerPairBegins):
+               const std::vector<std::pair<unsigned int, unsigned int> >& setPairs):
         seedingLayerSetsHits_(seedingLayerSetsHits), regions_(regions) {
 
-        // construct the pairs from the sets
+        // materialize the cached (layer set, pair begin) list for this event
+        layerPairs.reserve(setPairs.size());
         if(seedingLayerSetsHits_->numberOfLayersInSet() > 2) {
-          for(const auto& layerSet: *seedingLayerSetsHits_) {
-            for(const auto pairBeginIndex: layerPairBegins) {
-              if(pairBeginIndex+1 >= seedingLayerSetsHits->numberOfLayersInSet()) {
-                throw cms::Exception("LogicError") << "Layer pair index " << pairBeginIndex << " is out of bounds, input SeedingLayerSetsHits has only " << seedingLayerSetsHits->numberOfLayersInSet() << " layers per set, and the index+1 must be < than the number of layers in set";
-              }
-
-              // Take only the requested pair of the set
-              SeedingLayerSetsHits::SeedingLayerSet pairCandidate = layerSet.slice(pairBeginIndex, pairBeginIndex+1);
-
-              // it would be trivial to use 128-bit bitfield for O(1) check
-              // if a layer pair has been inserted, but let's test first how
-              // a "straightforward" solution works
-              auto found = std::find_if(layerPairs.begin(), layerPairs.end(), [&](const SeedingLayerSetsHits::SeedingLayerSet& pair) {
-                  return pair[0].index() == pairCandidate[0].index() && pair[1].index() == pairCandidate[1].index();
-                });
-              if(found != layerPairs.end())
-                continue;
-
-              layerPairs.push_back(pairCandidate);
-            }
-          }
+          for(const auto& setPair: setPairs)
+            layerPairs.push_back((*seedingLayerSetsHits_)[setPair.first].slice(setPair.second, setPair.second+1));
         }
         else {
-          if(layerPairBegins.size() != 1) {
-            throw cms::Exception("LogicError") << "With pairs of input layers, it doesn't make sense to specify more than one input layer pair, got " << layerPairBegins.size();
-          }
-          if(layerPairBegins[0] != 0) {
-            throw cms::Exception("LogicError") << "With pairs of input layers, it doesn't make sense to specify other input layer pair than 0; got " << layerPairBegins[0];
-          }
-
-          layerPairs.reserve(seedingLayerSetsHits->size());
-          for(const auto& set: *seedingLayerSetsHits)
-            layerPairs.push_back(set);
+          for(const auto& setPair: setPairs)
+            layerPairs.push_back((*seedingLayerSetsHits_)[setPair.first]);
         }
       }
 
@@ -697,7 +931,7 @@ namespace {
       regionToken_(iC.consumes<edm::OwnVector<TrackingRegion> >(regionTag))
     {}
 
-    EventTmp beginEvent(const edm::Event& iEvent) const {
+    EventTmp beginEvent(const edm::Event& iEvent) {
       edm::Handle<SeedingLayerSetsHits> hlayers;
       iEvent.getByToken(seedingLayerToken_, hlayers);
       const auto *layers = hlayers.product();
@@ -706,13 +940,83 @@ namespace {
       edm::Handle<edm::OwnVector<TrackingRegion> > hregions;
       iEvent.getByToken(regionToken_, hregions);
 
-      return EventTmp(layers, hregions.product(), *layerPairBegins_);
+      updateLayerPairs(hlayers.id(), *layers);
+
+      return EventTmp(layers, hregions.product(), layerPairs_);
     }
 
   private:
+    // recomputes the layer pairs only if the layout of the SeedingLayerSetsHits has changed; the
+    // layout is fixed by the configuration of its producer, so it is looked at only for a new product
+    void updateLayerPairs(const edm::ProductID& layersId, const SeedingLayerSetsHits& layers) {
+      if(layersId == layersId_ && layers.size() == nLayerSets_ && layers.numberOfLayersInSet() == nLayersInSet_)
+        return;
+      layersId_ = layersId;
+      nLayerSets_ = layers.size();
+      nLayersInSet_ = layers.numberOfLayersInSet();
+
+      layoutTmp_.clear();
+      layoutTmp_.reserve(layout_.size());
+      layoutTmp_.push_back(layers.numberOfLayersInSet());
+      for(const auto& layerSet: layers) {
+        for(size_t i=0, size=layerSet.size(); i<size; ++i)
+          layoutTmp_.push_back(layerSet[i].index());
+      }
+      if(layoutTmp_ == layout_)
+        return;
+
+      layout_.swap(layoutTmp_);
+      layerPairs_.clear();
+
+      // construct the pairs from the sets
+      if(layers.numberOfLayersInSet() > 2) {
+        for(const auto pairBeginIndex: *layerPairBegins_) {
+          if(pairBeginIndex+1 >= layers.numberOfLayersInSet()) {
+            throw cms::Exception("LogicError") << "Layer pair index " << pairBeginIndex << " is out of bounds, input SeedingLayerSetsHits has only " << layers.numberOfLayersInSet() << " layers per set, and the index+1 must be < than the number of layers in set";
+          }
+        }
+
+        // one bit per (inner, outer) layer index pair
+        const unsigned int nlayers = layout_.size() > 1 ? *std::max_element(layout_.begin()+1, layout_.end())+1 : 0;
+        std::vector<bool> inserted(nlayers*nlayers, false);
+        unsigned int setIndex = 0;
+        for(const auto& layerSet: layers) {
+          for(const auto pairBeginIndex: *layerPairBegins_) {
+            // Take only the requested pair of the set
+            const unsigned int bit = layerSet[pairBeginIndex].index()*nlayers + layerSet[pairBeginIndex+1].index();
+            if(inserted[bit])
+              continue;
+            inserted[bit] = true;
+            layerPairs_.emplace_back(setIndex, pairBeginIndex);
+          }
+          ++setIndex;
+        }
+      }
+      else {
+        if(layerPairBegins_->size() != 1) {
+          throw cms::Exception("LogicError") << "With pairs of input layers, it doesn't make sense to specify more than one input layer pair, got " << layerPairBegins_->size();
+        }
+        if((*layerPairBegins_)[0] != 0) {
+          throw cms::Exception("LogicError") << "With pairs of input layers, it doesn't make sense to specify other input layer pair than 0; got " << (*layerPairBegins_)[0];
+        }
+
+        layerPairs_.reserve(layers.size());
+        for(unsigned int i=0; i<layers.size(); ++i)
+          layerPairs_.emplace_back(i, 0);
+      }
+    }
+
     const std::vector<unsigned> *layerPairBegins_;
     edm::EDGetTokenT<SeedingLayerSetsHits> seedingLayerToken_;
     edm::EDGetTokenT<edm::OwnVector<TrackingRegion> > regionToken_;
+
+    // cached layer pairs as (layer set index, pair begin index) and the layout they were computed for
+    std::vector<std::pair<unsigned int, unsigned int> > layerPairs_;
+    std::vector<unsigned int> layout_;    // number of layers in set, followed by the layer indices of all the sets
+    std::vector<unsigned int> layoutTmp_;
+    edm::ProductID layersId_;             // SeedingLayerSetsHits product of the layout
+    size_t nLayerSets_ = 0;
+    unsigned int nLayersInSet_ = 0;
   };
 
   /////
@@ -770,7 +1074,7 @@ namespace {
 
 
 
-HitPairEDProducer::HitPairEDProducer(const edm::ParameterSet& iConfig) {
+HitPairEDProducer::HitPairEDProducer(const edm::ParameterSet& iConfig, const StatsSummary *summary) {
   auto layersTag = iConfig.getParameter<edm::InputTag>("seedingLayers");
   auto regionTag = iConfig.getParameter<edm::InputTag>("trackingRegions");
   auto regionLayerTag = iConfig.getParameter<edm::InputTag>("trackingRegionsSeedingLayers");
@@ -789,6 +1093,8 @@ HitPairEDProducer::HitPairEDProducer(const edm::ParameterSet& iConfig) {
 
   const bool produceSeedingHitSets = iConfig.getParameter<bool>("produceSeedingHitSets");
   const bool produceIntermediateHitDoublets = iConfig.getParameter<bool>("produceIntermediateHitDoublets");
+  if(iConfig.getParameter<bool>("produceScores") && !produceIntermediateHitDoublets)
+    throw cms::Exception("Configuration") << "HitPairEDProducer: 'produceScores' gives the scores of the doublets of IntermediateHitDoublets, it requires 'produceIntermediateHitDoublets'";
 
   if(produceSeedingHitSets && produceIntermediateHitDoublets) {
     if(useRegionLayers) throw cms::Exception("Configuration") << "Mode 'trackingRegionsSeedingLayers' makes sense only with 'produceSeedingHitsSets', now also 'produceIntermediateHitDoublets is active";
@@ -813,6 +1119,7 @@ HitPairEDProducer::HitPairEDProducer(const edm::ParameterSet& iConfig) {
   if(clusterCheckTag.label() != "")
     clusterCheckToken_ = consumes<bool>(clusterCheckTag);
 
+  impl_->setTimingOrigin(summary->origin);
   impl_->produces(*this);
 }
 
@@ -825,12 +1132,63 @@ void HitPairEDProducer::fillDescriptions(edm::ConfigurationDescriptions& descrip
   desc.add<edm::InputTag>("clusterCheck", edm::InputTag("trackerClusterCheck"));
   desc.add<bool>("produceSeedingHitSets", false);
   desc.add<bool>("produceIntermediateHitDoublets", false);
+  desc.add<bool>("produceScores", false)->setComment("Produce also the classifier score of each doublet kept, a std::vector<float> aligned with the doublets of IntermediateHitDoublets in sequence (1 for the doublets not classified by the network); requires produceIntermediateHitDoublets");
   desc.add<unsigned int>("maxElement", 1000000);
+  desc.add<std::string>("maxElementOverflow", "clear")->setComment("Layer pairs with more than maxElement doublets: 'clear' drops all their doublets, 'keepBest' keeps the maxElement ones closest to the center of the phi and RZ windows");
+  desc.add<bool>("removeDuplicateDoublets", false)->setComment("Keep each (inner hit, outer hit) doublet only in the first TrackingRegion producing it, for overlapping regions; the regions producing each doublet kept are produced as DoubletOwners, aligned with the doublets of IntermediateHitDoublets in sequence");
+  desc.add<bool>("compactSeedingHitSets", false)->setComment("Store the seeding hit sets as two hit pointers per doublet instead of full SeedingHitSets");
   desc.add<std::vector<unsigned> >("layerPairs", std::vector<unsigned>{0})->setComment("Indices to the pairs of consecutive layers, i.e. 0 means (0,1), 1 (1,2) etc.");
+  desc.add<bool>("collectStats", false)->setComment("Collect the doublet search statistics per region type and layer pair, printed at the end of the job");
+  desc.add<std::string>("statsFile", "")->setComment("If non-empty (and collectStats), write the statistics also as JSON to this file");
+  desc.add<bool>("collectTiming", false)->setComment("Time the doublet search, the CNN inference steps and the product filling, the quantiles are printed at the end of the job");
+  desc.add<std::string>("timingTraceFile", "")->setComment("If non-empty, write each timed step in Chrome trace format to '<timingTraceFile>.<stream id>'");
+  desc.add<std::string>("graphFile", "/lustre/home/adrianodif/CNNDoublets/freeze_models/dense_pix_model_final.pb")->setComment("Frozen graph of the doublet classifier (info_input to output/Softmax) for the layer pairs without a model in 'layerPairModels'");
+  edm::ParameterSetDescription layerPairModel;
+  layerPairModel.add<std::string>("innerLayer");
+  layerPairModel.add<std::string>("outerLayer");
+  layerPairModel.add<std::string>("graphFile")->setComment("Frozen graph of the classifier specialized for this layer pair, same inputs and outputs as 'graphFile'");
+  layerPairModel.add<double>("thresh", -1.)->setComment("Score threshold of this layer pair, negative to use 'thresh'");
+  desc.addVPSet("layerPairModels", layerPairModel, std::vector<edm::ParameterSet>())->setComment("Models specialized per layer pair (e.g. innerLayer = 'BPix1', outerLayer = 'FPix1_pos'), each graph file is loaded once");
+  desc.add<std::string>("prefilterFile", "")->setComment("If non-empty, cuts per layer pair (see DoubletPrefilter.h) rejecting or accepting the doublets before the CNN inference, only the others are classified by the network");
+  desc.add<std::string>("recordFile", "")->setComment("If non-empty, record the inputs of the doublet search to '<recordFile>.<stream id>' for offline replay with replayHitPairs");
 
   descriptions.add("hitPairEDProducerDefault", desc);
 }
 
+std::unique_ptr<StatsSummary> HitPairEDProducer::initializeGlobalCache(const edm::ParameterSet& iConfig) {
+  auto summary = std::make_unique<StatsSummary>();
+  summary->collect = iConfig.getParameter<bool>("collectStats");
+  summary->file = iConfig.getParameter<std::string>("statsFile");
+  summary->collectTiming = iConfig.getParameter<bool>("collectTiming");
+  summary->origin = HitPairTiming::now();
+  return summary;
+}
+
+void HitPairEDProducer::endStream() {
+  if(!impl_->stats() && !impl_->timing()) return;
+  std::lock_guard<std::mutex> guard(globalCache()->mutex);
+  if(impl_->stats()) globalCache()->stats.merge(*impl_->stats());
+  if(impl_->timing()) globalCache()->timing.merge(*impl_->timing());
+}
+
+void HitPairEDProducer::globalEndJob(const StatsSummary *summary) {
+  if(summary->collectTiming) {
+    std::ostringstream table;
+    summary->timing.printTable(table);
+    edm::LogVerbatim("HitPairEDProducer") << "Timing of the HitPairEDProducer steps\n" << table.str();
+  }
+  if(!summary->collect) return;
+  std::ostringstream table;
+  summary->stats.printTable(table);
+  edm::LogVerbatim("HitPairEDProducer") << "Doublet statistics per region type and layer pair (per call averages)\n" << table.str();
+  if(!summary->file.empty()) {
+    std::ofstream out(summary->file);
+    if(!out)
+      throw cms::Exception("FileOpenError") << "HitPairEDProducer: cannot open statsFile " << summary->file;
+    summary->stats.writeJson(out);
+  }
+}
+
 void HitPairEDProducer::produce(edm::Event& iEvent, const edm::EventSetup& iSetup) {
   bool clusterCheckOk = true;
   if(!clusterCheckToken_.isUninitialized()) {
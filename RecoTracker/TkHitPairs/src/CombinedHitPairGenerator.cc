@@ -3,35 +3,91 @@
 #include "FWCore/Framework/interface/ConsumesCollector.h"
 #include "FWCore/Framework/interface/Event.h"
 #include "DataFormats/Common/interface/Handle.h"
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+
+#include "tbb/parallel_for.h"
+
+#include <algorithm>
 
 CombinedHitPairGenerator::CombinedHitPairGenerator(const edm::ParameterSet& cfg, edm::ConsumesCollector& iC):
   theSeedingLayerToken(iC.consumes<SeedingLayerSetsHits>(cfg.getParameter<edm::InputTag>("SeedingLayers")))
 {
   theMaxElement = cfg.getParameter<unsigned int>("maxElement");
-  theGenerator = std::make_unique<HitPairGeneratorFromLayerPair>(0, 1, &theLayerCache, theMaxElement);
+  const auto overflow = HitPairGeneratorFromLayerPair::overflow(cfg.existsAs<std::string>("maxElementOverflow") ? cfg.getParameter<std::string>("maxElementOverflow") : "clear");
+  theGenerator = std::make_unique<HitPairGeneratorFromLayerPair>(0, 1, &theLayerCache, theMaxElement, overflow);
 }
 
 CombinedHitPairGenerator::CombinedHitPairGenerator(const CombinedHitPairGenerator& cb):
   theSeedingLayerToken(cb.theSeedingLayerToken),
-  theGenerator(std::make_unique<HitPairGeneratorFromLayerPair>(0, 1, &theLayerCache, cb.theMaxElement))
+  theGenerator(std::make_unique<HitPairGeneratorFromLayerPair>(0, 1, &theLayerCache, cb.theMaxElement, cb.theGenerator->overflow()))
 {
   theMaxElement = cb.theMaxElement;
 }
 
 CombinedHitPairGenerator::~CombinedHitPairGenerator() {}
 
+namespace {
+  const SeedingLayerSetsHits& getLayers(const edm::Event& ev, const edm::EDGetTokenT<SeedingLayerSetsHits>& token) {
+    edm::Handle<SeedingLayerSetsHits> hlayers;
+    ev.getByToken(token, hlayers);
+    const SeedingLayerSetsHits& layers = *hlayers;
+    if(layers.numberOfLayersInSet() != 2)
+      throw cms::Exception("Configuration") << "CombinedHitPairGenerator expects SeedingLayerSetsHits::numberOfLayersInSet() to be 2, got " << layers.numberOfLayersInSet();
+    return layers;
+  }
+}
+
+std::vector<std::unique_ptr<HitDoublets> > CombinedHitPairGenerator::layerSetDoublets(
+   const TrackingRegion& region, const SeedingLayerSetsHits& layers,
+   const edm::Event& ev, const edm::EventSetup& es, LayerCacheType& layerCache)
+{
+  // build once the maps of all the layers not yet in the cache, concurrently,
+  // and add them to the cache before any doublet search reads it
+  std::vector<SeedingLayerSetsHits::SeedingLayer> missing;
+  for(SeedingLayerSetsHits::SeedingLayerSet layerSet: layers) {
+    for(int i=0; i<2; ++i) {
+      auto layer = layerSet[i];
+      if(layerCache.get(layer) == nullptr &&
+         std::find_if(missing.begin(), missing.end(), [&](const SeedingLayerSetsHits::SeedingLayer& l) { return l.index() == layer.index(); }) == missing.end())
+        missing.push_back(layer);
+    }
+  }
+  std::vector<std::unique_ptr<RecHitsSortedInPhi> > maps(missing.size());
+  tbb::parallel_for(size_t(0), missing.size(), [&](size_t i) {
+      maps[i] = LayerCacheType::makeHitMap(missing[i], region, es);
+    });
+  for(size_t i=0; i!=missing.size(); ++i)
+    layerCache.add(missing[i], std::move(maps[i]));
+
+  // the cache is now only read: search the layer sets concurrently, one buffer per layer set
+  std::vector<std::unique_ptr<HitDoublets> > result(layers.size());
+  tbb::parallel_for(size_t(0), layers.size(), [&](size_t i) {
+      result[i] = std::make_unique<HitDoublets>(theGenerator->doublets(region, ev, es, layers[i], layerCache));
+    });
+  return result;
+}
+
 void CombinedHitPairGenerator::hitPairs(
    const TrackingRegion& region, OrderedHitPairs  & result,
    const edm::Event& ev, const edm::EventSetup& es)
 {
-  edm::Handle<SeedingLayerSetsHits> hlayers;
-  ev.getByToken(theSeedingLayerToken, hlayers);
-  const SeedingLayerSetsHits& layers = *hlayers;
-  if(layers.numberOfLayersInSet() != 2)
-    throw cms::Exception("Configuration") << "CombinedHitPairGenerator expects SeedingLayerSetsHits::numberOfLayersInSet() to be 2, got " << layers.numberOfLayersInSet();
+  const SeedingLayerSetsHits& layers = getLayers(ev, theSeedingLayerToken);
 
-  for(SeedingLayerSetsHits::SeedingLayerSet layerSet: layers) {
-    theGenerator->hitPairs( region, result, ev, es, layerSet);
+  auto doublets = layerSetDoublets(region, layers, ev, es, theLayerCache);
+
+  // concatenate in the layer-set order, with the semantics of HitPairGeneratorFromLayerPair::hitPairs
+  const bool clearOnOverflow = theGenerator->overflow() == HitPairGeneratorFromLayerPair::Overflow::clear;
+  size_t total = 0;
+  for(const auto& ds: doublets) total += ds->size();
+  result.reserve(result.size()+total);
+  for(const auto& ds: doublets) {
+    for (std::size_t i=0; i!=ds->size(); ++i) {
+      result.push_back( OrderedHitPair( ds->hit(i,HitDoublets::inner),ds->hit(i,HitDoublets::outer) ));
+    }
+    if (clearOnOverflow && theMaxElement!=0 && result.size() >= theMaxElement){
+      result.clear();
+      edm::LogError("TooManyPairs")<<"number of pairs exceed maximum, no pairs produced";
+    }
   }
 
   theLayerCache.clear();
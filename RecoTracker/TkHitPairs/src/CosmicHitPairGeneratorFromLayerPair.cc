@@ -6,12 +6,58 @@
 #include "FWCore/MessageLogger/interface/MessageLogger.h"
 #include "TrackingTools/DetLayers/interface/BarrelDetLayer.h"
 #include "FWCore/Framework/interface/ESHandle.h"
-#include "RecoTracker/TransientTrackingRecHit/interface/TkTransientTrackingRecHitBuilder.h"
-#include "TrackingTools/Records/interface/TransientRecHitRecord.h"
+#include "DataFormats/GeometryVector/interface/Phi.h"
+
+#include <algorithm>
 
 using namespace std;
 // typedef TransientTrackingRecHit::ConstRecHitPointer TkHitPairsCachedHit;
 
+namespace {
+  // positions of the hits of a layer extracted once, in the order of LayerWithHits::recHits()
+  struct CosmicHits {
+    explicit CosmicHits(const LayerWithHits & layer) {
+      auto const & hits = layer.recHits();
+      hit.reserve(hits.size()); x.reserve(hits.size()); y.reserve(hits.size());
+      z.reserve(hits.size()); perp.reserve(hits.size()); phi.reserve(hits.size());
+      for (auto h : hits) {
+        auto bh = static_cast<BaseTrackerRecHit const *>(h);
+        GlobalPoint gp = bh->globalPosition();
+        hit.push_back(bh);
+        x.push_back(gp.x()); y.push_back(gp.y()); z.push_back(gp.z());
+        perp.push_back(gp.perp()); phi.push_back(gp.barePhi());
+      }
+    }
+    unsigned int size() const { return hit.size(); }
+
+    std::vector<BaseTrackerRecHit const *> hit;
+    std::vector<float> x, y, z, perp, phi;
+  };
+
+  // indices of the hits with y>0 or y<0 sorted in z, for window searches
+  struct ZSorted {
+    ZSorted(const CosmicHits & hits, int ysign) {
+      for (unsigned int i=0; i!=hits.size(); ++i)
+        if (ysign*hits.y[i] > 0) index.push_back(i);
+      std::sort(index.begin(), index.end(), [&hits](int a, int b) { return hits.z[a] < hits.z[b]; });
+      z.reserve(index.size());
+      for (auto i : index) z.push_back(hits.z[i]);
+    }
+    // appends the indices with zMin <= z <= zMax
+    void window(float zMin, float zMax, std::vector<int> & result) const {
+      auto b = std::lower_bound(z.begin(), z.end(), zMin) - z.begin();
+      auto e = std::upper_bound(z.begin()+b, z.end(), zMax) - z.begin();
+      result.insert(result.end(), index.begin()+b, index.begin()+e);
+    }
+    std::vector<int> index;
+    std::vector<float> z;
+  };
+
+  // the windows are widened by this margin and the exact cuts applied to the candidates,
+  // so that rounding in the bounds can not change the result
+  constexpr float zMargin = 1.e-3f;
+}
+
 CosmicHitPairGeneratorFromLayerPair::CosmicHitPairGeneratorFromLayerPair(const LayerWithHits* inner, 
 							     const LayerWithHits* outer, 
 									 //							     LayerCacheType* layerCache, 
@@ -30,19 +76,9 @@ void CosmicHitPairGeneratorFromLayerPair::hitPairs(
   const TrackingRegion & region, OrderedHitPairs & result,
   const edm::EventSetup& iSetup)
 {
-//  static int NSee = 0; static int Ntry = 0; static int Nacc = 0;
-
-
-  typedef OrderedHitPair::InnerRecHit InnerHit;
-  typedef OrderedHitPair::OuterRecHit OuterHit;
-
-
   if (theInnerLayer->recHits().empty()) return;
 
   if (theOuterLayer->recHits().empty()) return;
-  //  const DetLayer* innerlay=theOuterLayer->layer();
-  // const BarrelDetLayer *pippo=dynamic_cast<const BarrelDetLayer*>(theOuterLayer->layer());
-
 
   // ************ Daniele
 
@@ -54,11 +90,9 @@ void CosmicHitPairGeneratorFromLayerPair::hitPairs(
 
   bool seedfromoverlaps= false;
   bool InTheBarrel = false;
-  bool InTheForward = false;
   if (blay1 && blay2) {
     InTheBarrel = true;
   }
-  else  InTheForward = true;
 
   if (InTheBarrel){
     float radius1 =dynamic_cast<const BarrelDetLayer*>(theInnerLayer->layer())->specificSurface().radius();
@@ -66,65 +100,54 @@ void CosmicHitPairGeneratorFromLayerPair::hitPairs(
      seedfromoverlaps=(abs(radius1-radius2)<0.1) ? true : false;
   }
 
- 
-  vector<OrderedHitPair> allthepairs;
-  std::string builderName = "WithTrackAngle";
-  edm::ESHandle<TransientTrackingRecHitBuilder> builder;
-  iSetup.get<TransientRecHitRecord>().get(builderName, builder);
-
-  
-
-  for( auto ohh=theOuterLayer->recHits().begin();ohh!=theOuterLayer->recHits().end();ohh++){
-    for(auto ihh=theInnerLayer->recHits().begin();ihh!=theInnerLayer->recHits().end();ihh++){
-     auto oh = static_cast<BaseTrackerRecHit const * const>(*ohh);
-     auto ih = static_cast<BaseTrackerRecHit const * const>(*ihh);
-      
-      float z_diff =ih->globalPosition().z()-oh->globalPosition().z();
-      float inny=ih->globalPosition().y();
-      float outy=oh->globalPosition().y();
-      float innx=ih->globalPosition().x();
-      float outx=oh->globalPosition().x();;
-      float dxdy=abs((outx-innx)/(outy-inny));
-      float DeltaR=oh->globalPosition().perp()-ih->globalPosition().perp();;
-      
-      if( InTheBarrel && (abs(z_diff)<30) // && (outy > 0.) && (inny > 0.)
-	  //&&((abs(inny-outy))<30) 
-	  &&(dxdy<2)
-	  &&(inny*outy>0)
-	  && (abs(DeltaR)>0)) {
-
-	//	cout << " ******** sono dentro inthebarrel *********** " << endl;
-	if (seedfromoverlaps){
-	  //this part of code works for MTCC
-	  // for the other geometries must be verified
-	  //Overlaps in the difference in z is decreased and the difference in phi is
-	  //less than 0.05
-	  if ((DeltaR<0)&&(abs(z_diff)<18)&&(abs(ih->globalPosition().phi()-oh->globalPosition().phi())<0.05)&&(dxdy<2)) result.push_back( OrderedHitPair(ih, oh));
-	}
-	else  result.push_back( OrderedHitPair( ih, oh));
-      
-	
-
-
+  // In the barrel, instead of testing all the N x M combinations the inner hits
+  // are sorted in z and split by the sign of y, and only the ones in the z window
+  // of each outer hit are tested. The candidates are tested in the original inner
+  // order with the original cuts, so the pairs and their order are unchanged.
+  const CosmicHits inner(*theInnerLayer);
+  const CosmicHits outer(*theOuterLayer);
+
+  std::vector<int> candidates;
+  if (InTheBarrel) {
+    const ZSorted innerUp(inner, 1), innerDown(inner, -1);
+    const float zWindow = (seedfromoverlaps ? 18.f : 30.f) + zMargin;
+
+    for (unsigned int io=0; io!=outer.size(); ++io) {
+      const float outy = outer.y[io];
+      if (outy == 0) continue; // inny*outy>0 can not be satisfied
+      candidates.clear();
+      (outy > 0 ? innerUp : innerDown).window(outer.z[io]-zWindow, outer.z[io]+zWindow, candidates);
+      std::sort(candidates.begin(), candidates.end());
+
+      for (int ii : candidates) {
+        float z_diff = inner.z[ii]-outer.z[io];
+        float inny = inner.y[ii];
+        float dxdy = abs((outer.x[io]-inner.x[ii])/(outy-inny));
+        float DeltaR = outer.perp[io]-inner.perp[ii];
+
+        if( (abs(z_diff)<30) && (dxdy<2) && (inny*outy>0) && (abs(DeltaR)>0)) {
+          if (seedfromoverlaps){
+            //this part of code works for MTCC
+            // for the other geometries must be verified
+            //Overlaps in the difference in z is decreased and the difference in phi is
+            //less than 0.05
+            Geom::Phi<float> dphi = Geom::Phi<float>(inner.phi[ii]) - Geom::Phi<float>(outer.phi[io]);
+            if ((DeltaR<0)&&(abs(z_diff)<18)&&(abs(dphi.value())<0.05)&&(dxdy<2)) result.push_back( OrderedHitPair(inner.hit[ii], outer.hit[io]));
+          }
+          else  result.push_back( OrderedHitPair(inner.hit[ii], outer.hit[io]));
+        }
       }
-      if( InTheForward &&  (abs(z_diff) > 1.)) {
-	//	cout << " ******** sono dentro intheforward *********** " << endl;
-	result.push_back( OrderedHitPair(ih,oh));
+    }
+  }
+  else {
+    // InTheForward: almost all the N x M pairs pass |z_diff| > 1, so a z window
+    // can not save work; the inner positions extracted once are enough
+    for (unsigned int io=0; io!=outer.size(); ++io) {
+      const float zo = outer.z[io];
+      for (unsigned int ii=0; ii!=inner.size(); ++ii) {
+        float z_diff = inner.z[ii]-zo;
+        if (abs(z_diff) > 1.) result.push_back( OrderedHitPair(inner.hit[ii], outer.hit[io]));
       }
     }
   }
-
-//   stable_sort(allthepairs.begin(),allthepairs.end(),CompareHitPairsY(iSetup));
-//   //Seed from overlaps are saved only if 
-//   //no others have been saved
-
-//   if (allthepairs.size()>0) {
-//     if (seedfromoverlaps) {
-//       if (result.size()==0) result.push_back(allthepairs[0]);
-//     }
-//     else result.push_back(allthepairs[0]);
-//   }
-
-
 }
-
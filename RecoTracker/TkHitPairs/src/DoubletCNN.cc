@@ -0,0 +1,586 @@
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+namespace {
+  DoubletCNN::Activation readActivation(std::istream& in, const std::string& fileName) {
+    std::string name;
+    in >> name;
+    if(name == "linear") return DoubletCNN::Activation::linear;
+    if(name == "relu") return DoubletCNN::Activation::relu;
+    if(name == "sigmoid") return DoubletCNN::Activation::sigmoid;
+    if(name == "softmax") return DoubletCNN::Activation::softmax;
+    throw cms::Exception("DoubletCNN") << "unknown activation '" << name << "' in " << fileName;
+  }
+
+  void readValues(std::istream& in, const std::string& fileName, const DoubletCNN::Layer& layer, size_t n, std::vector<float>& values) {
+    values.resize(n);
+    for(auto& v: values) in >> v;
+    if(!in)
+      throw cms::Exception("DoubletCNN") << "truncated layer " << layer.nin << " -> " << layer.nout << " in " << fileName;
+  }
+}
+
+DoubletCNN::DoubletCNN(const std::string& fileName) {
+  std::ifstream in(fileName);
+  if(!in)
+    throw cms::Exception("DoubletCNN") << "cannot open " << fileName;
+
+  std::string magic, input;
+  int version = 0;
+  in >> magic >> version >> input >> padSize_ >> channels_ >> infoSize_;
+  if(!in || magic != "DoubletCNN" || version != 1 || input != "input")
+    throw cms::Exception("DoubletCNN") << fileName << " is not a version 1 DoubletCNN file";
+
+  bool normalize = false, standardize = false;
+  float padMean = 0.f, padSigma = 1.f;
+  std::vector<float> infoMeans, infoSigmas;
+  std::string type;
+  while(in >> type && type != "end") {
+    if((type == "normalize" || type == "standardize") && !layers_.empty())
+      throw cms::Exception("DoubletCNN") << type << " after the first layer in " << fileName;
+    if(type == "normalize") {
+      in >> padMean >> padSigma;
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "bad normalize in " << fileName;
+      normalize = true;
+      continue;
+    }
+    if(type == "standardize") {
+      infoMeans.resize(infoSize_);
+      infoSigmas.resize(infoSize_);
+      for(auto& v: infoMeans) in >> v;
+      for(auto& v: infoSigmas) in >> v;
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "truncated standardize in " << fileName;
+      standardize = true;
+      continue;
+    }
+    if(type == "affine") {
+      if(layers_.empty())
+        throw cms::Exception("DoubletCNN") << "affine before the first layer in " << fileName;
+      Layer& layer = layers_.back();
+      unsigned int n = 0;
+      in >> n;
+      readValues(in, fileName, layer, n, layer.scale);
+      readValues(in, fileName, layer, n, layer.shift);
+      continue;
+    }
+    if(type == "quantize") {
+      if(layers_.empty())
+        throw cms::Exception("DoubletCNN") << "quantize before the first layer in " << fileName;
+      in >> layers_.back().inputMin >> layers_.back().inputMax;
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "bad quantize of layer " << layers_.size() - 1 << " in " << fileName;
+      continue;
+    }
+    Layer layer;
+    if(type == "conv") {
+      layer.type = Layer::conv;
+      in >> layer.size >> layer.nin >> layer.nout;
+      layer.activation = readActivation(in, fileName);
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "bad conv layer " << layers_.size() << " in " << fileName;
+      readValues(in, fileName, layer, size_t(layer.size)*layer.size*layer.nin*layer.nout, layer.weights);
+      readValues(in, fileName, layer, layer.nout, layer.biases);
+    }
+    else if(type == "maxpool") {
+      layer.type = Layer::maxpool;
+      in >> layer.size;
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "bad maxpool layer " << layers_.size() << " in " << fileName;
+    }
+    else if(type == "dense") {
+      layer.type = Layer::dense;
+      in >> layer.nin >> layer.nout;
+      layer.activation = readActivation(in, fileName);
+      if(!in)
+        throw cms::Exception("DoubletCNN") << "bad dense layer " << layers_.size() << " in " << fileName;
+      readValues(in, fileName, layer, size_t(layer.nin)*layer.nout, layer.weights);
+      readValues(in, fileName, layer, layer.nout, layer.biases);
+    }
+    else {
+      throw cms::Exception("DoubletCNN") << "unknown layer '" << type << "' in " << fileName;
+    }
+    layers_.push_back(std::move(layer));
+  }
+  if(type != "end")
+    throw cms::Exception("DoubletCNN") << fileName << " is truncated";
+
+  init(fileName);
+  if(normalize) normalizePads(padMean, padSigma);
+  if(standardize) standardizeInfo(infoMeans, infoSigmas);
+}
+
+DoubletCNN::DoubletCNN(unsigned int padSize, unsigned int channels, unsigned int infoSize, std::vector<Layer> layers):
+  padSize_(padSize), channels_(channels), infoSize_(infoSize), layers_(std::move(layers)) {
+  init("model");
+}
+
+void DoubletCNN::init(const std::string& source) {
+  if(channels_ % 2 != 0 || (channels_ > 0 && padSize_ == 0))
+    throw cms::Exception("DoubletCNN") << "bad input " << padSize_ << " " << channels_ << " in " << source << ", the image needs an even number of channels";
+
+  // shape of the image, then number of features, after each layer
+  unsigned int size = padSize_, nchannels = channels_, features = 0;
+  bool flat = false;
+  for(unsigned int l=0; l<layers_.size(); ++l) {
+    Layer& layer = layers_[l];
+    if(layer.type == Layer::conv || layer.type == Layer::maxpool) {
+      if(flat || channels_ == 0)
+        throw cms::Exception("DoubletCNN") << (layer.type == Layer::conv ? "conv" : "maxpool") << " layer " << l << " in " << source << " has no image input";
+      if(layer.type == Layer::conv) {
+        if(layer.size == 0 || layer.nin != nchannels || layer.nout == 0
+           || layer.weights.size() != size_t(layer.size)*layer.size*layer.nin*layer.nout || layer.biases.size() != layer.nout)
+          throw cms::Exception("DoubletCNN") << "bad conv layer " << l << " in " << source << ", expected " << nchannels << " input channels";
+        nchannels = layer.nout;
+      }
+      else {
+        if(layer.size == 0)
+          throw cms::Exception("DoubletCNN") << "bad maxpool layer " << l << " in " << source;
+        layer.nin = layer.nout = nchannels;
+        size = (size + layer.size - 1)/layer.size;
+      }
+      bufferSize_ = std::max(bufferSize_, size*size*nchannels);
+    }
+    else {
+      if(!flat) {
+        flat = true;
+        imageLayers_ = l;
+        flatSize_ = channels_ > 0 ? size*size*nchannels : 0;
+        features = flatSize_ + infoSize_;
+        // the first layer reads the pads directly
+        bufferSize_ = std::max(bufferSize_, imageLayers_ > 0 || channels_ == 0 ? features : 0);
+      }
+      if(layer.nin != features || layer.nout == 0
+         || layer.weights.size() != size_t(layer.nin)*layer.nout || layer.biases.size() != layer.nout)
+        throw cms::Exception("DoubletCNN") << "bad dense layer " << l << " in " << source << ", expected " << features << " inputs";
+      features = layer.nout;
+      bufferSize_ = std::max(bufferSize_, features);
+    }
+    if((!layer.scale.empty() || !layer.shift.empty()) && (layer.scale.size() != layer.nout || layer.shift.size() != layer.nout))
+      throw cms::Exception("DoubletCNN") << "bad affine of layer " << l << " in " << source << ", expected " << layer.nout << " values";
+    if(layer.inputMax != layer.inputMin && (l == 0 || layer.type == Layer::maxpool || !(layer.inputMax > layer.inputMin)))
+      throw cms::Exception("DoubletCNN") << "bad quantize of layer " << l << " in " << source << ", only the convolutions and dense layers after the first one are quantized";
+  }
+  if(!flat)
+    throw cms::Exception("DoubletCNN") << source << " has no dense layer";
+  if(layers_.front().type == Layer::maxpool)
+    throw cms::Exception("DoubletCNN") << source << " starts with a maxpool, the first layer reads the pads";
+
+  scatterLimit_ = padSize_*padSize_/2;
+  makeBackgroundMaps();
+  quantize();
+}
+
+void DoubletCNN::write(const std::string& fileName) const {
+  std::ofstream out(fileName);
+  if(!out)
+    throw cms::Exception("DoubletCNN") << "cannot write " << fileName;
+  static const char *const activations[] = {"linear", "relu", "sigmoid", "softmax"};
+  out.precision(std::numeric_limits<float>::max_digits10);
+  out << "DoubletCNN 1\ninput " << padSize_ << " " << channels_ << " " << infoSize_ << "\n";
+  // sigma and the feature standardization are in the weights already
+  if(padsNormalized_)
+    out << "normalize " << -padOffset_ << " 1\n";
+  auto values = [&out](const std::vector<float>& v) {
+    for(float x: v) out << x << " ";
+    out << "\n";
+  };
+  for(const auto& layer: layers_) {
+    switch(layer.type) {
+    case Layer::conv:
+      out << "conv " << layer.size << " " << layer.nin << " " << layer.nout << " " << activations[int(layer.activation)] << "\n";
+      values(layer.weights);
+      values(layer.biases);
+      break;
+    case Layer::maxpool:
+      out << "maxpool " << layer.size << "\n";
+      break;
+    case Layer::dense:
+      out << "dense " << layer.nin << " " << layer.nout << " " << activations[int(layer.activation)] << "\n";
+      values(layer.weights);
+      values(layer.biases);
+      break;
+    }
+    if(!layer.scale.empty()) {
+      out << "affine " << layer.scale.size() << "\n";
+      values(layer.scale);
+      values(layer.shift);
+    }
+    if(layer.inputMax > layer.inputMin)
+      out << "quantize " << layer.inputMin << " " << layer.inputMax << "\n";
+  }
+  out << "end\n";
+  if(!out)
+    throw cms::Exception("DoubletCNN") << "cannot write " << fileName;
+}
+
+void DoubletCNN::normalizePads(float mean, float sigma) {
+  if(!std::isfinite(mean) || !std::isfinite(sigma) || sigma == 0.f)
+    throw cms::Exception("DoubletCNN") << "bad pad normalization, mean " << mean << " sigma " << sigma;
+  padsNormalized_ = true;
+  if(channels_ == 0) return;
+  // w*((x - mean)/sigma + offset) = (w/sigma)*(x + sigma*offset - mean)
+  Layer& layer = layers_.front();
+  const size_t padWeights = layer.type == Layer::conv ? layer.weights.size() : size_t(flatSize_)*layer.nout;
+  for(size_t w=0; w<padWeights; ++w) layer.weights[w] /= sigma;
+  padOffset_ = sigma*padOffset_ - mean;
+  makeBackgroundMaps();
+}
+
+void DoubletCNN::standardizeInfo(const std::vector<float>& means, const std::vector<float>& sigmas) {
+  if(means.size() != infoSize_ || sigmas.size() != infoSize_)
+    throw cms::Exception("DoubletCNN") << "standardization of " << means.size() << " and " << sigmas.size()
+                                       << " features for a model of " << infoSize_ << " features";
+  for(unsigned int f=0; f<infoSize_; ++f)
+    if(!std::isfinite(means[f]) || !std::isfinite(sigmas[f]) || sigmas[f] == 0.f)
+      throw cms::Exception("DoubletCNN") << "bad standardization of feature " << f << ", mean " << means[f] << " sigma " << sigmas[f];
+  // the features follow the flattened image in the inputs of the first dense layer
+  Layer& layer = layers_[imageLayers_];
+  const unsigned int nout = layer.nout;
+  for(unsigned int f=0; f<infoSize_; ++f) {
+    float *w = layer.weights.data() + size_t(flatSize_ + f)*nout;
+    for(unsigned int o=0; o<nout; ++o) {
+      w[o] /= sigmas[f];
+      layer.biases[o] -= means[f]*w[o];
+    }
+  }
+  // its inputs are the raw features now
+  if(layer.inputMax > layer.inputMin) {
+    layer.inputMin = layer.inputMax = 0.f;
+    quantize();
+  }
+}
+
+void DoubletCNN::makeBackgroundMaps() {
+  if(channels_ == 0) return;
+  const Layer& layer = layers_.front();
+  const unsigned int n = padSize_, np = n*n, nout = layer.nout;
+  if(layer.type == Layer::dense) {
+    // sum of the weights of all the pixels of the channel
+    backgroundMaps_.assign(channels_*nout, 0.f);
+    for(unsigned int c=0; c<channels_; ++c)
+      for(unsigned int p=0; p<np; ++p)
+        for(unsigned int o=0; o<nout; ++o)
+          backgroundMaps_[c*nout + o] += layer.weights[(p*channels_ + c)*nout + o];
+    return;
+  }
+  // sum of the kernel taps falling inside the pad, for each output pixel
+  const int k = layer.size, pad = (k-1)/2;
+  backgroundMaps_.assign(channels_*np*nout, 0.f);
+  for(unsigned int c=0; c<channels_; ++c) {
+    for(int y=0; y<int(n); ++y) {
+      for(int x=0; x<int(n); ++x) {
+        float *map = backgroundMaps_.data() + (c*np + y*n + x)*nout;
+        for(int dy=0; dy<k; ++dy) {
+          const int yy = y + dy - pad;
+          if(yy < 0 || yy >= int(n)) continue;
+          for(int dx=0; dx<k; ++dx) {
+            const int xx = x + dx - pad;
+            if(xx < 0 || xx >= int(n)) continue;
+            const float *w = layer.weights.data() + ((dy*k + dx)*channels_ + c)*nout;
+            for(unsigned int o=0; o<nout; ++o) map[o] += w[o];
+          }
+        }
+      }
+    }
+  }
+}
+
+void DoubletCNN::Input::resize(const DoubletCNN& model, unsigned int size) {
+  size_ = size;
+  padElements_ = model.padSize()*model.padSize();
+  infoSize_ = model.infoSize();
+  pads_.resize(size_t(2)*size*padElements_);
+  channels_.resize(2*size);
+  info_.resize(size_t(size)*infoSize_);
+}
+
+void DoubletCNN::operator()(const Input& input, std::vector<float>& outputs) const {
+  const unsigned int n = input.size(), nout = this->outputs();
+  outputs.resize(size_t(n)*nout);
+  if(input.padElements() != padSize_*padSize_ || input.infoSize() != infoSize_)
+    throw cms::Exception("DoubletCNN") << "input of " << input.padElements() << " pixels and " << input.infoSize()
+                                       << " features for a model of " << padSize_*padSize_ << " pixels and " << infoSize_ << " features";
+
+  Workspace work;
+  work.a.resize(bufferSize_);
+  work.b.resize(bufferSize_);
+  for(unsigned int i=0; i<n; ++i)
+    evaluate(input, i, work, outputs.data() + size_t(i)*nout);
+}
+
+void DoubletCNN::evaluate(const Input& input, unsigned int i, Workspace& work, float *output,
+                          Observer observer, void *context) const {
+  const float *pads[2] = {input.pad(i, 0), input.pad(i, 1)};
+  const unsigned int channels[2] = {input.channel(i, 0), input.channel(i, 1)};
+  if(channels_ > 0 && (channels[0] >= channels_ || channels[1] >= channels_))
+    throw cms::Exception("DoubletCNN") << "channels " << channels[0] << ", " << channels[1] << " of doublet " << i << " for a model of " << channels_ << " channels";
+
+  unsigned int size = padSize_, nchannels = channels_;
+  float *in = work.a.data(), *out = work.b.data();
+  for(unsigned int l=0, nl=layers_.size(); l<nl; ++l) {
+    const Layer& layer = layers_[l];
+    unsigned int elements = layer.nout;
+    if(l == 0 && l == imageLayers_ && channels_ > 0) {
+      firstDense(layer, pads, channels, input.background(), input.info(i), out);
+    }
+    else {
+      // the features after the flattened image, as concatenate([flat, infos])
+      if(l == imageLayers_)
+        std::copy(input.info(i), input.info(i) + infoSize_, in + flatSize_);
+      if(observer && l > 0)
+        observer(context, l, in, layer.type == Layer::dense ? layer.nin : size*size*layer.nin);
+      const Int8Layer *q = int8_.empty() || int8_[l].depth == 0 ? nullptr : &int8_[l];
+      switch(layer.type) {
+      case Layer::conv:
+        if(l == 0) firstConv(layer, pads, channels, input.background(), work, out);
+        else if(q) int8Conv(layer, *q, in, size, work, out);
+        else conv(layer, in, size, out);
+        nchannels = layer.nout;
+        elements = size*size*nchannels;
+        break;
+      case Layer::maxpool:
+        maxpool(layer, in, size, nchannels, out);
+        size = (size + layer.size - 1)/layer.size;
+        elements = size*size*nchannels;
+        break;
+      case Layer::dense:
+        if(q) int8Dense(layer, *q, in, work, out);
+        else dense(layer, in, out);
+        break;
+      }
+    }
+    if(!layer.scale.empty()) affine(layer, out, elements);
+    std::swap(in, out);
+  }
+  std::copy(in, in + outputs(), output);
+}
+
+void DoubletCNN::firstConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background,
+                           Workspace& work, float *out) const {
+  const unsigned int np = padSize_*padSize_;
+  unsigned int active = 0;
+  for(int j=0; j<2; ++j)
+    for(unsigned int p=0; p<np; ++p) active += pads[j][p] != background;
+  if(active > scatterLimit_) im2colConv(layer, pads, channels, work, out);
+  else scatterConv(layer, pads, channels, background, out);
+  activate(layer.activation, out, np*layer.nout, layer.nout);
+}
+
+void DoubletCNN::scatterConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background, float *out) const {
+  // channels last, 'same' padding as in TensorFlow (for even kernels one more row and column after)
+  const int k = layer.size, pad = (k-1)/2, n = padSize_, np = n*n;
+  const unsigned int nin = layer.nin, nout = layer.nout;
+
+  // bias and response to the two pads full of background (plus the pad offset)
+  const float *maps[2] = {backgroundMaps_.data() + channels[0]*np*nout, backgroundMaps_.data() + channels[1]*np*nout};
+  const float level = background + padOffset_;
+  for(int p=0; p<np; ++p) {
+    float * __restrict__ acc = out + p*nout;
+    std::copy(layer.biases.begin(), layer.biases.end(), acc);
+    if(level == 0.f) continue;
+    for(int j=0; j<2; ++j) {
+      const float * __restrict__ map = maps[j] + p*nout;
+      for(unsigned int o=0; o<nout; ++o) acc[o] += level*map[o];
+    }
+  }
+
+  // each pixel different from the background adds to the outputs it is an input of
+  for(int j=0; j<2; ++j) {
+    for(int py=0; py<n; ++py) {
+      for(int px=0; px<n; ++px) {
+        const float v = pads[j][py*n + px];
+        if(v == background) continue;
+        const float d = v - background;
+        for(int dy=0; dy<k; ++dy) {
+          const int y = py - dy + pad;
+          if(y < 0 || y >= n) continue;
+          for(int dx=0; dx<k; ++dx) {
+            const int x = px - dx + pad;
+            if(x < 0 || x >= n) continue;
+            float * __restrict__ acc = out + (y*n + x)*nout;
+            const float * __restrict__ w = layer.weights.data() + ((dy*k + dx)*nin + channels[j])*nout;
+            for(unsigned int o=0; o<nout; ++o) acc[o] += d*w[o];
+          }
+        }
+      }
+    }
+  }
+}
+
+void DoubletCNN::im2colConv(const Layer& layer, const float *const pads[2], const unsigned int channels[2], Workspace& work, float *out) const {
+  const int k = layer.size, pad = (k-1)/2, n = padSize_, np = n*n, taps = k*k, depth = 2*taps;
+  const unsigned int nin = layer.nin, nout = layer.nout;
+
+  // weights of the two channels, row t*2+j for tap t and pad j
+  work.weights.resize(depth*nout);
+  for(int t=0; t<taps; ++t)
+    for(int j=0; j<2; ++j)
+      std::copy(layer.weights.data() + (t*nin + channels[j])*nout, layer.weights.data() + (t*nin + channels[j] + 1)*nout,
+                work.weights.data() + (t*2 + j)*nout);
+
+  // one row of inputs per output pixel, zero outside of the pad
+  work.columns.resize(np*depth);
+  for(int y=0; y<n; ++y) {
+    for(int x=0; x<n; ++x) {
+      float *row = work.columns.data() + (y*n + x)*depth;
+      for(int dy=0; dy<k; ++dy) {
+        const int yy = y + dy - pad;
+        for(int dx=0; dx<k; ++dx) {
+          const int xx = x + dx - pad;
+          const bool inside = yy >= 0 && yy < n && xx >= 0 && xx < n;
+          for(int j=0; j<2; ++j)
+            row[(dy*k + dx)*2 + j] = inside ? pads[j][yy*n + xx] : 0.f;
+        }
+      }
+    }
+  }
+
+  // out = columns x weights + biases (+ pad offset x background maps)
+  for(int r=0; r<np; ++r) {
+    float * __restrict__ acc = out + r*nout;
+    std::copy(layer.biases.begin(), layer.biases.end(), acc);
+    if(padOffset_ != 0.f) {
+      for(int j=0; j<2; ++j) {
+        const float * __restrict__ map = backgroundMaps_.data() + (channels[j]*np + r)*nout;
+        for(unsigned int o=0; o<nout; ++o) acc[o] += padOffset_*map[o];
+      }
+    }
+    const float *row = work.columns.data() + r*depth;
+    for(int e=0; e<depth; ++e) {
+      const float v = row[e];
+      if(v == 0.f) continue;
+      const float * __restrict__ w = work.weights.data() + e*nout;
+      for(unsigned int o=0; o<nout; ++o) acc[o] += v*w[o];
+    }
+  }
+}
+
+void DoubletCNN::conv(const Layer& layer, const float *in, unsigned int size, float *out) {
+  const int k = layer.size, pad = (k-1)/2, n = size;
+  const unsigned int nin = layer.nin, nout = layer.nout;
+  for(int y=0; y<n; ++y) {
+    for(int x=0; x<n; ++x) {
+      float * __restrict__ acc = out + (y*n + x)*nout;
+      std::copy(layer.biases.begin(), layer.biases.end(), acc);
+      for(int dy=0; dy<k; ++dy) {
+        const int yy = y + dy - pad;
+        if(yy < 0 || yy >= n) continue;
+        for(int dx=0; dx<k; ++dx) {
+          const int xx = x + dx - pad;
+          if(xx < 0 || xx >= n) continue;
+          const float *pixel = in + (yy*n + xx)*nin;
+          const float *w = layer.weights.data() + (dy*k + dx)*nin*nout;
+          for(unsigned int c=0; c<nin; ++c) {
+            const float v = pixel[c];
+            if(v == 0.f) continue; // frequent after relu
+            const float * __restrict__ wc = w + c*nout;
+            for(unsigned int o=0; o<nout; ++o) acc[o] += v*wc[o];
+          }
+        }
+      }
+    }
+  }
+  activate(layer.activation, out, n*n*nout, nout);
+}
+
+void DoubletCNN::maxpool(const Layer& layer, const float *in, unsigned int size, unsigned int channels, float *out) {
+  // 'same' padding, the padding is not part of the maximum
+  const int s = layer.size, n = size, m = (n + s - 1)/s, pad = (m*s - n)/2;
+  for(int y=0; y<m; ++y) {
+    for(int x=0; x<m; ++x) {
+      float *result = out + (y*m + x)*channels;
+      std::fill(result, result + channels, -std::numeric_limits<float>::infinity());
+      for(int dy=0; dy<s; ++dy) {
+        const int yy = y*s + dy - pad;
+        if(yy < 0 || yy >= n) continue;
+        for(int dx=0; dx<s; ++dx) {
+          const int xx = x*s + dx - pad;
+          if(xx < 0 || xx >= n) continue;
+          const float *pixel = in + (yy*n + xx)*channels;
+          for(unsigned int c=0; c<channels; ++c) result[c] = std::max(result[c], pixel[c]);
+        }
+      }
+    }
+  }
+}
+
+void DoubletCNN::firstDense(const Layer& layer, const float *const pads[2], const unsigned int channels[2], float background,
+                            const float *info, float *out) const {
+  // flattened image (pixel major, channels last) then features, only the two pad channels are non zero
+  const unsigned int np = padSize_*padSize_, nout = layer.nout;
+  float * __restrict__ acc = out;
+  std::copy(layer.biases.begin(), layer.biases.end(), acc);
+  const float level = background + padOffset_;
+  for(int j=0; j<2; ++j) {
+    if(level != 0.f) {
+      const float * __restrict__ map = backgroundMaps_.data() + channels[j]*nout;
+      for(unsigned int o=0; o<nout; ++o) acc[o] += level*map[o];
+    }
+    for(unsigned int p=0; p<np; ++p) {
+      const float v = pads[j][p];
+      if(v == background) continue;
+      const float d = v - background;
+      const float * __restrict__ w = layer.weights.data() + (p*channels_ + channels[j])*nout;
+      for(unsigned int o=0; o<nout; ++o) acc[o] += d*w[o];
+    }
+  }
+  const float *w = layer.weights.data() + np*channels_*nout;
+  for(unsigned int f=0; f<infoSize_; ++f) {
+    const float v = info[f];
+    const float * __restrict__ wf = w + f*nout;
+    for(unsigned int o=0; o<nout; ++o) acc[o] += v*wf[o];
+  }
+  activate(layer.activation, out, nout, nout);
+}
+
+void DoubletCNN::dense(const Layer& layer, const float *in, float *out) {
+  const unsigned int nout = layer.nout;
+  float * __restrict__ acc = out;
+  std::copy(layer.biases.begin(), layer.biases.end(), acc);
+  for(unsigned int f=0; f<layer.nin; ++f) {
+    const float v = in[f];
+    if(v == 0.f) continue;
+    const float * __restrict__ w = layer.weights.data() + f*nout;
+    for(unsigned int o=0; o<nout; ++o) acc[o] += v*w[o];
+  }
+  activate(layer.activation, out, nout, nout);
+}
+
+void DoubletCNN::activate(Activation activation, float *x, unsigned int n, unsigned int nout) {
+  switch(activation) {
+  case Activation::linear:
+    break;
+  case Activation::relu:
+    for(unsigned int i=0; i<n; ++i) x[i] = std::max(x[i], 0.f);
+    break;
+  case Activation::sigmoid:
+    for(unsigned int i=0; i<n; ++i) x[i] = 1.f/(1.f + std::exp(-x[i]));
+    break;
+  case Activation::softmax:
+    for(unsigned int i=0; i<n; i+=nout) {
+      float *v = x + i;
+      const float max = *std::max_element(v, v + nout);
+      float sum = 0.f;
+      for(unsigned int o=0; o<nout; ++o) sum += (v[o] = std::exp(v[o] - max));
+      for(unsigned int o=0; o<nout; ++o) v[o] /= sum;
+    }
+    break;
+  }
+}
+
+void DoubletCNN::affine(const Layer& layer, float *x, unsigned int n) {
+  const unsigned int nout = layer.nout;
+  const float * __restrict__ scale = layer.scale.data();
+  const float * __restrict__ shift = layer.shift.data();
+  for(unsigned int i=0; i<n; i+=nout) {
+    float * __restrict__ v = x + i;
+    for(unsigned int o=0; o<nout; ++o) v[o] = v[o]*scale[o] + shift[o];
+  }
+}
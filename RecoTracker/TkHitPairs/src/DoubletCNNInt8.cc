@@ -0,0 +1,257 @@
+// int8 path of DoubletCNN: calibration of the layer input ranges, quantized
+// weights, and the uint8 x int8 dot products (AVX-VNNI/AVX512-VNNI, AVX2 or
+// generic, chosen at run time; the library is built for the baseline ISA).
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DOUBLETCNN_X86 1
+// AVX-VNNI and AVX512-VNNI intrinsics
+#if (defined(__clang__) && __clang_major__ >= 12) || (!defined(__clang__) && __GNUC__ >= 11)
+#define DOUBLETCNN_VNNI 1
+#endif
+#endif
+
+namespace {
+  constexpr unsigned int kBlock = 32;   // inputs per SIMD step, the rows are padded to it
+  constexpr int kInputMax = 127;        // 7 bit inputs: a pair of products fits in int16 (maddubs)
+  constexpr int kWeightMax = 127;
+
+  typedef int32_t (*Dot)(const uint8_t *a, const int8_t *b, unsigned int depth);
+
+  int32_t dotGeneric(const uint8_t *a, const int8_t *b, unsigned int depth) {
+    int32_t sum = 0;
+    for(unsigned int i=0; i<depth; ++i) sum += int32_t(a[i])*int32_t(b[i]);
+    return sum;
+  }
+
+#ifdef DOUBLETCNN_X86
+  __attribute__((target("avx2"))) inline int32_t sum8(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+  }
+
+  __attribute__((target("avx2"))) int32_t dotAVX2(const uint8_t *a, const int8_t *b, unsigned int depth) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for(unsigned int i=0; i<depth; i+=kBlock) {
+      const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+      const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(va, vb), ones));
+    }
+    return sum8(acc);
+  }
+
+#ifdef DOUBLETCNN_VNNI
+  __attribute__((target("avx2,avxvnni"))) int32_t dotAVXVNNI(const uint8_t *a, const int8_t *b, unsigned int depth) {
+    __m256i acc = _mm256_setzero_si256();
+    for(unsigned int i=0; i<depth; i+=kBlock) {
+      const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+      const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+      acc = _mm256_dpbusd_avx_epi32(acc, va, vb);
+    }
+    return sum8(acc);
+  }
+
+  __attribute__((target("avx2,avx512vnni,avx512vl"))) int32_t dotAVX512VNNI(const uint8_t *a, const int8_t *b, unsigned int depth) {
+    __m256i acc = _mm256_setzero_si256();
+    for(unsigned int i=0; i<depth; i+=kBlock) {
+      const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+      const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+      acc = _mm256_dpbusd_epi32(acc, va, vb);
+    }
+    return sum8(acc);
+  }
+#endif
+#endif
+
+  struct Kernel {
+    const char *name;
+    Dot dot;
+  };
+
+  Kernel kernel(const std::string& name) {
+#ifdef DOUBLETCNN_X86
+    __builtin_cpu_init();
+#ifdef DOUBLETCNN_VNNI
+    if(name == "vnni" || name == "best") {
+      if(__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) return {"vnni", dotAVX512VNNI};
+      if(__builtin_cpu_supports("avxvnni")) return {"vnni", dotAVXVNNI};
+    }
+#endif
+    if((name == "avx2" || name == "best") && __builtin_cpu_supports("avx2")) return {"avx2", dotAVX2};
+#endif
+    if(name == "generic" || name == "best") return {"generic", dotGeneric};
+    return {nullptr, nullptr};
+  }
+
+  Kernel& current() {
+    static Kernel best = kernel("best");
+    return best;
+  }
+
+  struct Ranges {
+    std::vector<float> min, max;
+    std::vector<std::vector<unsigned long long> > histograms;   // second pass
+  };
+
+  constexpr unsigned int kBins = 4096;
+
+  void minMax(void *context, unsigned int layer, const float *in, unsigned int n) {
+    Ranges& ranges = *static_cast<Ranges *>(context);
+    const auto range = std::minmax_element(in, in + n);
+    ranges.min[layer] = std::min(ranges.min[layer], *range.first);
+    ranges.max[layer] = std::max(ranges.max[layer], *range.second);
+  }
+
+  void histogram(void *context, unsigned int layer, const float *in, unsigned int n) {
+    Ranges& ranges = *static_cast<Ranges *>(context);
+    auto& h = ranges.histograms[layer];
+    if(h.empty()) return;
+    const float lo = ranges.min[layer], width = (ranges.max[layer] - lo)/kBins;
+    for(unsigned int i=0; i<n; ++i) {
+      const int bin = width > 0.f ? int((in[i] - lo)/width) : 0;
+      ++h[std::min(std::max(bin, 0), int(kBins) - 1)];
+    }
+  }
+
+  inline uint8_t quantizeInput(float x, float inverseScale, int zero) {
+    const int q = int(std::nearbyint(x*inverseScale)) + zero;
+    return uint8_t(std::min(std::max(q, 0), kInputMax));
+  }
+}
+
+const char *DoubletCNN::int8Kernel() {
+  return current().name;
+}
+
+bool DoubletCNN::setInt8Kernel(const std::string& name) {
+  const Kernel k = kernel(name);
+  if(!k.dot) return false;
+  current() = k;
+  return true;
+}
+
+void DoubletCNN::calibrate(const Input& sample, double coverage) {
+  clearCalibration();
+  if(sample.size() == 0) return;
+  const unsigned int nl = layers_.size();
+  Ranges ranges;
+  ranges.min.assign(nl, std::numeric_limits<float>::max());
+  ranges.max.assign(nl, std::numeric_limits<float>::lowest());
+
+  Workspace work;
+  work.a.resize(bufferSize_);
+  work.b.resize(bufferSize_);
+  std::vector<float> outputs(this->outputs());
+  for(unsigned int i=0; i<sample.size(); ++i) evaluate(sample, i, work, outputs.data(), minMax, &ranges);
+
+  // then the tails: below (1-coverage)/2 and above, or only above for non negative inputs (after relu)
+  ranges.histograms.resize(nl);
+  for(unsigned int l=1; l<nl; ++l)
+    if(layers_[l].type != Layer::maxpool && ranges.max[l] > ranges.min[l]) ranges.histograms[l].assign(kBins, 0);
+  for(unsigned int i=0; i<sample.size(); ++i) evaluate(sample, i, work, outputs.data(), histogram, &ranges);
+
+  for(unsigned int l=1; l<nl; ++l) {
+    const auto& h = ranges.histograms[l];
+    if(h.empty()) continue;
+    const bool positive = ranges.min[l] >= 0.f;
+    unsigned long long total = 0;
+    for(auto n: h) total += n;
+    const double tail = (1. - coverage)*total/(positive ? 1. : 2.);
+    const float width = (ranges.max[l] - ranges.min[l])/kBins;
+    unsigned int first = 0, last = kBins - 1;
+    for(unsigned long long n = 0; !positive && first < last && n + h[first] <= tail; ++first) n += h[first];
+    for(unsigned long long n = 0; last > first && n + h[last] <= tail; --last) n += h[last];
+    layers_[l].inputMin = positive ? 0.f : ranges.min[l] + first*width;
+    layers_[l].inputMax = ranges.min[l] + (last + 1)*width;
+  }
+  quantize();
+}
+
+void DoubletCNN::clearCalibration() {
+  for(auto& layer: layers_) layer.inputMin = layer.inputMax = 0.f;
+  int8_.clear();
+}
+
+void DoubletCNN::quantize() {
+  int8_.clear();
+  if(std::none_of(layers_.begin(), layers_.end(), [](const Layer& l) { return l.inputMax > l.inputMin; })) return;
+  int8_.resize(layers_.size());
+  for(unsigned int l=0; l<layers_.size(); ++l) {
+    const Layer& layer = layers_[l];
+    if(!(layer.inputMax > layer.inputMin)) continue;
+    Int8Layer& q = int8_[l];
+    const unsigned int inputs = layer.type == Layer::conv ? layer.size*layer.size*layer.nin : layer.nin;
+    q.depth = (inputs + kBlock - 1)/kBlock*kBlock;
+    // the range must contain 0: the 'same' padding and the zeros after relu are exact
+    const float lo = std::min(layer.inputMin, 0.f), hi = std::max(layer.inputMax, 0.f);
+    q.inputScale = (hi - lo)/kInputMax;
+    q.zero = std::min(std::max(int(std::nearbyint(-lo/q.inputScale)), 0), kInputMax);
+    q.weights.assign(size_t(layer.nout)*q.depth, 0);
+    q.scales.resize(layer.nout);
+    q.offsets.resize(layer.nout);
+    // the Keras kernel is inputs x nout (conv: taps, then input channels), the rows are per output
+    for(unsigned int o=0; o<layer.nout; ++o) {
+      float max = 0.f;
+      for(unsigned int i=0; i<inputs; ++i) max = std::max(max, std::abs(layer.weights[size_t(i)*layer.nout + o]));
+      const float weightScale = max > 0.f ? max/kWeightMax : 1.f;
+      int32_t sum = 0;
+      int8_t *row = q.weights.data() + size_t(o)*q.depth;
+      for(unsigned int i=0; i<inputs; ++i) {
+        row[i] = int8_t(std::nearbyint(layer.weights[size_t(i)*layer.nout + o]/weightScale));
+        sum += row[i];
+      }
+      q.scales[o] = q.inputScale*weightScale;
+      q.offsets[o] = layer.biases[o] - q.scales[o]*q.zero*sum;
+    }
+  }
+}
+
+void DoubletCNN::int8Conv(const Layer& layer, const Int8Layer& q, const float *in, unsigned int size, Workspace& work, float *out) {
+  const int k = layer.size, pad = (k-1)/2, n = size;
+  const unsigned int nin = layer.nin, nout = layer.nout;
+  const Dot dot = current().dot;
+
+  const float inverseScale = 1.f/q.inputScale;
+  work.quantized.resize(size_t(n)*n*nin);
+  for(size_t i=0, e=work.quantized.size(); i<e; ++i) work.quantized[i] = quantizeInput(in[i], inverseScale, q.zero);
+
+  // inputs of each output pixel in the order of the weights, the padding is 0 (the zero point)
+  work.patch.assign(q.depth, 0);
+  for(int y=0; y<n; ++y) {
+    for(int x=0; x<n; ++x) {
+      uint8_t *patch = work.patch.data();
+      for(int dy=0; dy<k; ++dy) {
+        const int yy = y + dy - pad;
+        for(int dx=0; dx<k; ++dx, patch += nin) {
+          const int xx = x + dx - pad;
+          if(yy < 0 || yy >= n || xx < 0 || xx >= n) std::fill(patch, patch + nin, uint8_t(q.zero));
+          else std::copy_n(work.quantized.data() + (yy*n + xx)*nin, nin, patch);
+        }
+      }
+      float *acc = out + (y*n + x)*nout;
+      for(unsigned int o=0; o<nout; ++o)
+        acc[o] = q.scales[o]*dot(work.patch.data(), q.weights.data() + size_t(o)*q.depth, q.depth) + q.offsets[o];
+    }
+  }
+  activate(layer.activation, out, n*n*nout, nout);
+}
+
+void DoubletCNN::int8Dense(const Layer& layer, const Int8Layer& q, const float *in, Workspace& work, float *out) {
+  const unsigned int nout = layer.nout;
+  const Dot dot = current().dot;
+  const float inverseScale = 1.f/q.inputScale;
+  work.quantized.assign(q.depth, 0);
+  for(unsigned int i=0; i<layer.nin; ++i) work.quantized[i] = quantizeInput(in[i], inverseScale, q.zero);
+  for(unsigned int o=0; o<nout; ++o)
+    out[o] = q.scales[o]*dot(work.quantized.data(), q.weights.data() + size_t(o)*q.depth, q.depth) + q.offsets[o];
+  activate(layer.activation, out, nout, nout);
+}
@@ -0,0 +1,429 @@
+// DoubletCNN::fromKeras: the Keras functional models of the doublet
+// classifiers (model.to_json() for the topology, save() or save_weights()
+// for the weights) converted to the DoubletCNN layer chain.
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "hdf5.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace {
+  typedef boost::property_tree::ptree Tree;
+
+  // model.to_json() saved with json.dump is a JSON string holding the JSON model
+  Tree readJson(const std::string& fileName) {
+    std::ifstream in(fileName);
+    if(!in)
+      throw cms::Exception("DoubletCNN") << "cannot open " << fileName;
+    std::stringstream content;
+    content << in.rdbuf();
+    std::string text = content.str();
+    Tree tree;
+    try {
+      const auto first = text.find_first_not_of(" \t\r\n");
+      if(first != std::string::npos && text[first] == '"') {
+        std::istringstream wrapped("{\"model\": " + text + "}");
+        boost::property_tree::read_json(wrapped, tree);
+        text = tree.get<std::string>("model");
+      }
+      std::istringstream model(text);
+      boost::property_tree::read_json(model, tree);
+    }
+    catch(const boost::property_tree::ptree_error& e) {
+      throw cms::Exception("DoubletCNN") << "cannot parse " << fileName << ": " << e.what();
+    }
+    return tree;
+  }
+
+  std::vector<int> integers(const Tree& tree, const std::string& path) {
+    std::vector<int> values;
+    const auto child = tree.get_child_optional(path);
+    if(child)
+      for(const auto& item: *child)
+        values.push_back(item.second.data() == "null" ? -1 : item.second.get_value<int>());
+    return values;
+  }
+
+  // HDF5 handle closed at the end of the scope
+  class Handle {
+  public:
+    Handle(hid_t id, herr_t (*close)(hid_t)): id_(id), close_(close) {}
+    ~Handle() { if(id_ >= 0) close_(id_); }
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+    operator hid_t() const { return id_; }
+    bool valid() const { return id_ >= 0; }
+  private:
+    hid_t id_;
+    herr_t (*close_)(hid_t);
+  };
+
+  struct Weight {
+    std::vector<hsize_t> dims;
+    std::vector<float> values;
+  };
+
+  class WeightFile {
+  public:
+    explicit WeightFile(const std::string& fileName):
+      fileName_(fileName), file_(H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose) {
+      if(!file_.valid())
+        throw cms::Exception("DoubletCNN") << "cannot open " << fileName;
+      // save() puts the weights in model_weights, save_weights() at the top
+      root_ = H5Lexists(file_, "model_weights", H5P_DEFAULT) > 0 ? "model_weights/" : "";
+    }
+
+    /// the weights of a layer by short name (kernel, bias, gamma, beta, moving_mean, moving_variance)
+    std::map<std::string, Weight> layer(const std::string& name) const {
+      std::map<std::string, Weight> weights;
+      const std::string group = root_ + name;
+      if(H5Lexists(file_, group.c_str(), H5P_DEFAULT) <= 0) return weights;
+      for(const auto& weightName: strings(group, "weight_names")) {
+        // e.g. conv1_1/kernel:0
+        std::string key = weightName.substr(weightName.rfind('/') + 1);
+        key = key.substr(0, key.find(':'));
+        weights[key] = read(group + "/" + weightName);
+      }
+      return weights;
+    }
+
+  private:
+    std::vector<std::string> strings(const std::string& object, const char *attribute) const {
+      std::vector<std::string> values;
+      if(H5Aexists_by_name(file_, object.c_str(), attribute, H5P_DEFAULT) <= 0) return values;
+      Handle attr(H5Aopen_by_name(file_, object.c_str(), attribute, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+      Handle type(H5Aget_type(attr), H5Tclose);
+      Handle space(H5Aget_space(attr), H5Sclose);
+      // layers without weights have an empty float array
+      if(H5Tget_class(type) != H5T_STRING) return values;
+      const hssize_t n = H5Sget_simple_extent_npoints(space);
+      if(H5Tis_variable_str(type) > 0) {
+        std::vector<char *> buffer(n);
+        Handle memType(H5Tget_native_type(type, H5T_DIR_ASCEND), H5Tclose);
+        if(H5Aread(attr, memType, buffer.data()) < 0)
+          throw cms::Exception("DoubletCNN") << "cannot read " << object << " " << attribute << " in " << fileName_;
+        for(auto s: buffer) values.emplace_back(s ? s : "");
+        H5Dvlen_reclaim(memType, space, H5P_DEFAULT, buffer.data());
+      }
+      else {
+        const size_t length = H5Tget_size(type);
+        std::vector<char> buffer(n*length);
+        if(H5Aread(attr, type, buffer.data()) < 0)
+          throw cms::Exception("DoubletCNN") << "cannot read " << object << " " << attribute << " in " << fileName_;
+        for(hssize_t i=0; i<n; ++i) {
+          const char *s = buffer.data() + i*length;
+          values.emplace_back(s, std::find(s, s + length, '\0'));
+        }
+      }
+      return values;
+    }
+
+    Weight read(const std::string& path) const {
+      Handle dataset(H5Dopen2(file_, path.c_str(), H5P_DEFAULT), H5Dclose);
+      if(!dataset.valid())
+        throw cms::Exception("DoubletCNN") << "no weights " << path << " in " << fileName_;
+      Handle space(H5Dget_space(dataset), H5Sclose);
+      Weight weight;
+      weight.dims.resize(H5Sget_simple_extent_ndims(space));
+      H5Sget_simple_extent_dims(space, weight.dims.data(), nullptr);
+      weight.values.resize(H5Sget_simple_extent_npoints(space));
+      if(H5Dread(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, weight.values.data()) < 0)
+        throw cms::Exception("DoubletCNN") << "cannot read " << path << " in " << fileName_;
+      return weight;
+    }
+
+    std::string fileName_, root_;
+    Handle file_;
+  };
+
+  // output of a Keras layer: the last DoubletCNN layer computing it (-1 for the inputs)
+  // and, for the features, a batch normalization not applied yet
+  struct Tensor {
+    enum Kind { image, flat, info, features };
+    Kind kind;
+    int layer;
+    unsigned int size;                  // features
+    std::vector<float> scale, shift;
+  };
+
+  DoubletCNN::Activation activation(const std::string& name, const std::string& layer, const std::string& fileName) {
+    if(name == "linear") return DoubletCNN::Activation::linear;
+    if(name == "relu") return DoubletCNN::Activation::relu;
+    if(name == "sigmoid") return DoubletCNN::Activation::sigmoid;
+    if(name == "softmax") return DoubletCNN::Activation::softmax;
+    throw cms::Exception("DoubletCNN") << "unsupported activation '" << name << "' of " << layer << " in " << fileName;
+  }
+
+  // y = scale*x + shift per channel, after the layer outputs
+  void applyAfter(DoubletCNN::Layer& layer, const std::vector<float>& scale, const std::vector<float>& shift) {
+    if(layer.type != DoubletCNN::Layer::maxpool && layer.activation == DoubletCNN::Activation::linear && layer.scale.empty()) {
+      // in the weights
+      const size_t nout = layer.nout;
+      for(size_t i=0; i<layer.weights.size(); ++i) layer.weights[i] *= scale[i%nout];
+      for(size_t o=0; o<nout; ++o) layer.biases[o] = layer.biases[o]*scale[o] + shift[o];
+      return;
+    }
+    if(layer.scale.empty()) {
+      layer.scale = scale;
+      layer.shift = shift;
+      return;
+    }
+    for(size_t o=0; o<scale.size(); ++o) {
+      layer.scale[o] *= scale[o];
+      layer.shift[o] = layer.shift[o]*scale[o] + shift[o];
+    }
+  }
+
+  // dense on scale*x + shift
+  void applyBefore(DoubletCNN::Layer& layer, const std::vector<float>& scale, const std::vector<float>& shift) {
+    const size_t nout = layer.nout;
+    for(size_t i=0; i<layer.nin; ++i) {
+      float *w = layer.weights.data() + i*nout;
+      for(size_t o=0; o<nout; ++o) {
+        layer.biases[o] += shift[i]*w[o];
+        w[o] *= scale[i];
+      }
+    }
+  }
+}
+
+DoubletCNN DoubletCNN::fromKeras(const std::string& jsonFile, const std::string& h5File) {
+  const Tree model = readJson(jsonFile);
+  if(model.get<std::string>("class_name", "") != "Model")
+    throw cms::Exception("DoubletCNN") << jsonFile << " is not a Keras functional model";
+  const WeightFile weights(h5File);
+
+  unsigned int padSize = 0, channels = 0, infoSize = 0;
+  unsigned int size = 0, nchannels = 0;   // image after the last layer
+  std::vector<Layer> layers;
+  std::map<std::string, Tensor> tensors;
+
+  for(const auto& item: model.get_child("config.layers")) {
+    const Tree& keras = item.second;
+    const std::string type = keras.get<std::string>("class_name"), name = keras.get<std::string>("name");
+    const Tree& config = keras.get_child("config");
+    auto error = [&]() -> cms::Exception {
+      return cms::Exception("DoubletCNN") << type << " " << name << " in " << jsonFile << ": ";
+    };
+
+    std::vector<std::string> inputs;
+    const auto& nodes = keras.get_child("inbound_nodes");
+    if(nodes.size() > 1)
+      throw error() << "shared layers are not supported";
+    for(const auto& node: nodes)
+      for(const auto& input: node.second)
+        inputs.push_back(input.second.begin()->second.data());
+    std::vector<Tensor *> in;
+    for(const auto& input: inputs) {
+      auto tensor = tensors.find(input);
+      if(tensor == tensors.end())
+        throw error() << "unknown input " << input;
+      in.push_back(&tensor->second);
+    }
+    // a chain: each layer continues the last one
+    auto chained = [&](const Tensor& tensor) {
+      if(tensor.layer != int(layers.size()) - 1)
+        throw error() << "branching models are not supported";
+    };
+
+    if(type == "InputLayer") {
+      const auto shape = integers(config, "batch_input_shape");
+      if(shape.size() == 4 && shape[1] == shape[2] && shape[1] > 0 && shape[3] > 0 && channels == 0) {
+        size = padSize = shape[1];
+        nchannels = channels = shape[3];
+        tensors[name] = Tensor{Tensor::image, -1, 0, {}, {}};
+      }
+      else if(shape.size() == 2 && shape[1] > 0 && infoSize == 0) {
+        infoSize = shape[1];
+        tensors[name] = Tensor{Tensor::info, -1, infoSize, {}, {}};
+      }
+      else
+        throw error() << "only one square image input and one feature input are supported";
+      continue;
+    }
+    if(in.empty())
+      throw error() << "no input";
+
+    if(type == "Dropout") {
+      tensors[name] = *in[0];
+    }
+    else if(type == "Conv2D" || type == "MaxPooling2D") {
+      if(in[0]->kind != Tensor::image)
+        throw error() << "the input is not an image";
+      chained(*in[0]);
+      if(config.get<std::string>("data_format", "channels_last") != "channels_last")
+        throw error() << "only channels_last is supported";
+      const std::string padding = config.get<std::string>("padding");
+      Layer layer;
+      if(type == "Conv2D") {
+        const auto kernel = integers(config, "kernel_size"), strides = integers(config, "strides");
+        const auto dilation = integers(config, "dilation_rate");
+        if(kernel.size() != 2 || kernel[0] != kernel[1] || strides != std::vector<int>({1, 1})
+           || (!dilation.empty() && dilation != std::vector<int>({1, 1})) || padding != "same")
+          throw error() << "only square kernels with 'same' padding and stride 1 are supported";
+        layer.type = Layer::conv;
+        layer.size = kernel[0];
+        layer.nin = nchannels;
+        layer.nout = config.get<unsigned int>("filters");
+        layer.activation = activation(config.get<std::string>("activation"), name, jsonFile);
+        auto w = weights.layer(name);
+        const std::vector<hsize_t> shape = {layer.size, layer.size, layer.nin, layer.nout};
+        if(w["kernel"].dims != shape)
+          throw error() << "kernel not found or of the wrong shape in " << h5File;
+        layer.weights = std::move(w["kernel"].values);
+        layer.biases.assign(layer.nout, 0.f);
+        if(config.get<bool>("use_bias", true)) {
+          if(w["bias"].values.size() != layer.nout)
+            throw error() << "bias not found or of the wrong shape in " << h5File;
+          layer.biases = std::move(w["bias"].values);
+        }
+        nchannels = layer.nout;
+      }
+      else {
+        const auto pool = integers(config, "pool_size"), strides = integers(config, "strides");
+        if(pool.size() != 2 || pool[0] != pool[1] || (!strides.empty() && strides != pool)
+           || !(padding == "same" || (padding == "valid" && size % pool[0] == 0)))
+          throw error() << "only square pools with stride equal to the pool size and 'same' padding are supported";
+        layer.type = Layer::maxpool;
+        layer.size = pool[0];
+        layer.nin = layer.nout = nchannels;
+        size = (size + layer.size - 1)/layer.size;
+      }
+      layers.push_back(std::move(layer));
+      tensors[name] = Tensor{Tensor::image, int(layers.size()) - 1, 0, {}, {}};
+    }
+    else if(type == "Flatten") {
+      if(in[0]->kind != Tensor::image)
+        throw error() << "the input is not an image";
+      tensors[name] = Tensor{Tensor::flat, in[0]->layer, size*size*nchannels, {}, {}};
+    }
+    else if(type == "Concatenate") {
+      if(in.size() != 2 || in[0]->kind != Tensor::flat || in[1]->kind != Tensor::info)
+        throw error() << "only the concatenation of the flattened image and of the features is supported";
+      Tensor tensor{Tensor::features, in[0]->layer, in[0]->size + in[1]->size, {}, {}};
+      if(!in[0]->scale.empty() || !in[1]->scale.empty()) {
+        for(const Tensor *part: in) {
+          tensor.scale.insert(tensor.scale.end(), part->scale.begin(), part->scale.end());
+          tensor.shift.insert(tensor.shift.end(), part->shift.begin(), part->shift.end());
+          tensor.scale.resize(tensor.scale.size() + (part->scale.empty() ? part->size : 0), 1.f);
+          tensor.shift.resize(tensor.shift.size() + (part->shift.empty() ? part->size : 0), 0.f);
+        }
+      }
+      tensors[name] = std::move(tensor);
+    }
+    else if(type == "BatchNormalization") {
+      Tensor tensor = *in[0];
+      const int axis = config.get<int>("axis", -1);
+      if(axis != -1 && axis != (tensor.kind == Tensor::image ? 3 : 1))
+        throw error() << "only the normalization of the last axis is supported";
+      const unsigned int n = tensor.kind == Tensor::image ? nchannels : tensor.size;
+      auto w = weights.layer(name);
+      const double epsilon = config.get<double>("epsilon", 1e-3);
+      const bool hasScale = config.get<bool>("scale", true), hasCenter = config.get<bool>("center", true);
+      if(w["moving_mean"].values.size() != n || w["moving_variance"].values.size() != n
+         || (hasScale && w["gamma"].values.size() != n) || (hasCenter && w["beta"].values.size() != n))
+        throw error() << "weights not found or of the wrong shape in " << h5File;
+      std::vector<float> scale(n), shift(n);
+      for(unsigned int i=0; i<n; ++i) {
+        const double a = (hasScale ? w["gamma"].values[i] : 1.)/std::sqrt(double(w["moving_variance"].values[i]) + epsilon);
+        scale[i] = a;
+        shift[i] = (hasCenter ? w["beta"].values[i] : 0.) - w["moving_mean"].values[i]*a;
+      }
+      if(tensor.kind == Tensor::image) {
+        // the padding of a following convolution is 0 after the normalization
+        if(tensor.layer < 0)
+          throw error() << "the normalization of the image input is not supported";
+        chained(tensor);
+        applyAfter(layers[tensor.layer], scale, shift);
+      }
+      else if(tensor.layer >= 0 && tensor.layer == int(layers.size()) - 1 && layers[tensor.layer].type == Layer::dense
+              && layers[tensor.layer].activation == Activation::linear && tensor.scale.empty()) {
+        applyAfter(layers[tensor.layer], scale, shift);
+      }
+      else if(tensor.scale.empty()) {
+        // in the next dense layer
+        tensor.scale = std::move(scale);
+        tensor.shift = std::move(shift);
+      }
+      else {
+        for(unsigned int i=0; i<n; ++i) {
+          tensor.scale[i] *= scale[i];
+          tensor.shift[i] = tensor.shift[i]*scale[i] + shift[i];
+        }
+      }
+      tensors[name] = std::move(tensor);
+    }
+    else if(type == "Dense") {
+      Tensor& input = *in[0];
+      const bool first = std::none_of(layers.begin(), layers.end(), [](const Layer& l) { return l.type == Layer::dense; });
+      if(first ? (channels > 0 ? input.kind != Tensor::features && !(input.kind == Tensor::flat && infoSize == 0)
+                               : input.kind != Tensor::info)
+               : input.kind != Tensor::features)
+        throw error() << "the first dense layer must read the flattened image and the features";
+      chained(input);
+      Layer layer;
+      layer.type = Layer::dense;
+      layer.nin = input.size;
+      layer.nout = config.get<unsigned int>("units");
+      layer.activation = activation(config.get<std::string>("activation"), name, jsonFile);
+      auto w = weights.layer(name);
+      const std::vector<hsize_t> shape = {layer.nin, layer.nout};
+      if(w["kernel"].dims != shape)
+        throw error() << "kernel not found or of the wrong shape in " << h5File;
+      layer.weights = std::move(w["kernel"].values);
+      layer.biases.assign(layer.nout, 0.f);
+      if(config.get<bool>("use_bias", true)) {
+        if(w["bias"].values.size() != layer.nout)
+          throw error() << "bias not found or of the wrong shape in " << h5File;
+        layer.biases = std::move(w["bias"].values);
+      }
+      if(!input.scale.empty()) applyBefore(layer, input.scale, input.shift);
+      layers.push_back(std::move(layer));
+      tensors[name] = Tensor{Tensor::features, int(layers.size()) - 1, layers.back().nout, {}, {}};
+    }
+    else if(type == "Activation") {
+      Tensor tensor = *in[0];
+      if(tensor.layer < 0 || tensor.layer != int(layers.size()) - 1 || !tensor.scale.empty()
+         || layers[tensor.layer].type == Layer::maxpool || layers[tensor.layer].activation != Activation::linear
+         || !layers[tensor.layer].scale.empty())
+        throw error() << "only an activation directly after a linear convolution or dense layer is supported";
+      layers[tensor.layer].activation = activation(config.get<std::string>("activation"), name, jsonFile);
+      tensors[name] = std::move(tensor);
+    }
+    else {
+      throw error() << "unsupported layer";
+    }
+  }
+
+  const auto& outputs = model.get_child("config.output_layers");
+  if(outputs.size() != 1)
+    throw cms::Exception("DoubletCNN") << jsonFile << ": only models with one output are supported";
+  const std::string outputName = outputs.begin()->second.begin()->second.data();
+  const auto output = tensors.find(outputName);
+  if(output == tensors.end() || output->second.kind != Tensor::features || output->second.layer != int(layers.size()) - 1)
+    throw cms::Exception("DoubletCNN") << jsonFile << ": the output " << outputName << " is not the last dense layer";
+  if(!output->second.scale.empty())
+    applyAfter(layers.back(), output->second.scale, output->second.shift);
+
+  // an increasing affine commutes with the maximum: on the pooled image, smaller
+  for(size_t l=0; l+1<layers.size(); ++l) {
+    Layer& layer = layers[l];
+    Layer& next = layers[l+1];
+    if(layer.type == Layer::conv && !layer.scale.empty() && next.type == Layer::maxpool && next.scale.empty()
+       && std::all_of(layer.scale.begin(), layer.scale.end(), [](float s) { return s > 0.f; })) {
+      next.scale.swap(layer.scale);
+      next.shift.swap(layer.shift);
+    }
+  }
+
+  return DoubletCNN(padSize, channels, infoSize, std::move(layers));
+}
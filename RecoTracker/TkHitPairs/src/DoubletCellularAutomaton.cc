@@ -0,0 +1,153 @@
+#include "RecoTracker/TkHitPairs/interface/DoubletCellularAutomaton.h"
+
+#include <cmath>
+#include <utility>
+
+void DoubletCellularAutomaton::build(const std::vector<const HitDoublets *>& layerPairs, const std::vector<bool> *keep, unsigned int& doubletOffset) {
+  maps_.clear(); mapOffsets_.clear();
+  unsigned int nhits = 0, ndoublets = 0;
+  auto hitOffset = [&](const RecHitsSortedInPhi& map) {
+    for(size_t i=0; i<maps_.size(); ++i) {
+      if(maps_[i] == &map) return mapOffsets_[i];
+    }
+    maps_.push_back(&map);
+    mapOffsets_.push_back(nhits);
+    nhits += map.size();
+    return mapOffsets_.back();
+  };
+  for(const auto *doublets: layerPairs) {
+    hitOffset(doublets->innerLayer());
+    hitOffset(doublets->outerLayer());
+    ndoublets += doublets->size();
+  }
+
+  x_.resize(nhits); y_.resize(nhits); z_.resize(nhits); r_.resize(nhits); hits_.resize(nhits);
+  for(size_t i=0; i<maps_.size(); ++i) {
+    const auto& map = *maps_[i];
+    for(unsigned int j=0, o=mapOffsets_[i]; j<map.size(); ++j) {
+      x_[o+j] = map.x[j]; y_[o+j] = map.y[j]; z_[o+j] = map.z[j];
+      r_[o+j] = std::sqrt(map.x[j]*map.x[j] + map.y[j]*map.y[j]);
+      hits_[o+j] = map.theHits[j].hit();
+    }
+  }
+
+  // one cell per kept doublet
+  innerHit_.clear(); outerHit_.clear();
+  innerHit_.reserve(ndoublets); outerHit_.reserve(ndoublets);
+  for(const auto *doublets: layerPairs) {
+    const unsigned int innerOffset = hitOffset(doublets->innerLayer());
+    const unsigned int outerOffset = hitOffset(doublets->outerLayer());
+    for(size_t i=0, size=doublets->size(); i<size; ++i) {
+      if(keep && !(*keep)[doubletOffset+i]) continue;
+      innerHit_.push_back(innerOffset + doublets->innerHitId(i));
+      outerHit_.push_back(outerOffset + doublets->outerHitId(i));
+    }
+    doubletOffset += doublets->size();
+  }
+
+  // cells starting from each hit, counting sort on the inner hit
+  const unsigned int ncells = nCells();
+  cellsFromHitOffsets_.assign(nhits+1, 0);
+  for(auto h: innerHit_) ++cellsFromHitOffsets_[h+1];
+  for(unsigned int h=0; h<nhits; ++h) cellsFromHitOffsets_[h+1] += cellsFromHitOffsets_[h];
+  cellsFromHit_.resize(ncells);
+  stateTmp_.assign(cellsFromHitOffsets_.begin(), cellsFromHitOffsets_.end()-1); // fill positions
+  for(unsigned int c=0; c<ncells; ++c) cellsFromHit_[stateTmp_[innerHit_[c]]++] = c;
+}
+
+bool DoubletCellularAutomaton::areAligned(unsigned int inner, unsigned int outer, float ptMin, float minRadius, float thetaCut) const {
+  const unsigned int h1 = innerHit_[inner], h2 = outerHit_[inner], h3 = outerHit_[outer];
+
+  // RZ alignment, as in the CA of the pixel tracking
+  const float r1 = r_[h1], z1 = z_[h1], r2 = r_[h2], z2 = z_[h2], r3 = r_[h3], z3 = z_[h3];
+  const float radiusDiff = std::abs(r1 - r3);
+  const float distance13Squared = radiusDiff*radiusDiff + (z1-z3)*(z1-z3);
+  const float pMin = ptMin*std::sqrt(distance13Squared);
+  const float tanHalfTimesDistanceSquared = std::abs(z1*(r2-r3) + z2*(r3-r1) + z3*(r1-r2));
+  if(tanHalfTimesDistanceSquared*pMin > thetaCut*distance13Squared*radiusDiff) return false;
+
+  // radius of the circle through the three hits: R = |a||b||c| / (2 |a x b|)
+  const float ax = x_[h2]-x_[h1], ay = y_[h2]-y_[h1];
+  const float bx = x_[h3]-x_[h2], by = y_[h3]-y_[h2];
+  const float cx = x_[h3]-x_[h1], cy = y_[h3]-y_[h1];
+  const float cross = std::abs(ax*by - ay*bx);
+  const float product = std::sqrt((ax*ax+ay*ay)*(bx*bx+by*by)*(cx*cx+cy*cy));
+  return 2.f*cross*minRadius <= product;
+}
+
+void DoubletCellularAutomaton::connect(float ptMin, float invBz, float thetaCut) {
+  const unsigned int ncells = nCells();
+  // bending radius of a ptMin track, in cm
+  const float minRadius = ptMin*std::abs(invBz);
+
+  innerNeighbourOffsets_.assign(ncells+1, 0);
+  nOuterNeighbours_.assign(ncells, 0);
+  std::vector<std::pair<unsigned int, unsigned int> > connections; // (outer cell, inner cell)
+  for(unsigned int c=0; c<ncells; ++c) {
+    const unsigned int h = outerHit_[c];
+    for(unsigned int k=cellsFromHitOffsets_[h]; k<cellsFromHitOffsets_[h+1]; ++k) {
+      const unsigned int o = cellsFromHit_[k];
+      if(!areAligned(c, o, ptMin, minRadius, thetaCut)) continue;
+      connections.emplace_back(o, c);
+      ++innerNeighbourOffsets_[o+1];
+      ++nOuterNeighbours_[c];
+    }
+  }
+  for(unsigned int c=0; c<ncells; ++c) innerNeighbourOffsets_[c+1] += innerNeighbourOffsets_[c];
+  innerNeighbours_.resize(connections.size());
+  stateTmp_.assign(innerNeighbourOffsets_.begin(), innerNeighbourOffsets_.end()-1);
+  for(const auto& oc: connections) innerNeighbours_[stateTmp_[oc.first]++] = oc.second;
+}
+
+void DoubletCellularAutomaton::evolve() {
+  const unsigned int ncells = nCells();
+  state_.assign(ncells, 1);
+  stateTmp_.resize(ncells);
+  for(unsigned int iteration=0; iteration<ncells; ++iteration) {
+    bool changed = false;
+    for(unsigned int c=0; c<ncells; ++c) {
+      unsigned int s = state_[c];
+      for(unsigned int k=innerNeighbourOffsets_[c]; k<innerNeighbourOffsets_[c+1]; ++k) {
+        // a cell grows if one of its inner neighbours has its same state
+        if(state_[innerNeighbours_[k]] == state_[c]) { s = state_[c]+1; break; }
+      }
+      changed |= s != state_[c];
+      stateTmp_[c] = s;
+    }
+    state_.swap(stateTmp_);
+    if(!changed) break;
+  }
+}
+
+void DoubletCellularAutomaton::followInwards(unsigned int cell, unsigned int maxCells, std::vector<unsigned int>& path,
+                                             unsigned int minHits, std::vector<Ntuplet>& ntuplets) const {
+  path.push_back(cell);
+  bool extended = false;
+  if(path.size() < maxCells) {
+    for(unsigned int k=innerNeighbourOffsets_[cell]; k<innerNeighbourOffsets_[cell+1]; ++k) {
+      const unsigned int inner = innerNeighbours_[k];
+      if(state_[inner]+1 != state_[cell]) continue;
+      extended = true;
+      followInwards(inner, maxCells, path, minHits, ntuplets);
+    }
+  }
+  if(!extended && path.size()+1 >= minHits) {
+    // path goes from the outermost to the innermost cell
+    Ntuplet ntuplet;
+    ntuplet.nHits = path.size()+1;
+    ntuplet.hits[0] = innerHit_[path.back()];
+    for(unsigned int i=0; i<path.size(); ++i)
+      ntuplet.hits[i+1] = outerHit_[path[path.size()-1-i]];
+    ntuplets.push_back(ntuplet);
+  }
+  path.pop_back();
+}
+
+void DoubletCellularAutomaton::findNtuplets(unsigned int minHits, unsigned int maxHits, std::vector<Ntuplet>& ntuplets) const {
+  std::vector<unsigned int> path;
+  path.reserve(maxHits);
+  for(unsigned int c=0, ncells=nCells(); c<ncells; ++c) {
+    if(nOuterNeighbours_[c] > 0 || state_[c]+1 < minHits) continue;
+    followInwards(c, maxHits-1, path, minHits, ntuplets);
+  }
+}
@@ -0,0 +1,103 @@
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+
+#include <cmath>
+
+void DoubletGraph::clear() {
+  regionNodeOffsets_.clear();
+  edgeOffsets_.clear();
+  outerNodes_.clear();
+  x_.clear(); y_.clear(); z_.clear(); r_.clear(); phi_.clear();
+  layer_.clear();
+  hits_.clear();
+  layerPairs_.clear();
+  edgeLayerPair_.clear();
+  edgeDoublet_.clear();
+  innerNodes_.clear();
+}
+
+void DoubletGraph::fill(const IntermediateHitDoublets& doublets) {
+  clear();
+
+  // nodes: the hits of each distinct layer map of each region
+  std::vector<const RecHitsSortedInPhi *> maps;
+  std::vector<unsigned int> mapOffsets; // node offset of each layer map, per layer pair (inner, outer)
+  unsigned int nnodes = 0, nedges = 0, regionIndex = 0;
+  regionNodeOffsets_.push_back(0);
+  for(const auto& regionLayerPairs: doublets) {
+    const size_t regionMapsBegin = maps.size();
+    auto addMap = [&](const RecHitsSortedInPhi& map, LayerIndex layer) {
+      for(size_t i=regionMapsBegin; i<maps.size(); ++i) {
+        if(maps[i] == &map) return;
+      }
+      maps.push_back(&map);
+      const float *xs = map.x.data(), *ys = map.y.data(), *zs = map.z.data();
+      for(unsigned int i=0, size=map.size(); i<size; ++i) {
+        x_.push_back(xs[i]); y_.push_back(ys[i]); z_.push_back(zs[i]);
+        r_.push_back(std::sqrt(xs[i]*xs[i] + ys[i]*ys[i]));
+        phi_.push_back(map.phi(i));
+        layer_.push_back(layer);
+        hits_.push_back(map.theHits[i].hit());
+      }
+      nnodes += map.size();
+    };
+    auto nodeOffset = [&](const RecHitsSortedInPhi& map) {
+      unsigned int offset = regionNodeOffsets_.back();
+      for(size_t i=regionMapsBegin; maps[i] != &map; ++i) offset += maps[i]->size();
+      return offset;
+    };
+
+    for(const auto& layerPair: regionLayerPairs) {
+      const auto& hd = layerPair.doublets();
+      addMap(hd.innerLayer(), layerPair.innerLayerIndex());
+      addMap(hd.outerLayer(), layerPair.outerLayerIndex());
+      layerPairs_.push_back(LayerPair{&regionLayerPairs.region(), regionIndex, layerPair.innerLayerIndex(), layerPair.outerLayerIndex()});
+      mapOffsets.push_back(nodeOffset(hd.innerLayer()));
+      mapOffsets.push_back(nodeOffset(hd.outerLayer()));
+      nedges += hd.size();
+    }
+    regionNodeOffsets_.push_back(nnodes);
+    ++regionIndex;
+  }
+
+  // edges: degree of each node, then scatter in CSR order
+  innerNodes_.reserve(nedges);
+  edgeOffsets_.assign(nnodes+1, 0);
+  unsigned int ilp = 0;
+  for(const auto& regionLayerPairs: doublets) {
+    for(const auto& layerPair: regionLayerPairs) {
+      const auto& hd = layerPair.doublets();
+      const unsigned int innerOffset = mapOffsets[2*ilp];
+      for(unsigned int i=0, size=hd.size(); i<size; ++i) {
+        const unsigned int node = innerOffset + hd.innerHitId(i);
+        innerNodes_.push_back(node);
+        ++edgeOffsets_[node+1];
+      }
+      ++ilp;
+    }
+  }
+  for(unsigned int i=0; i<nnodes; ++i) edgeOffsets_[i+1] += edgeOffsets_[i];
+
+  outerNodes_.resize(nedges);
+  edgeLayerPair_.resize(nedges);
+  edgeDoublet_.resize(nedges);
+  std::vector<unsigned int> next(edgeOffsets_.begin(), edgeOffsets_.end()-1);
+  unsigned int iedge = 0;
+  ilp = 0;
+  for(const auto& regionLayerPairs: doublets) {
+    for(const auto& layerPair: regionLayerPairs) {
+      const auto& hd = layerPair.doublets();
+      const unsigned int outerOffset = mapOffsets[2*ilp+1];
+      for(unsigned int i=0, size=hd.size(); i<size; ++i, ++iedge) {
+        const unsigned int k = next[innerNodes_[iedge]]++;
+        outerNodes_[k] = outerOffset + hd.outerHitId(i);
+        edgeLayerPair_[k] = ilp;
+        edgeDoublet_[k] = i;
+      }
+      ++ilp;
+    }
+  }
+  // inner nodes in CSR order
+  for(unsigned int node=0; node<nnodes; ++node) {
+    for(unsigned int k=edgeOffsets_[node]; k<edgeOffsets_[node+1]; ++k) innerNodes_[k] = node;
+  }
+}
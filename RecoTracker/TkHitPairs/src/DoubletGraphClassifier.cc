@@ -0,0 +1,140 @@
+#include "RecoTracker/TkHitPairs/interface/DoubletGraphClassifier.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "DataFormats/GeometryVector/interface/Pi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace {
+  void readDense(std::istream& in, const std::string& fileName, const char *name,
+                 unsigned int nin, unsigned int nout, DoubletGraphClassifier::Dense& layer) {
+    std::string tag;
+    in >> tag >> layer.nin >> layer.nout;
+    if(!in || tag != "dense" || layer.nin != nin || layer.nout != nout)
+      throw cms::Exception("DoubletGraphClassifier") << "bad layer " << name << " in " << fileName << ", expected dense " << nin << " " << nout;
+    layer.weights.resize(nin*nout);
+    layer.biases.resize(nout);
+    for(auto& w: layer.weights) in >> w;
+    for(auto& b: layer.biases) in >> b;
+    if(!in)
+      throw cms::Exception("DoubletGraphClassifier") << "truncated layer " << name << " in " << fileName;
+  }
+
+  constexpr unsigned int nNodeFeatures = 3;
+  constexpr unsigned int nEdgeFeatures = 3;
+}
+
+DoubletGraphClassifier::DoubletGraphClassifier(const std::string& fileName) {
+  std::ifstream in(fileName);
+  if(!in)
+    throw cms::Exception("DoubletGraphClassifier") << "cannot open " << fileName;
+
+  std::string magic, hidden, iterations, scales;
+  int version = 0;
+  in >> magic >> version >> hidden >> hidden_ >> iterations >> iterations_ >> scales >> scales_[0] >> scales_[1] >> scales_[2];
+  if(!in || magic != "DoubletGraphClassifier" || version != 1 || hidden != "hidden" || iterations != "iterations" || scales != "scales" || hidden_ == 0)
+    throw cms::Exception("DoubletGraphClassifier") << fileName << " is not a version 1 DoubletGraphClassifier file";
+
+  const unsigned int h = hidden_;
+  readDense(in, fileName, "nodeEncoder", nNodeFeatures, h, nodeEncoder_);
+  readDense(in, fileName, "edgeHidden", 2*h + nEdgeFeatures, h, edgeHidden_);
+  readDense(in, fileName, "edgeOutput", h, 1, edgeOutput_);
+  readDense(in, fileName, "nodeHidden", 3*h + nNodeFeatures, h, nodeHidden_);
+}
+
+void DoubletGraphClassifier::dense(const Dense& layer, const float *in, unsigned int n, Activation activation, float *out) {
+  for(unsigned int o=0; o<layer.nout; ++o) {
+    float * __restrict__ row = out + o*n;
+    const float bias = layer.biases[o];
+    for(unsigned int i=0; i<n; ++i) row[i] = bias;
+    for(unsigned int f=0; f<layer.nin; ++f) {
+      const float w = layer.weights[o*layer.nin + f];
+      const float * __restrict__ x = in + f*n;
+      for(unsigned int i=0; i<n; ++i) row[i] += w*x[i];
+    }
+    if(activation == Activation::tanh) {
+      for(unsigned int i=0; i<n; ++i) row[i] = std::tanh(row[i]);
+    }
+    else {
+      for(unsigned int i=0; i<n; ++i) row[i] = 1.f/(1.f + std::exp(-row[i]));
+    }
+  }
+}
+
+void DoubletGraphClassifier::edgeNetwork(const std::vector<unsigned int>& innerNodes, const std::vector<unsigned int>& outerNodes,
+                                         const std::vector<float>& nodes, const std::vector<float>& edgeFeatures,
+                                         std::vector<float>& edgeInput, std::vector<float>& edgeHidden, std::vector<float>& weights) const {
+  const unsigned int ne = outerNodes.size(), nn = nodes.size()/hidden_, h = hidden_;
+  const unsigned int *inner = innerNodes.data(), *outer = outerNodes.data();
+
+  edgeInput.resize((2*h + nEdgeFeatures)*ne);
+  for(unsigned int f=0; f<h; ++f) {
+    const float *state = nodes.data() + f*nn;
+    float *in = edgeInput.data() + f*ne, *out = edgeInput.data() + (h+f)*ne;
+    for(unsigned int k=0; k<ne; ++k) {
+      in[k] = state[inner[k]];
+      out[k] = state[outer[k]];
+    }
+  }
+  std::copy(edgeFeatures.begin(), edgeFeatures.end(), edgeInput.begin() + 2*h*ne);
+
+  edgeHidden.resize(h*ne);
+  dense(edgeHidden_, edgeInput.data(), ne, Activation::tanh, edgeHidden.data());
+  weights.resize(ne);
+  dense(edgeOutput_, edgeHidden.data(), ne, Activation::sigmoid, weights.data());
+}
+
+void DoubletGraphClassifier::operator()(const std::vector<float>& r, const std::vector<float>& phi, const std::vector<float>& z,
+                                        const std::vector<unsigned int>& edgeOffsets, const std::vector<unsigned int>& innerNodes,
+                                        const std::vector<unsigned int>& outerNodes, std::vector<float>& scores) const {
+  const unsigned int nn = r.size(), ne = outerNodes.size(), h = hidden_;
+  scores.clear();
+  if(ne == 0) return;
+
+  // node and edge features
+  std::vector<float> nodeFeatures(nNodeFeatures*nn);
+  for(unsigned int i=0; i<nn; ++i) {
+    nodeFeatures[i]      = r[i]/scales_[0];
+    nodeFeatures[nn+i]   = phi[i]/scales_[1];
+    nodeFeatures[2*nn+i] = z[i]/scales_[2];
+  }
+  std::vector<float> edgeFeatures(nEdgeFeatures*ne);
+  const unsigned int *inner = innerNodes.data(), *outer = outerNodes.data();
+  for(unsigned int k=0; k<ne; ++k) {
+    const unsigned int i = inner[k], o = outer[k];
+    float dphi = phi[o] - phi[i];
+    if(dphi > Geom::fpi()) dphi -= Geom::ftwoPi();
+    else if(dphi < -Geom::fpi()) dphi += Geom::ftwoPi();
+    edgeFeatures[k]        = (r[o] - r[i])/scales_[0];
+    edgeFeatures[ne+k]     = dphi/scales_[1];
+    edgeFeatures[2*ne+k]   = (z[o] - z[i])/scales_[2];
+  }
+
+  // node input is [state, weighted inner neighbours, weighted outer neighbours, features]
+  std::vector<float> nodeInput((3*h + nNodeFeatures)*nn);
+  std::copy(nodeFeatures.begin(), nodeFeatures.end(), nodeInput.begin() + 3*h*nn);
+  std::vector<float> nodes(h*nn);
+  dense(nodeEncoder_, nodeFeatures.data(), nn, Activation::tanh, nodes.data());
+
+  std::vector<float> edgeInput, edgeHidden;
+  const auto& offsets = edgeOffsets;
+  for(unsigned int iteration=0; iteration<iterations_; ++iteration) {
+    edgeNetwork(innerNodes, outerNodes, nodes, edgeFeatures, edgeInput, edgeHidden, scores);
+
+    std::copy(nodes.begin(), nodes.end(), nodeInput.begin());
+    std::fill(nodeInput.begin() + h*nn, nodeInput.begin() + 3*h*nn, 0.f);
+    for(unsigned int f=0; f<h; ++f) {
+      const float *state = nodes.data() + f*nn;
+      float *fromInner = nodeInput.data() + (h+f)*nn, *fromOuter = nodeInput.data() + (2*h+f)*nn;
+      for(unsigned int i=0; i<nn; ++i) {
+        float sum = 0.f;
+        for(unsigned int k=offsets[i]; k<offsets[i+1]; ++k) sum += scores[k]*state[outer[k]];
+        fromOuter[i] = sum;
+      }
+      for(unsigned int k=0; k<ne; ++k) fromInner[outer[k]] += scores[k]*state[inner[k]];
+    }
+    dense(nodeHidden_, nodeInput.data(), nn, Activation::tanh, nodes.data());
+  }
+  edgeNetwork(innerNodes, outerNodes, nodes, edgeFeatures, edgeInput, edgeHidden, scores);
+}
@@ -0,0 +1,78 @@
+#include "RecoTracker/TkHitPairs/interface/DoubletPrefilter.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+const char *DoubletPrefilter::name(Feature feature) {
+  switch(feature) {
+  case deltaA: return "deltaA";
+  case deltaADC: return "deltaADC";
+  case deltaS: return "deltaS";
+  case deltaR: return "deltaR";
+  case deltaPhi: return "deltaPhi";
+  case deltaZ: return "deltaZ";
+  case zZero: return "zZero";
+  default: return "unknown";
+  }
+}
+
+DoubletPrefilter::Features DoubletPrefilter::features(const HitFeatures& inner, const HitFeatures& outer) {
+  Features x;
+  x[deltaA] = outer.size - inner.size;
+  x[deltaADC] = outer.charge - inner.charge;
+  x[deltaS] = outer.shape - inner.shape;
+  x[deltaR] = outer.r - inner.r;
+  float dphi = outer.phi - inner.phi;
+  if(dphi > float(M_PI)) dphi -= float(2*M_PI);
+  else if(dphi < -float(M_PI)) dphi += float(2*M_PI);
+  x[deltaPhi] = dphi;
+  x[deltaZ] = outer.z - inner.z;
+  x[zZero] = x[deltaR] != 0.f ? inner.z - inner.r*x[deltaZ]/x[deltaR] : inner.z;
+  return x;
+}
+
+DoubletPrefilter::Decision DoubletPrefilter::Cuts::decide(const Features& x) const {
+  for(const auto& cut: reject)
+    if(!cut.inside(x)) return DoubletPrefilter::reject;
+  if(accept.empty()) return ambiguous;
+  for(const auto& cut: accept)
+    if(!cut.inside(x)) return ambiguous;
+  return DoubletPrefilter::accept;
+}
+
+DoubletPrefilter::DoubletPrefilter(const std::string& fileName) {
+  std::ifstream in(fileName);
+  if(!in)
+    throw cms::Exception("DoubletPrefilter") << "cannot open " << fileName;
+
+  std::string line;
+  for(unsigned int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string type, inner, outer, featureName;
+    if(!(fields >> type)) continue;
+    Cut cut;
+    fields >> inner >> outer >> featureName >> cut.min >> cut.max;
+    if(!fields || (type != "reject" && type != "accept"))
+      throw cms::Exception("DoubletPrefilter") << fileName << ":" << lineNumber << ": expected 'reject|accept inner outer feature min max'";
+    if((inner == "*") != (outer == "*"))
+      throw cms::Exception("DoubletPrefilter") << fileName << ":" << lineNumber << ": * must be used for both layers";
+    int feature = 0;
+    while(feature < nFeatures && featureName != name(Feature(feature))) ++feature;
+    if(feature == nFeatures)
+      throw cms::Exception("DoubletPrefilter") << fileName << ":" << lineNumber << ": unknown feature '" << featureName << "'";
+    if(!(cut.min <= cut.max))
+      throw cms::Exception("DoubletPrefilter") << fileName << ":" << lineNumber << ": empty window [" << cut.min << ", " << cut.max << "]";
+    cut.feature = Feature(feature);
+    auto& cuts = cuts_[std::make_pair(inner, outer)];
+    (type == "reject" ? cuts.reject : cuts.accept).push_back(cut);
+  }
+}
+
+const DoubletPrefilter::Cuts *DoubletPrefilter::cuts(const std::string& innerLayer, const std::string& outerLayer) const {
+  auto found = cuts_.find(std::make_pair(innerLayer, outerLayer));
+  if(found == cuts_.end()) found = cuts_.find(std::make_pair(std::string("*"), std::string("*")));
+  return found == cuts_.end() ? nullptr : &found->second;
+}
@@ -0,0 +1,29 @@
+#include "RecoTracker/TkHitPairs/interface/DuplicateDoublets.h"
+
+#include <algorithm>
+
+void DuplicateDoublets::clear() {
+  kept_.clear();
+  keptRegion_.clear();
+  otherOwners_.clear();
+}
+
+DoubletOwners DuplicateDoublets::owners() const {
+  // a region removing the same doublet in more layer pairs is listed once
+  auto others = otherOwners_;
+  std::sort(others.begin(), others.end());
+  others.erase(std::unique(others.begin(), others.end()), others.end());
+
+  std::vector<unsigned int> offsets(keptRegion_.size()+1, 0);
+  for(const auto& other: others) ++offsets[other.first+1];
+  for(unsigned int i=0; i<keptRegion_.size(); ++i) offsets[i+1] += offsets[i] + 1;
+
+  std::vector<unsigned int> regions;
+  regions.reserve(offsets.back());
+  auto other = others.begin();
+  for(unsigned int i=0; i<keptRegion_.size(); ++i) {
+    regions.push_back(keptRegion_[i]);
+    for(; other != others.end() && other->first == i; ++other) regions.push_back(other->second);
+  }
+  return DoubletOwners(std::move(offsets), std::move(regions));
+}
@@ -1,5 +1,6 @@
 #include "RecoTracker/TkHitPairs/interface/HitPairGeneratorFromLayerPair.h"
 #include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/Utilities/interface/Exception.h"
 
 #include "TrackingTools/DetLayers/interface/DetLayer.h"
 #include "TrackingTools/DetLayers/interface/BarrelDetLayer.h"
@@ -9,6 +10,7 @@
 #include "RecoTracker/TkTrackingRegions/interface/TrackingRegion.h"
 #include "RecoTracker/TkTrackingRegions/interface/TrackingRegionBase.h"
 #include "RecoTracker/TkHitPairs/interface/OrderedHitPairs.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairKernels.h"
 #include "RecoTracker/TkHitPairs/src/InnerDeltaPhi.h"
 
 #include "FWCore/Framework/interface/Event.h"
@@ -33,45 +35,20 @@ HitPairGeneratorFromLayerPair::HitPairGeneratorFromLayerPair(
 							     unsigned int inner,
 							     unsigned int outer,
 							     LayerCacheType* layerCache,
-							     unsigned int max)
-  : theLayerCache(layerCache), theOuterLayer(outer), theInnerLayer(inner), theMaxElement(max)
+							     unsigned int max,
+							     Overflow overflow)
+  : theLayerCache(layerCache), theOuterLayer(outer), theInnerLayer(inner), theMaxElement(max), theOverflow(overflow)
 {
 }
 
 HitPairGeneratorFromLayerPair::~HitPairGeneratorFromLayerPair() {}
 
-// devirtualizer
-#include<tuple>
-namespace {
-
-  template<typename Algo>
-  struct Kernel {
-    using  Base = HitRZCompatibility;
-    void set(Base const * a) {
-      assert( a->algo()==Algo::me);
-      checkRZ=reinterpret_cast<Algo const *>(a);
-    }
-    
-    void operator()(int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) const {
-      constexpr float nSigmaRZ = 3.46410161514f; // std::sqrt(12.f);
-      for (int i=b; i!=e; ++i) {
-	Range allowed = checkRZ->range(innerHitsMap.u[i]);
-	float vErr = nSigmaRZ * innerHitsMap.dv[i];
-	Range hitRZ(innerHitsMap.v[i]-vErr, innerHitsMap.v[i]+vErr);
-	Range crossRange = allowed.intersection(hitRZ);
-	ok[i-b] = ! crossRange.empty() ;
-      }
-    }
-    Algo const * checkRZ;
-    
-  };
-
-
-  template<typename ... Args> using Kernels = std::tuple<Kernel<Args>...>;
-
+HitPairGeneratorFromLayerPair::Overflow HitPairGeneratorFromLayerPair::overflow(const std::string& name) {
+  if(name == "clear") return Overflow::clear;
+  if(name == "keepBest") return Overflow::keepBest;
+  throw cms::Exception("Configuration") << "Unknown maxElementOverflow '" << name << "', valid values are 'clear' and 'keepBest'";
 }
 
-
 void HitPairGeneratorFromLayerPair::hitPairs(
 					     const TrackingRegion & region, OrderedHitPairs & result,
 					     const edm::Event& iEvent, const edm::EventSetup& iSetup, Layers layers) {
@@ -80,7 +57,8 @@ void HitPairGeneratorFromLayerPair::hitPairs(
   for (std::size_t i=0; i!=ds.size(); ++i) {
     result.push_back( OrderedHitPair( ds.hit(i,HitDoublets::inner),ds.hit(i,HitDoublets::outer) ));
   }
-  if (theMaxElement!=0 && result.size() >= theMaxElement){
+  // with keepBest the layer pair is already limited to the best theMaxElement doublets
+  if (theOverflow == Overflow::clear && theMaxElement!=0 && result.size() >= theMaxElement){
      result.clear();
     edm::LogError("TooManyPairs")<<"number of pairs exceed maximum, no pairs produced";
   }
@@ -98,7 +76,7 @@ HitDoublets HitPairGeneratorFromLayerPair::doublets( const TrackingRegion& regio
   HitDoublets result(innerHitsMap,outerHitsMap); result.reserve(std::max(innerHitsMap.size(),outerHitsMap.size()));
   doublets(region,
 	   *innerLayer.detLayer(),*outerLayer.detLayer(),
-	   innerHitsMap,outerHitsMap,iSetup,theMaxElement,result);
+	   innerHitsMap,outerHitsMap,iSetup,theMaxElement,result,theOverflow,theCounters);
   
   return result;
 
@@ -111,7 +89,9 @@ void HitPairGeneratorFromLayerPair::doublets(const TrackingRegion& region,
 						    const RecHitsSortedInPhi & outerHitsMap,
 						    const edm::EventSetup& iSetup,
 						    const unsigned int theMaxElement,
-						    HitDoublets & result){
+						    HitDoublets & result,
+						    Overflow overflow,
+						    hitPairKernels::Counters * counters){
 
   //  HitDoublets result(innerHitsMap,outerHitsMap); result.reserve(std::max(innerHitsMap.size(),outerHitsMap.size()));
   typedef RecHitsSortedInPhi::Hit Hit;
@@ -119,8 +99,14 @@ void HitPairGeneratorFromLayerPair::doublets(const TrackingRegion& region,
 
   // std::cout << "layers " << theInnerLayer.detLayer()->seqNum()  << " " << outerLayer.detLayer()->seqNum() << std::endl;
 
-  // constexpr float nSigmaRZ = std::sqrt(12.f);
-  constexpr float nSigmaPhi = 3.f;
+  // with keepBest the search is not stopped at theMaxElement, the doublets are scored instead
+  // and the best theMaxElement are selected whenever twice as many are found, so that the
+  // doublets and their scores never take more than 2*theMaxElement entries
+  const bool keepBest = overflow == Overflow::keepBest && theMaxElement!=0;
+  std::vector<float> scores;
+  size_t found = 0;
+
+  using hitPairKernels::nSigmaPhi;
   for (int io = 0; io!=int(outerHitsMap.theHits.size()); ++io) {
     if (!deltaPhi.prefilter(outerHitsMap.x[io],outerHitsMap.y[io])) continue;
     Hit const & ohit =  outerHitsMap.theHits[io].hit();
@@ -139,42 +125,31 @@ void HitPairGeneratorFromLayerPair::doublets(const TrackingRegion& region,
 						       );
     if(!checkRZ) continue;
 
-    Kernels<HitZCheck,HitRCheck,HitEtaCheck> kernels;
-
-    auto innerRange = innerHitsMap.doubleRange(phiRange.min(), phiRange.max());
     LogDebug("HitPairGeneratorFromLayerPair")<<
-      "preparing for combination of: "<< innerRange[1]-innerRange[0]+innerRange[3]-innerRange[2]
-				      <<" inner and: "<< outerHitsMap.theHits.size()<<" outter";
-    for(int j=0; j<3; j+=2) {
-      auto b = innerRange[j]; auto e=innerRange[j+1];
-      bool ok[e-b];
-      switch (checkRZ->algo()) {
-	case (HitRZCompatibility::zAlgo) :
-	  std::get<0>(kernels).set(checkRZ);
-	  std::get<0>(kernels)(b,e,innerHitsMap, ok);
-	  break;
-	case (HitRZCompatibility::rAlgo) :
-	  std::get<1>(kernels).set(checkRZ);
-	  std::get<1>(kernels)(b,e,innerHitsMap, ok);
-	  break;
-	case (HitRZCompatibility::etaAlgo) :
-	  std::get<2>(kernels).set(checkRZ);
-	  std::get<2>(kernels)(b,e,innerHitsMap, ok);
-	  break;
-      }
-      for (int i=0; i!=e-b; ++i) {
-	if (!ok[i]) continue;
-	if (theMaxElement!=0 && result.size() >= theMaxElement){
-	  result.clear();
-	  edm::LogError("TooManyPairs")<<"number of pairs exceed maximum, no pairs produced";
-	  delete checkRZ;
-	  return;
-	}
-        result.add(b+i,io);
-      }
+      "preparing for combination of inner hits in phi range ("<< phiRange.min() << "," << phiRange.max()
+				      <<") and: "<< outerHitsMap.theHits.size()<<" outter";
+    auto rz = [checkRZ](int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) {
+      hitPairKernels::checkRZ(checkRZ, b, e, innerHitsMap, ok);
+    };
+    const size_t before = result.size();
+    if (!hitPairKernels::addDoublets(io, phiRange.min(), phiRange.max(), rz, innerHitsMap, keepBest ? 0 : theMaxElement, result, counters)) {
+      result.clear();
+      edm::LogError("TooManyPairs")<<"number of pairs exceed maximum, no pairs produced";
+      delete checkRZ;
+      return;
+    }
+    if (keepBest) {
+      hitPairKernels::residuals(phiRange.min(), phiRange.max(), [checkRZ](float u) { return checkRZ->range(u); },
+                                before, result, scores);
+      found += result.size()-before;
+      if (result.size() >= 2*theMaxElement) hitPairKernels::keepBest(result, scores, theMaxElement);
     }
     delete checkRZ;
   }
+  if (keepBest && found > theMaxElement) {
+    edm::LogWarning("TooManyPairs")<<"number of pairs "<<found<<" exceed maximum, keeping the best "<<theMaxElement;
+    hitPairKernels::keepBest(result, scores, theMaxElement);
+  }
   LogDebug("HitPairGeneratorFromLayerPair")<<" total number of pairs provided back: "<<result.size();
   result.shrink_to_fit();
 
@@ -0,0 +1,201 @@
+#include "RecoTracker/TkHitPairs/interface/HitPairRecord.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairKernels.h"
+#include "RecoTracker/TkHitPairs/src/InnerDeltaPhi.h"
+#include "RecoTracker/TkTrackingRegions/interface/TrackingRegion.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+
+namespace {
+  constexpr unsigned int theMagicV1 = 0x31525048; // "HPR1", without LayerPair::keepBest
+  constexpr unsigned int theMagic = 0x32525048; // "HPR2"
+
+  template <typename T> void writePOD(std::ofstream& out, const T& v) {
+    out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+  }
+  template <typename T> void writeVector(std::ofstream& out, const std::vector<T>& v) {
+    writePOD(out, static_cast<unsigned int>(v.size()));
+    out.write(reinterpret_cast<const char *>(v.data()), v.size()*sizeof(T));
+  }
+
+  template <typename T> void readPOD(std::ifstream& in, T& v) {
+    in.read(reinterpret_cast<char *>(&v), sizeof(T));
+  }
+  template <typename T> void readVector(std::ifstream& in, std::vector<T>& v) {
+    unsigned int size = 0;
+    readPOD(in, size);
+    v.resize(size);
+    in.read(reinterpret_cast<char *>(v.data()), v.size()*sizeof(T));
+  }
+}
+
+namespace hitPairRecord {
+
+  Writer::Writer(const std::string& fileName): out_(fileName, std::ios::binary) {
+    if(!out_)
+      throw cms::Exception("Configuration") << "Can not open " << fileName << " to record the doublet inputs";
+    writePOD(out_, theMagic);
+  }
+
+  void Writer::write(const Event& event) {
+    writePOD(out_, event.run);
+    writePOD(out_, event.lumi);
+    writePOD(out_, event.event);
+    writePOD(out_, static_cast<unsigned int>(event.regions.size()));
+    for(const auto& region: event.regions) {
+      writePOD(out_, region.originX); writePOD(out_, region.originY); writePOD(out_, region.originZ);
+      writePOD(out_, region.ptMin); writePOD(out_, region.originRBound); writePOD(out_, region.originZBound);
+      writePOD(out_, static_cast<unsigned int>(region.layers.size()));
+      for(const auto& layer: region.layers) {
+        writePOD(out_, layer.index);
+        writePOD(out_, layer.seqNum);
+        writePOD(out_, layer.barrel);
+        writeVector(out_, layer.hits);
+      }
+      writePOD(out_, static_cast<unsigned int>(region.layerPairs.size()));
+      for(const auto& pair: region.layerPairs) {
+        writePOD(out_, pair.inner);
+        writePOD(out_, pair.outer);
+        writePOD(out_, pair.maxElement);
+        writePOD(out_, pair.keepBest);
+        writeVector(out_, pair.windows);
+        writeVector(out_, pair.doublets);
+      }
+    }
+    out_.flush();
+  }
+
+  Reader::Reader(const std::string& fileName): in_(fileName, std::ios::binary) {
+    unsigned int magic = 0;
+    readPOD(in_, magic);
+    if(!in_ || (magic != theMagic && magic != theMagicV1))
+      throw cms::Exception("Configuration") << fileName << " is not a doublet input record";
+    version_ = magic == theMagicV1 ? 1 : 2;
+  }
+
+  bool Reader::read(Event& event) {
+    readPOD(in_, event.run);
+    if(!in_) return false;
+    readPOD(in_, event.lumi);
+    readPOD(in_, event.event);
+    unsigned int nregions = 0;
+    readPOD(in_, nregions);
+    event.regions.resize(nregions);
+    for(auto& region: event.regions) {
+      readPOD(in_, region.originX); readPOD(in_, region.originY); readPOD(in_, region.originZ);
+      readPOD(in_, region.ptMin); readPOD(in_, region.originRBound); readPOD(in_, region.originZBound);
+      unsigned int size = 0;
+      readPOD(in_, size);
+      region.layers.resize(size);
+      for(auto& layer: region.layers) {
+        readPOD(in_, layer.index);
+        readPOD(in_, layer.seqNum);
+        readPOD(in_, layer.barrel);
+        readVector(in_, layer.hits);
+      }
+      readPOD(in_, size);
+      region.layerPairs.resize(size);
+      for(auto& pair: region.layerPairs) {
+        readPOD(in_, pair.inner);
+        readPOD(in_, pair.outer);
+        readPOD(in_, pair.maxElement);
+        pair.keepBest = false;
+        if(version_ >= 2) readPOD(in_, pair.keepBest);
+        readVector(in_, pair.windows);
+        readVector(in_, pair.doublets);
+      }
+    }
+    if(!in_)
+      throw cms::Exception("CorruptData") << "Truncated doublet input record";
+    return true;
+  }
+
+  Layer makeLayer(int index, int seqNum, const RecHitsSortedInPhi& hits) {
+    Layer layer{index, seqNum, hits.isBarrel, {}};
+    layer.hits.resize(hits.size());
+    for(unsigned int i=0; i!=hits.size(); ++i) {
+      auto& hs = layer.hits[i];
+      hs.x = hits.x[i]; hs.y = hits.y[i]; hs.z = hits.z[i];
+      hs.errorRPhi = hits.drphi[i];
+      hs.errorR = hits.isBarrel ? hits.du[i] : hits.dv[i];
+      hs.errorZ = hits.isBarrel ? hits.dv[i] : hits.du[i];
+    }
+    return layer;
+  }
+
+  Region makeRegion(const TrackingRegion& region) {
+    return Region{region.origin().x(), region.origin().y(), region.origin().z(),
+                  region.ptMin(), region.originRBound(), region.originZBound(), {}, {}};
+  }
+
+  void fillWindows(const TrackingRegion& region,
+                   const DetLayer& innerHitDetLayer, const DetLayer& outerHitDetLayer,
+                   const RecHitsSortedInPhi& innerHitsMap, const RecHitsSortedInPhi& outerHitsMap,
+                   const edm::EventSetup& iSetup,
+                   std::vector<Window>& windows) {
+    windows.clear();
+    if(innerHitsMap.empty() || outerHitsMap.empty()) return;
+    windows.reserve(outerHitsMap.size());
+
+    // the RZ range is sampled at the extreme u of the inner layer
+    auto uRange = std::minmax_element(innerHitsMap.u.begin(), innerHitsMap.u.end());
+    const float u0 = *uRange.first;
+    const float u1 = *uRange.second > u0 ? *uRange.second : u0+1.f;
+
+    InnerDeltaPhi deltaPhi(outerHitDetLayer, innerHitDetLayer, region, iSetup);
+    using hitPairKernels::nSigmaPhi;
+    for (int io = 0; io!=int(outerHitsMap.theHits.size()); ++io) {
+      if (!deltaPhi.prefilter(outerHitsMap.x[io],outerHitsMap.y[io])) { windows.push_back(Window::skip()); continue; }
+      PixelRecoRange<float> phiRange = deltaPhi(outerHitsMap.x[io],
+                                                outerHitsMap.y[io],
+                                                outerHitsMap.z[io],
+                                                nSigmaPhi*outerHitsMap.drphi[io]
+                                                );
+      if (phiRange.empty()) { windows.push_back(Window::skip()); continue; }
+
+      const HitRZCompatibility *checkRZ = region.checkRZ(&innerHitDetLayer, outerHitsMap.theHits[io].hit(), iSetup, &outerHitDetLayer,
+                                                         outerHitsMap.rv(io),outerHitsMap.z[io],
+                                                         outerHitsMap.isBarrel ? outerHitsMap.du[io] :  outerHitsMap.dv[io],
+                                                         outerHitsMap.isBarrel ? outerHitsMap.dv[io] :  outerHitsMap.du[io]
+                                                         );
+      if(!checkRZ) { windows.push_back(Window::skip()); continue; }
+
+      auto r0 = checkRZ->range(u0);
+      auto r1 = checkRZ->range(u1);
+      const float lo1 = (r1.min()-r0.min())/(u1-u0);
+      const float hi1 = (r1.max()-r0.max())/(u1-u0);
+      windows.push_back(Window{phiRange.min(), phiRange.max(), r0.min()-lo1*u0, lo1, r0.max()-hi1*u0, hi1});
+      delete checkRZ;
+    }
+  }
+
+  void doublets(const RecHitsSortedInPhi& innerHitsMap, const RecHitsSortedInPhi& outerHitsMap,
+                const std::vector<Window>& windows, const unsigned int maxElement, const bool keepBest,
+                HitDoublets& result) {
+    assert(windows.size() == outerHitsMap.size() || innerHitsMap.empty() || outerHitsMap.empty());
+    // as in HitPairGeneratorFromLayerPair::doublets
+    const bool best = keepBest && maxElement!=0;
+    std::vector<float> scores;
+    size_t found = 0;
+    for (int io = 0; io!=int(windows.size()); ++io) {
+      const Window& w = windows[io];
+      if (w.skipped()) continue;
+      auto range = [&w](float u) { return hitPairKernels::Range(w.lo0+w.lo1*u, w.hi0+w.hi1*u); };
+      auto rz = [&range](int b, int e, const RecHitsSortedInPhi & hitsMap, bool * ok) {
+        hitPairKernels::rzCompatibility(range, b, e, hitsMap, ok);
+      };
+      const size_t before = result.size();
+      if (!hitPairKernels::addDoublets(io, w.phiMin, w.phiMax, rz, innerHitsMap, best ? 0 : maxElement, result)) {
+        result.clear();
+        return;
+      }
+      if (best) {
+        hitPairKernels::residuals(w.phiMin, w.phiMax, range, before, result, scores);
+        found += result.size()-before;
+        if (result.size() >= 2*maxElement) hitPairKernels::keepBest(result, scores, maxElement);
+      }
+    }
+    if (best && found > maxElement) hitPairKernels::keepBest(result, scores, maxElement);
+    result.shrink_to_fit();
+  }
+}
@@ -0,0 +1,94 @@
+#include "RecoTracker/TkHitPairs/interface/HitPairStats.h"
+
+#include <iomanip>
+#include <ostream>
+
+HitPairStats::Counters& HitPairStats::Counters::operator+=(const Counters& other) {
+  calls += other.calls;
+  outerHits += other.outerHits;
+  candidates += other.candidates;
+  rzAccepted += other.rzAccepted;
+  doublets += other.doublets;
+  inferred += other.inferred;
+  kept += other.kept;
+  time += other.time;
+  return *this;
+}
+
+void HitPairStats::add(const std::string& region, const std::string& innerLayer, const std::string& outerLayer,
+                       const hitPairKernels::Counters& search, unsigned long long doublets, unsigned long long inferred,
+                       unsigned long long kept, double time) {
+  auto& counters = counters_[Key(region, innerLayer, outerLayer)];
+  ++counters.calls;
+  counters.outerHits += search.outerHits;
+  counters.candidates += search.candidates;
+  counters.rzAccepted += search.rzAccepted;
+  counters.doublets += doublets;
+  counters.inferred += inferred;
+  counters.kept += kept;
+  counters.time += time;
+}
+
+void HitPairStats::merge(const HitPairStats& other) {
+  for(const auto& item: other.counters_)
+    counters_[item.first] += item.second;
+}
+
+namespace {
+  void printLine(std::ostream& out, const std::string& region, const std::string& layers, const HitPairStats::Counters& c) {
+    const double perCall = c.calls ? 1./c.calls : 0.;
+    out << std::left << std::setw(32) << region << std::setw(28) << layers << std::right
+        << std::setw(10) << c.calls
+        << std::setw(14) << std::setprecision(1) << std::fixed << c.candidates*perCall
+        << std::setw(10) << std::setprecision(3) << (c.candidates ? double(c.rzAccepted)/c.candidates : 0.)
+        << std::setw(14) << std::setprecision(1) << c.doublets*perCall
+        << std::setw(14) << c.inferred*perCall
+        << std::setw(14) << c.kept*perCall
+        << std::setw(12) << std::setprecision(3) << c.time*perCall*1.e3
+        << std::setw(12) << std::setprecision(2) << c.time
+        << "\n";
+  }
+
+  void jsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for(char c: s) {
+      if(c == '"' || c == '\\') out << '\\';
+      out << c;
+    }
+    out << '"';
+  }
+}
+
+void HitPairStats::printTable(std::ostream& out) const {
+  out << std::left << std::setw(32) << "region" << std::setw(28) << "layer pair" << std::right
+      << std::setw(10) << "calls" << std::setw(14) << "candidates" << std::setw(10) << "RZ eff"
+      << std::setw(14) << "doublets" << std::setw(14) << "inferred" << std::setw(14) << "kept" << std::setw(12) << "ms/call" << std::setw(12) << "total s" << "\n";
+  Counters total;
+  for(const auto& item: counters_) {
+    printLine(out, std::get<0>(item.first), std::get<1>(item.first) + "+" + std::get<2>(item.first), item.second);
+    total += item.second;
+  }
+  printLine(out, "total", "", total);
+}
+
+void HitPairStats::writeJson(std::ostream& out) const {
+  out << "[\n";
+  bool first = true;
+  for(const auto& item: counters_) {
+    const auto& c = item.second;
+    if(!first) out << ",\n";
+    first = false;
+    out << "  {\"region\": "; jsonString(out, std::get<0>(item.first));
+    out << ", \"innerLayer\": "; jsonString(out, std::get<1>(item.first));
+    out << ", \"outerLayer\": "; jsonString(out, std::get<2>(item.first));
+    out << ", \"calls\": " << c.calls
+        << ", \"outerHits\": " << c.outerHits
+        << ", \"candidates\": " << c.candidates
+        << ", \"rzAccepted\": " << c.rzAccepted
+        << ", \"doublets\": " << c.doublets
+        << ", \"inferred\": " << c.inferred
+        << ", \"kept\": " << c.kept
+        << ", \"time\": " << std::setprecision(9) << std::defaultfloat << c.time << "}";
+  }
+  out << "\n]\n";
+}
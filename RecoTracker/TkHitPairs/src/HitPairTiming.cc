@@ -0,0 +1,99 @@
+#include "RecoTracker/TkHitPairs/interface/HitPairTiming.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+
+const char *HitPairTiming::name(Stage stage) {
+  switch(stage) {
+  case doublets: return "doublets";
+  case prefilter: return "prefilter";
+  case cnnData: return "cnnData";
+  case cnnInference: return "cnnInference";
+  case cnnPush: return "cnnPush";
+  case fill: return "fill";
+  default: return "unknown";
+  }
+}
+
+void HitPairTiming::add(Stage stage, double seconds) {
+  auto& h = stages_[stage];
+  int bin = 0;
+  if(seconds > 0) {
+    bin = 1 + int(std::floor((std::log10(seconds) - minDecade)*binsPerDecade));
+    bin = std::min(std::max(bin, 0), nBins-1);
+  }
+  ++h.bins[bin];
+  ++h.entries;
+  h.total += seconds;
+  h.max = std::max(h.max, seconds);
+}
+
+void HitPairTiming::merge(const HitPairTiming& other) {
+  for(int s=0; s<nStages; ++s) {
+    auto& h = stages_[s];
+    const auto& o = other.stages_[s];
+    for(int b=0; b<nBins; ++b) h.bins[b] += o.bins[b];
+    h.entries += o.entries;
+    h.total += o.total;
+    h.max = std::max(h.max, o.max);
+  }
+}
+
+double HitPairTiming::quantile(Stage stage, double q) const {
+  const auto& h = stages_[stage];
+  if(h.entries == 0) return 0;
+  const double target = q*h.entries;
+  unsigned long long sum = 0;
+  for(int b=0; b<nBins; ++b) {
+    sum += h.bins[b];
+    if(sum >= target && sum > 0) {
+      if(b == nBins-1) return h.max; // overflow
+      return std::min(h.max, std::pow(10., minDecade + double(b)/binsPerDecade));
+    }
+  }
+  return h.max;
+}
+
+void HitPairTiming::printTable(std::ostream& out) const {
+  out << std::left << std::setw(14) << "stage" << std::right << std::setw(14) << "entries"
+      << std::setw(14) << "mean ms" << std::setw(14) << "p50 ms" << std::setw(14) << "p95 ms"
+      << std::setw(14) << "p99 ms" << std::setw(14) << "max ms" << "\n";
+  for(int s=0; s<nStages; ++s) {
+    const Stage stage = Stage(s);
+    const auto& h = stages_[s];
+    if(h.entries == 0) continue;
+    out << std::left << std::setw(14) << name(stage) << std::right << std::setw(14) << h.entries
+        << std::fixed << std::setprecision(4)
+        << std::setw(14) << h.total/h.entries*1.e3
+        << std::setw(14) << quantile(stage, 0.50)*1.e3
+        << std::setw(14) << quantile(stage, 0.95)*1.e3
+        << std::setw(14) << quantile(stage, 0.99)*1.e3
+        << std::setw(14) << h.max*1.e3 << "\n";
+  }
+}
+
+HitPairTiming::TraceWriter::TraceWriter(const std::string& fileName, Clock::time_point origin, unsigned int thread):
+  out_(fileName), origin_(origin), thread_(thread)
+{
+  if(!out_)
+    throw cms::Exception("FileOpenError") << "HitPairTiming: cannot open trace file " << fileName;
+  out_ << "{\"traceEvents\": [\n";
+}
+
+HitPairTiming::TraceWriter::~TraceWriter() {
+  out_ << "\n]}\n";
+}
+
+void HitPairTiming::TraceWriter::write(Stage stage, Clock::time_point start, Clock::time_point end, unsigned long long event) {
+  using us = std::chrono::duration<double, std::micro>;
+  if(!first_) out_ << ",\n";
+  first_ = false;
+  out_ << "{\"name\": \"" << name(stage) << "\", \"cat\": \"HitPairEDProducer\", \"ph\": \"X\""
+       << ", \"ts\": " << std::fixed << std::setprecision(3) << us(start - origin_).count()
+       << ", \"dur\": " << us(end - start).count()
+       << ", \"pid\": 0, \"tid\": " << thread_
+       << ", \"args\": {\"event\": " << event << "}}";
+}
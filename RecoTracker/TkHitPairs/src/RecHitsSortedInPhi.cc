@@ -26,27 +26,51 @@ RecHitsSortedInPhi::RecHitsSortedInPhi(const std::vector<Hit>& hits, GlobalPoint
   for (unsigned int i=0; i!=theHits.size(); ++i) {
     auto const & h = *theHits[i].hit();
     auto const & gs = static_cast<BaseTrackerRecHit const &>(h).globalState();
-    auto loc = gs.position-origin.basicVector();
-    float lr = loc.perp();
-    // float lr = gs.position.perp();
-    float lz = gs.position.z();
-    float dr = gs.errorR;
-    float dz = gs.errorZ;
-    // r[i] = gs.position.perp();
-    // phi[i] = gs.position.barePhi();
-    x[i] = gs.position.x();
-    y[i] = gs.position.y();
-    z[i] = lz;
-    drphi[i] = gs.errorRPhi;
-    u[i] = isBarrel ? lr : lz;
-    v[i] = isBarrel ? lz : lr;
-    du[i] = isBarrel ? dr : dz;
-    dv[i] = isBarrel ? dz : dr;
-    lphi[i] = loc.barePhi();
+    setColumns(i, gs.position, gs.errorR, gs.errorZ, gs.errorRPhi, origin);
   }
   
 }
 
+RecHitsSortedInPhi::RecHitsSortedInPhi(const std::vector<HitGlobalState>& hits, GlobalPoint const & origin, bool barrel) :
+  theOrigin(origin),
+  layer(nullptr),
+  isBarrel(barrel),
+  x(hits.size()),y(hits.size()),z(hits.size()),drphi(hits.size()),
+  u(hits.size()),v(hits.size()),du(hits.size()),dv(hits.size()),
+  lphi(hits.size())
+{
+  std::vector<std::pair<float,unsigned int> > order; order.reserve(hits.size());
+  for (unsigned int i=0; i!=hits.size(); ++i)
+    order.emplace_back(GlobalPoint(hits[i].x,hits[i].y,hits[i].z).barePhi(), i);
+  std::stable_sort(order.begin(), order.end(),
+                   [](std::pair<float,unsigned int> const & a, std::pair<float,unsigned int> const & b) { return a.first < b.first; });
+
+  theHits.reserve(hits.size());
+  for (unsigned int i=0; i!=order.size(); ++i) {
+    auto const & hs = hits[order[i].second];
+    theHits.emplace_back(nullptr, order[i].first);
+    setColumns(i, GlobalPoint(hs.x,hs.y,hs.z), hs.errorR, hs.errorZ, hs.errorRPhi, origin);
+  }
+}
+
+void RecHitsSortedInPhi::setColumns(unsigned int i, GlobalPoint const & position, float errorR, float errorZ, float errorRPhi,
+                                    GlobalPoint const & origin) {
+  auto loc = position-origin.basicVector();
+  float lr = loc.perp();
+  float lz = position.z();
+  float dr = errorR;
+  float dz = errorZ;
+  x[i] = position.x();
+  y[i] = position.y();
+  z[i] = lz;
+  drphi[i] = errorRPhi;
+  u[i] = isBarrel ? lr : lz;
+  v[i] = isBarrel ? lz : lr;
+  du[i] = isBarrel ? dr : dz;
+  dv[i] = isBarrel ? dz : dr;
+  lphi[i] = loc.barePhi();
+}
+
 
 RecHitsSortedInPhi::DoubleRange RecHitsSortedInPhi::doubleRange(float phiMin, float phiMax) const {
   Range r1,r2;
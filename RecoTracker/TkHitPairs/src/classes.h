@@ -1,5 +1,7 @@
 #include "RecoTracker/TkHitPairs/interface/IntermediateHitDoublets.h"
 #include "RecoTracker/TkHitPairs/interface/RegionsSeedingHitSets.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletGraph.h"
+#include "RecoTracker/TkHitPairs/interface/DoubletOwners.h"
 #include "DataFormats/Common/interface/Wrapper.h"
 
 #include <vector>
@@ -11,5 +13,11 @@ namespace RecoTracker_TkHitPairs {
 
     RegionsSeedingHitSets rshs;
     edm::Wrapper<RegionsSeedingHitSets> wrshs;
+
+    DoubletGraph dg;
+    edm::Wrapper<DoubletGraph> wdg;
+
+    DoubletOwners dow;
+    edm::Wrapper<DoubletOwners> wdow;
   };
 }
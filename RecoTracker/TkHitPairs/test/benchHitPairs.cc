@@ -0,0 +1,193 @@
+// Standalone benchmark of the doublet search of HitPairGeneratorFromLayerPair
+// on synthetic pixel layers, no EventSetup or input files needed.
+//
+// usage: benchHitPairs [PU=100] [events=5] [seed=12345]
+//
+// Hits are generated uniformly in phi on a Phase-1 like pixel detector with an
+// occupancy proportional to PU. The phi window of each outer hit corresponds to
+// a 0.9 GeV track from the beam line in 3.8 T, the RZ window to a vertex in
+// |z|<15 cm (HitEtaCheck), as a GlobalTrackingRegion would give.
+
+#include "RecoTracker/TkHitPairs/interface/HitPairKernels.h"
+#include "RecoTracker/TkMSParametrization/interface/PixelRecoPointRZ.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+  typedef std::chrono::steady_clock Clock;
+
+  double nsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now()-start).count();
+  }
+
+  struct LayerGeometry {
+    const char * name;
+    bool barrel;
+    float pos;        // radius (barrel) or z (forward)
+    float min, max;   // z extension (barrel) or radial extension (forward)
+    float hitsPerPU;  // average number of hits per pileup interaction
+  };
+
+  const LayerGeometry theLayers[] = {
+    {"BPix1",  true,   2.9f, -26.7f, 26.7f, 24.f},
+    {"BPix2",  true,   6.8f, -26.7f, 26.7f, 14.f},
+    {"BPix3",  true,  10.9f, -26.7f, 26.7f, 10.f},
+    {"BPix4",  true,  16.0f, -26.7f, 26.7f,  8.f},
+    {"FPix1+", false, 32.0f,   4.5f, 16.0f,  5.f},
+    {"FPix2+", false, 39.5f,   4.5f, 16.0f,  5.f},
+    {"FPix3+", false, 48.5f,   4.5f, 16.0f,  5.f},
+    {"FPix1-", false,-32.0f,   4.5f, 16.0f,  5.f},
+    {"FPix2-", false,-39.5f,   4.5f, 16.0f,  5.f},
+    {"FPix3-", false,-48.5f,   4.5f, 16.0f,  5.f}
+  };
+  constexpr unsigned int nLayers = sizeof(theLayers)/sizeof(LayerGeometry);
+
+  const std::pair<unsigned int, unsigned int> theLayerPairs[] = {
+    {0,1}, {1,2}, {2,3}, {0,2}, {1,3},
+    {0,4}, {1,4}, {4,5}, {5,6},
+    {0,7}, {1,7}, {7,8}, {8,9}
+  };
+
+  constexpr float ptMin = 0.9f;
+  constexpr float bendingRadius = ptMin/(0.003f*3.8f); // cm
+  constexpr float zVertexBound = 15.f;
+  constexpr float hitErrorRPhi = 0.0015f, hitErrorZ = 0.0025f, hitErrorR = 0.0025f;
+
+  std::vector<RecHitsSortedInPhi::HitGlobalState> generateHits(const LayerGeometry & layer, float pu, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> uphi(-M_PI, M_PI), upos(layer.min, layer.max);
+    std::poisson_distribution<int> nhits(layer.hitsPerPU*pu);
+    std::vector<RecHitsSortedInPhi::HitGlobalState> hits(nhits(rng));
+    for (auto & h : hits) {
+      float phi = uphi(rng);
+      float r = layer.barrel ? layer.pos : upos(rng);
+      h.x = r*std::cos(phi); h.y = r*std::sin(phi);
+      h.z = layer.barrel ? upos(rng) : layer.pos;
+      h.errorRPhi = hitErrorRPhi;
+      h.errorZ = layer.barrel ? hitErrorZ : 0.f;
+      h.errorR = layer.barrel ? 0.f : hitErrorR;
+    }
+    return hits;
+  }
+
+  // half width of the phi window of an outer hit at radius rOuter for an inner layer at rInner
+  float deltaPhi(float rInner, float rOuter, float errRPhi) {
+    float dphi = std::asin(std::min(1.f, rOuter/(2.f*bendingRadius))) - std::asin(std::min(1.f, rInner/(2.f*bendingRadius)));
+    return std::abs(dphi) + hitPairKernels::nSigmaPhi*errRPhi/rInner + 0.003f;
+  }
+
+  // lines from the outer hit to the ends of the beam spot, ordered to give a non-reversed range at uProbe
+  HitEtaCheck makeEtaCheck(bool innerBarrel, float rOuter, float zOuter, float uProbe) {
+    float cotLeft = (zOuter + zVertexBound)/rOuter;
+    float cotRight = (zOuter - zVertexBound)/rOuter;
+    HitEtaCheck check(innerBarrel, PixelRecoPointRZ(rOuter, zOuter), cotLeft, cotRight);
+    auto r = check.range(uProbe);
+    if (r.min() <= r.max()) return check;
+    return HitEtaCheck(innerBarrel, PixelRecoPointRZ(rOuter, zOuter), cotRight, cotLeft);
+  }
+
+  float innerRadius(const RecHitsSortedInPhi & hits) {
+    float r = 0;
+    for (unsigned int i=0; i!=hits.size(); ++i) r += std::sqrt(hits.x[i]*hits.x[i]+hits.y[i]*hits.y[i]);
+    return hits.empty() ? 1.f : r/hits.size();
+  }
+
+  struct Timing {
+    double ns = 0;
+    long long n = 0;
+    double perItem() const { return n ? ns/n : 0.; }
+  };
+
+}
+
+int main(int argc, char ** argv) {
+  const float pu = argc > 1 ? std::atof(argv[1]) : 100.f;
+  const int nEvents = argc > 2 ? std::atoi(argv[2]) : 5;
+  const unsigned int seed = argc > 3 ? std::atoi(argv[3]) : 12345;
+
+  std::mt19937 rng(seed);
+  const GlobalPoint origin(0,0,0);
+
+  Timing tBuild, tRange, tKernel, tDoublets;
+  long long nHits = 0, nDoublets = 0;
+
+  for (int iev=0; iev!=nEvents; ++iev) {
+    // layer hit maps
+    std::vector<std::unique_ptr<RecHitsSortedInPhi> > maps;
+    for (auto const & layer : theLayers) {
+      auto hits = generateHits(layer, pu, rng);
+      auto start = Clock::now();
+      maps.emplace_back(std::make_unique<RecHitsSortedInPhi>(hits, origin, layer.barrel));
+      tBuild.ns += nsSince(start); tBuild.n += hits.size();
+      nHits += hits.size();
+    }
+
+    for (auto const & lp : theLayerPairs) {
+      const RecHitsSortedInPhi & inner = *maps[lp.first];
+      const RecHitsSortedInPhi & outer = *maps[lp.second];
+      if (inner.empty() || outer.empty()) continue;
+      const bool innerBarrel = theLayers[lp.first].barrel;
+      const float rInner = innerRadius(inner);
+      const float uProbe = innerBarrel ? rInner : theLayers[lp.first].pos;
+
+      // phi windows and RZ checks of the outer hits
+      std::vector<std::pair<float,float> > phiWindows(outer.size());
+      std::vector<HitEtaCheck> checks; checks.reserve(outer.size());
+      for (unsigned int io=0; io!=outer.size(); ++io) {
+        float ro = std::sqrt(outer.x[io]*outer.x[io]+outer.y[io]*outer.y[io]);
+        float dphi = deltaPhi(rInner, ro, outer.drphi[io]);
+        phiWindows[io] = std::make_pair(outer.phi(io)-dphi, outer.phi(io)+dphi);
+        checks.push_back(makeEtaCheck(innerBarrel, ro, outer.z[io], uProbe));
+      }
+
+      // doubleRange alone
+      long long sink = 0;
+      auto start = Clock::now();
+      for (unsigned int io=0; io!=outer.size(); ++io) {
+        auto r = inner.doubleRange(phiWindows[io].first, phiWindows[io].second);
+        sink += r[1]-r[0]+r[3]-r[2];
+      }
+      tRange.ns += nsSince(start); tRange.n += outer.size();
+
+      // RZ kernel over the whole inner layer, one outer hit in 16
+      std::unique_ptr<bool[]> ok(new bool[inner.size()]);
+      start = Clock::now();
+      for (unsigned int io=0; io<outer.size(); io+=16) {
+        hitPairKernels::checkRZ(&checks[io], 0, inner.size(), inner, ok.get());
+        sink += ok[0];
+      }
+      tKernel.ns += nsSince(start); tKernel.n += ((outer.size()+15)/16)*inner.size();
+
+      // full doublet search
+      HitDoublets result(inner, outer); result.reserve(std::max(inner.size(), outer.size()));
+      start = Clock::now();
+      for (unsigned int io=0; io!=outer.size(); ++io) {
+        HitRZCompatibility const * checkRZ = &checks[io];
+        auto rz = [checkRZ](int b, int e, const RecHitsSortedInPhi & innerHitsMap, bool * ok) {
+          hitPairKernels::checkRZ(checkRZ, b, e, innerHitsMap, ok);
+        };
+        hitPairKernels::addDoublets(io, phiWindows[io].first, phiWindows[io].second, rz, inner, 0, result);
+      }
+      tDoublets.ns += nsSince(start); tDoublets.n += outer.size();
+      nDoublets += result.size();
+
+      if (sink < 0) std::printf("impossible\n"); // keep the timed loops alive
+    }
+  }
+
+  std::printf("benchHitPairs: PU %.0f, %d events, %u layers, %zu layer pairs, %.0f hits/event\n",
+              pu, nEvents, nLayers, sizeof(theLayerPairs)/sizeof(theLayerPairs[0]), double(nHits)/std::max(nEvents,1));
+  std::printf("  RecHitsSortedInPhi : %8.2f ns/hit\n", tBuild.perItem());
+  std::printf("  doubleRange        : %8.2f ns/call\n", tRange.perItem());
+  std::printf("  RZ kernel (eta)    : %8.2f ns/inner hit\n", tKernel.perItem());
+  std::printf("  doublets           : %8.0f /event, %.3g doublets/s, %.2f ns/outer hit\n",
+              double(nDoublets)/std::max(nEvents,1), tDoublets.ns > 0 ? nDoublets/(tDoublets.ns*1e-9) : 0., tDoublets.perItem());
+  return 0;
+}
@@ -0,0 +1,388 @@
+// Test of the native doublet classifier runtime (DoubletCNN): random models
+// are written in the DoubletCNN text format and evaluated on random doublets,
+// the outputs are compared with a plain reference implementation running on
+// the full image (all the channels, zeros except the inner and outer pads),
+// as TensorFlow does. Covered: a layer map CNN with even and odd kernels and
+// an odd image size for the poolings, a dense model on the flattened image
+// and a features only model, with raw (empty pixels at 0) and normalized
+// pads, and both paths of the first convolution (pixel scatter and dense).
+// The int8 path is calibrated on random doublets and compared with the float
+// outputs on others; all the int8 kernels available on the CPU must give the
+// same outputs, also after writing and reading the model. The models with
+// the pad normalization and the feature standardization folded in must give
+// on raw inputs the outputs of the original models on normalized inputs.
+//
+// usage: testDoubletCNN
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+  struct Layer {
+    std::string type;      // conv, maxpool, dense
+    unsigned int size, nin, nout;
+    std::string activation;
+    std::vector<float> weights, biases;
+  };
+
+  struct Model {
+    unsigned int padSize, channels, infoSize;
+    std::vector<Layer> layers;
+  };
+
+  Model randomModel(std::mt19937& gen, unsigned int padSize, unsigned int channels, unsigned int infoSize,
+                    const std::vector<Layer>& shapes) {
+    std::uniform_real_distribution<float> weight(-0.5f, 0.5f);
+    Model model{padSize, channels, infoSize, shapes};
+    for (auto& layer: model.layers) {
+      if (layer.type == "maxpool") continue;
+      const unsigned int kernel = layer.type == "conv" ? layer.size*layer.size : 1;
+      layer.weights.resize(kernel*layer.nin*layer.nout);
+      for (auto& w: layer.weights) w = weight(gen);
+      layer.biases.resize(layer.nout);
+      for (auto& b: layer.biases) b = weight(gen);
+    }
+    return model;
+  }
+
+  void write(const Model& model, const std::string& fileName, const std::string& normalization = "") {
+    std::ofstream out(fileName);
+    out << "DoubletCNN 1\ninput " << model.padSize << " " << model.channels << " " << model.infoSize << "\n";
+    out << normalization;
+    out.precision(9);
+    for (const auto& layer: model.layers) {
+      if (layer.type == "maxpool") {
+        out << "maxpool " << layer.size << "\n";
+        continue;
+      }
+      if (layer.type == "conv") out << "conv " << layer.size << " ";
+      else out << "dense ";
+      out << layer.nin << " " << layer.nout << " " << layer.activation << "\n";
+      for (float w: layer.weights) out << w << " ";
+      out << "\n";
+      for (float b: layer.biases) out << b << " ";
+      out << "\n";
+    }
+    out << "end\n";
+  }
+
+  void activate(const std::string& activation, std::vector<float>& x, unsigned int nout) {
+    if (activation == "relu")
+      for (auto& v: x) v = std::max(v, 0.f);
+    else if (activation == "sigmoid")
+      for (auto& v: x) v = 1.f/(1.f + std::exp(-v));
+    else if (activation == "softmax")
+      for (size_t i = 0; i < x.size(); i += nout) {
+        double sum = 0;
+        for (unsigned int o = 0; o < nout; ++o) sum += std::exp(x[i+o]);
+        for (unsigned int o = 0; o < nout; ++o) x[i+o] = std::exp(x[i+o])/sum;
+      }
+  }
+
+  // the full image, channels last, with the TensorFlow 'same' padding (before = (k-1)/2)
+  std::vector<float> reference(const Model& model, const std::vector<float>& image, const std::vector<float>& info) {
+    std::vector<float> x = image;
+    int n = model.padSize;
+    unsigned int channels = model.channels;
+    bool flat = false;
+    for (const auto& layer: model.layers) {
+      std::vector<float> y;
+      if (layer.type == "conv") {
+        const int k = layer.size, before = (k-1)/2;
+        y.assign(n*n*layer.nout, 0.f);
+        for (int r = 0; r < n; ++r)
+          for (int c = 0; c < n; ++c)
+            for (unsigned int o = 0; o < layer.nout; ++o) {
+              double sum = layer.biases[o];
+              for (int dy = 0; dy < k; ++dy)
+                for (int dx = 0; dx < k; ++dx) {
+                  const int rr = r+dy-before, cc = c+dx-before;
+                  if (rr < 0 || rr >= n || cc < 0 || cc >= n) continue;
+                  for (unsigned int i = 0; i < layer.nin; ++i)
+                    sum += x[(rr*n+cc)*layer.nin + i]*layer.weights[((dy*k+dx)*layer.nin + i)*layer.nout + o];
+                }
+              y[(r*n+c)*layer.nout + o] = sum;
+            }
+        channels = layer.nout;
+        activate(layer.activation, y, layer.nout);
+      }
+      else if (layer.type == "maxpool") {
+        const int s = layer.size, m = (n+s-1)/s, before = (m*s-n)/2;
+        y.assign(m*m*channels, 0.f);
+        for (int r = 0; r < m; ++r)
+          for (int c = 0; c < m; ++c)
+            for (unsigned int i = 0; i < channels; ++i) {
+              float best = -1e30f;
+              for (int dy = 0; dy < s; ++dy)
+                for (int dx = 0; dx < s; ++dx) {
+                  const int rr = r*s+dy-before, cc = c*s+dx-before;
+                  if (rr >= 0 && rr < n && cc >= 0 && cc < n) best = std::max(best, x[(rr*n+cc)*channels + i]);
+                }
+              y[(r*m+c)*channels + i] = best;
+            }
+        n = m;
+      }
+      else {
+        if (!flat) {
+          flat = true;
+          if (model.channels == 0) x.clear();
+          x.insert(x.end(), info.begin(), info.end());
+        }
+        y.assign(layer.nout, 0.f);
+        for (unsigned int o = 0; o < layer.nout; ++o) {
+          double sum = layer.biases[o];
+          for (unsigned int i = 0; i < layer.nin; ++i) sum += x[i]*layer.weights[i*layer.nout + o];
+          y[o] = sum;
+        }
+        activate(layer.activation, y, layer.nout);
+      }
+      x.swap(y);
+    }
+    return x;
+  }
+
+  // random doublets, and the full images for the reference
+  void fill(std::mt19937& gen, const Model& model, float background, DoubletCNN::Input& input,
+            std::vector<std::vector<float> >& images, std::vector<std::vector<float> >& infos) {
+    std::uniform_int_distribution<unsigned int> layer(0, std::max(model.channels/2, 1u) - 1);
+    std::uniform_int_distribution<unsigned int> pixel(0, model.padSize*model.padSize - 1);
+    std::uniform_int_distribution<int> npixels(1, 12);
+    std::uniform_real_distribution<float> value(-1.5f, 3.f);
+
+    input.setBackground(background);
+    for (unsigned int i = 0; i < input.size(); ++i) {
+      std::vector<float> image(model.padSize*model.padSize*model.channels, 0.f);
+      for (unsigned int j = 0; j < 2 && model.channels > 0; ++j) {
+        const unsigned int channel = j*model.channels/2 + layer(gen);
+        input.setChannel(i, j, channel);
+        float *pad = input.pad(i, j);
+        std::fill(pad, pad + model.padSize*model.padSize, background);
+        // sparse clusters, and sometimes a full pad as after the normalization
+        if (i % 5 == 0)
+          for (unsigned int p = 0; p < model.padSize*model.padSize; ++p) pad[p] = value(gen);
+        else
+          for (int k = npixels(gen); k > 0; --k) pad[pixel(gen)] = value(gen);
+        for (unsigned int p = 0; p < model.padSize*model.padSize; ++p) image[p*model.channels + channel] = pad[p];
+      }
+      std::vector<float> info(model.infoSize);
+      for (auto& v: info) v = value(gen);
+      std::copy(info.begin(), info.end(), input.info(i));
+      images.push_back(image);
+      infos.push_back(info);
+    }
+  }
+
+  bool check(const char *name, std::mt19937& gen, const Model& model, unsigned int doublets, float background) {
+    const std::string fileName = std::string("testDoubletCNN_") + name + ".txt";
+    write(model, fileName);
+    DoubletCNN cnn(fileName);
+
+    DoubletCNN::Input input(cnn, doublets);
+    std::vector<std::vector<float> > images, infos;
+    fill(gen, model, background, input, images, infos);
+
+    // default limit (full pads dense, clusters scattered), all dense, all scattered
+    const unsigned int limits[] = {cnn.scatterLimit(), 0, 1000000};
+    for (unsigned int limit: limits) {
+      cnn.setScatterLimit(limit);
+      std::vector<float> outputs;
+      cnn(input, outputs);
+      if (outputs.size() != doublets*cnn.outputs()) {
+        std::printf("%s: %zu outputs, expected %u\n", name, outputs.size(), doublets*cnn.outputs());
+        return false;
+      }
+      for (unsigned int i = 0; i < doublets; ++i) {
+        const auto expected = reference(model, images[i], infos[i]);
+        for (unsigned int o = 0; o < cnn.outputs(); ++o) {
+          const float v = outputs[i*cnn.outputs() + o];
+          if (std::abs(v - expected[o]) > 1e-4f*std::max(1.f, std::abs(expected[o]))) {
+            std::printf("%s: background %g scatter limit %u doublet %u output %u is %g, expected %g\n",
+                        name, background, limit, i, o, v, expected[o]);
+            return false;
+          }
+        }
+      }
+    }
+    std::remove(fileName.c_str());
+    std::printf("%s: %u doublets with background %g OK\n", name, doublets, background);
+    return true;
+  }
+
+  // the random models are not trained, their outputs are sharper functions of the inputs than usual
+  bool checkInt8(const char *name, std::mt19937& gen, const Model& model, unsigned int doublets,
+                 float meanTolerance, float maxTolerance) {
+    const std::string fileName = std::string("testDoubletCNN_") + name + "_int8.txt";
+    write(model, fileName);
+    const DoubletCNN cnn(fileName);
+    DoubletCNN int8(fileName);
+
+    const float background = (0. - 13382.0011321)/10525.1252954;
+    DoubletCNN::Input sample(cnn, doublets), input(cnn, doublets);
+    std::vector<std::vector<float> > images, infos;
+    fill(gen, model, background, sample, images, infos);
+    fill(gen, model, background, input, images, infos);
+    int8.calibrate(sample);
+    int8.write(fileName);
+    const DoubletCNN reread(fileName);
+    std::remove(fileName.c_str());
+    if (!int8.quantized() || !reread.quantized()) {
+      std::printf("%s: not quantized after the calibration\n", name);
+      return false;
+    }
+
+    std::vector<float> expected, outputs, rereadOutputs;
+    cnn(input, expected);
+    int8(input, outputs);
+    float maxDiff = 0.f, meanDiff = 0.f;
+    for (size_t k = 0; k < outputs.size(); ++k) {
+      maxDiff = std::max(maxDiff, std::abs(outputs[k] - expected[k]));
+      meanDiff += std::abs(outputs[k] - expected[k])/outputs.size();
+    }
+    if (meanDiff > meanTolerance || maxDiff > maxTolerance) {
+      std::printf("%s: int8 outputs differ by %g on average, up to %g from float\n", name, meanDiff, maxDiff);
+      return false;
+    }
+
+    const std::string best = DoubletCNN::int8Kernel();
+    for (const char *kernel: {"generic", "avx2", "vnni"}) {
+      if (!DoubletCNN::setInt8Kernel(kernel)) continue;
+      int8(input, outputs);
+      reread(input, rereadOutputs);
+      for (size_t k = 0; k < outputs.size(); ++k) {
+        if (outputs[k] != rereadOutputs[k] || std::abs(outputs[k] - expected[k]) > maxDiff) {
+          std::printf("%s: %s kernel output %zu is %g (reread %g), float %g\n", name, kernel, k, outputs[k], rereadOutputs[k], expected[k]);
+          return false;
+        }
+      }
+      std::printf("%s: %s kernel OK\n", name, kernel);
+    }
+    DoubletCNN::setInt8Kernel(best);
+    std::printf("%s: int8 within %g (%g on average) of float OK\n", name, maxDiff, meanDiff);
+    return true;
+  }
+
+  // raw ADC pads and features, normalized as in training for the original model
+  bool checkNormalization(const char *name, std::mt19937& gen, const Model& model, unsigned int doublets) {
+    const std::string fileName = std::string("testDoubletCNN_") + name + "_normalized.txt";
+    const float padMean = 13382.0011321, padSigma = 10525.1252954;
+    std::uniform_real_distribution<float> mean(-50.f, 50.f), sigma(0.1f, 20.f), adc(1000.f, 40000.f);
+    std::vector<float> infoMeans(model.infoSize), infoSigmas(model.infoSize);
+    for (auto& m: infoMeans) m = mean(gen);
+    for (auto& s: infoSigmas) s = sigma(gen);
+
+    write(model, fileName);
+    const DoubletCNN cnn(fileName);
+    DoubletCNN folded(fileName);
+    folded.normalizePads(padMean, padSigma);
+    folded.standardizeInfo(infoMeans, infoSigmas);
+    std::ostringstream normalization;
+    normalization.precision(9);
+    normalization << "normalize " << padMean << " " << padSigma << "\nstandardize\n";
+    for (float m: infoMeans) normalization << m << " ";
+    for (float s: infoSigmas) normalization << s << " ";
+    normalization << "\n";
+    write(model, fileName, normalization.str());
+    const DoubletCNN loaded(fileName);
+    folded.write(fileName);
+    const DoubletCNN reread(fileName);
+    std::remove(fileName.c_str());
+    if (!folded.padsNormalized() || !loaded.padsNormalized() || !reread.padsNormalized() || cnn.padsNormalized()) {
+      std::printf("%s: wrong padsNormalized()\n", name);
+      return false;
+    }
+
+    DoubletCNN::Input normalized(cnn, doublets), raw(cnn, doublets);
+    std::vector<std::vector<float> > images, infos;
+    fill(gen, model, 0.f, raw, images, infos);
+    normalized.setBackground((0.f - padMean)/padSigma);
+    for (unsigned int i = 0; i < doublets; ++i) {
+      for (unsigned int j = 0; j < 2 && model.channels > 0; ++j) {
+        float *pad = raw.pad(i, j);
+        for (unsigned int p = 0; p < raw.padElements(); ++p) {
+          if (pad[p] != 0.f) pad[p] = adc(gen);
+          normalized.pad(i, j)[p] = (pad[p] - padMean)/padSigma;
+        }
+        normalized.setChannel(i, j, raw.channel(i, j));
+      }
+      for (unsigned int f = 0; f < model.infoSize; ++f) {
+        raw.info(i)[f] = infoMeans[f] + infoSigmas[f]*raw.info(i)[f];
+        normalized.info(i)[f] = (raw.info(i)[f] - infoMeans[f])/infoSigmas[f];
+      }
+    }
+
+    std::vector<float> expected, outputs;
+    cnn(normalized, expected);
+    const DoubletCNN *variants[] = {&folded, &loaded, &reread};
+    for (const DoubletCNN *variant: variants) {
+      for (unsigned int limit: {variant->scatterLimit(), 0u, 1000000u}) {
+        DoubletCNN limited = *variant;
+        limited.setScatterLimit(limit);
+        limited(raw, outputs);
+        for (size_t k = 0; k < outputs.size(); ++k) {
+          if (std::abs(outputs[k] - expected[k]) > 1e-3f*std::max(1.f, std::abs(expected[k]))) {
+            std::printf("%s: scatter limit %u output %zu on raw inputs is %g, expected %g\n", name, limit, k, outputs[k], expected[k]);
+            return false;
+          }
+        }
+      }
+    }
+    std::printf("%s: %u doublets with folded normalization OK\n", name, doublets);
+    return true;
+  }
+
+}
+
+int main() {
+  std::mt19937 gen(4242);
+
+  // as small_doublet_model, smaller
+  const Model layerMap = randomModel(gen, 16, 20, 67, {
+      {"conv", 5, 20, 8, "relu", {}, {}},
+      {"conv", 4, 8, 8, "relu", {}, {}},
+      {"maxpool", 2, 0, 0, "", {}, {}},
+      {"conv", 3, 8, 6, "relu", {}, {}},
+      {"maxpool", 2, 0, 0, "", {}, {}},
+      {"dense", 0, 4*4*6 + 67, 16, "relu", {}, {}},
+      {"dense", 0, 16, 2, "softmax", {}, {}}});
+  // odd pad size (15) for the 'same' poolings
+  const Model oddPad = randomModel(gen, 15, 4, 5, {
+      {"conv", 3, 4, 5, "relu", {}, {}},
+      {"maxpool", 2, 0, 0, "", {}, {}},
+      {"maxpool", 3, 0, 0, "", {}, {}},
+      {"dense", 0, 3*3*5 + 5, 1, "sigmoid", {}, {}}});
+  // as dense_model
+  const Model dense = randomModel(gen, 16, 20, 67, {
+      {"dense", 0, 16*16*20 + 67, 12, "relu", {}, {}},
+      {"dense", 0, 12, 2, "softmax", {}, {}}});
+  // features only
+  const Model info = randomModel(gen, 0, 0, 67, {
+      {"dense", 0, 67, 10, "relu", {}, {}},
+      {"dense", 0, 10, 2, "softmax", {}, {}}});
+
+  // raw pads and pads normalized as in CNNInference
+  for (float background: {0.f, float((0. - 13382.0011321)/10525.1252954)}) {
+    if (!check("layerMap", gen, layerMap, 50, background)) return 1;
+    if (!check("oddPad", gen, oddPad, 50, background)) return 1;
+    if (!check("dense", gen, dense, 50, background)) return 1;
+    if (!check("info", gen, info, 50, background)) return 1;
+  }
+
+  if (!checkNormalization("layerMap", gen, layerMap, 50)) return 1;
+  if (!checkNormalization("oddPad", gen, oddPad, 50)) return 1;
+  if (!checkNormalization("dense", gen, dense, 50)) return 1;
+  if (!checkNormalization("info", gen, info, 50)) return 1;
+
+  if (!checkInt8("layerMap", gen, layerMap, 200, 0.03f, 0.3f)) return 1;
+  if (!checkInt8("oddPad", gen, oddPad, 200, 0.03f, 0.3f)) return 1;
+  if (!checkInt8("dense", gen, dense, 200, 0.03f, 0.3f)) return 1;
+  return 0;
+}
@@ -0,0 +1,508 @@
+// Test of DoubletCNN::fromKeras: random Keras models are written as Keras
+// does (JSON topology, HDF5 weights as saved by save() and save_weights()),
+// loaded, and their outputs compared with a reference running the Keras
+// graph layer by layer (BatchNormalization and Dropout as in inference).
+// Covered: batch normalizations folded in the preceding convolution and dense
+// layer, in the following dense layer, kept as an affine before a max pooling
+// (positive and negative scales) and after the output; Dropout, Activation,
+// the layer map CNN and the dense model; the text format round trip.
+// With arguments, a Keras model is loaded and its layers are printed.
+//
+// usage: testDoubletCNNKeras [model.json weights.h5]
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCNN.h"
+
+#include "hdf5.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+  struct Weight {
+    std::vector<hsize_t> dims;
+    std::vector<float> values;
+  };
+
+  struct KerasLayer {
+    std::string type, name;
+    std::vector<std::string> inputs;
+    unsigned int size = 0;              // kernel or pool size, image size for the image input
+    unsigned int n = 0;                 // filters, units, channels or features of the inputs
+    std::string activation = "linear";
+    std::vector<std::pair<std::string, Weight> > weights;
+  };
+
+  struct Value {
+    unsigned int size = 0;              // image size, 0 for features
+    unsigned int n = 0;                 // channels or features
+    std::vector<float> x;
+  };
+
+  class Model {
+  public:
+    explicit Model(std::mt19937& gen): gen_(gen) {}
+
+    std::string input(unsigned int size, unsigned int n, const std::string& name) {
+      KerasLayer layer;
+      layer.type = "InputLayer";
+      layer.name = name;
+      layer.size = size;
+      layer.n = n;
+      return add(layer);
+    }
+    std::string conv(const std::string& in, unsigned int k, unsigned int filters, const std::string& activation) {
+      KerasLayer layer = make("Conv2D", in);
+      layer.size = k;
+      layer.n = filters;
+      layer.activation = activation;
+      const unsigned int nin = values_[in].n;
+      layer.weights = {{"kernel", random({k, k, nin, filters}, -0.4f, 0.4f)}, {"bias", random({filters}, -0.2f, 0.2f)}};
+      shape(layer, values_[in].size, filters);
+      return add(layer);
+    }
+    std::string maxpool(const std::string& in, unsigned int s) {
+      KerasLayer layer = make("MaxPooling2D", in);
+      layer.size = s;
+      shape(layer, (values_[in].size + s - 1)/s, values_[in].n);
+      return add(layer);
+    }
+    std::string dense(const std::string& in, unsigned int units, const std::string& activation) {
+      KerasLayer layer = make("Dense", in);
+      layer.n = units;
+      layer.activation = activation;
+      layer.weights = {{"kernel", random({values_[in].n, units}, -0.4f, 0.4f)}, {"bias", random({units}, -0.2f, 0.2f)}};
+      shape(layer, 0, units);
+      return add(layer);
+    }
+    // gammas in [lo, hi]
+    std::string batchNorm(const std::string& in, float lo, float hi) {
+      KerasLayer layer = make("BatchNormalization", in);
+      const hsize_t n = values_[in].n;
+      layer.weights = {{"gamma", random({n}, lo, hi)}, {"beta", random({n}, -0.5f, 0.5f)},
+                       {"moving_mean", random({n}, -0.5f, 0.5f)}, {"moving_variance", random({n}, 0.3f, 2.f)}};
+      shape(layer, values_[in].size, values_[in].n);
+      return add(layer);
+    }
+    std::string same(const std::string& type, const std::string& in, const std::string& activation = "") {
+      KerasLayer layer = make(type, in);
+      layer.activation = activation;
+      shape(layer, values_[in].size, values_[in].n);
+      return add(layer);
+    }
+    std::string flatten(const std::string& in) {
+      KerasLayer layer = make("Flatten", in);
+      shape(layer, 0, values_[in].size*values_[in].size*values_[in].n);
+      return add(layer);
+    }
+    std::string concatenate(const std::string& a, const std::string& b) {
+      KerasLayer layer = make("Concatenate", a);
+      layer.inputs.push_back(b);
+      shape(layer, 0, values_[a].n + values_[b].n);
+      return add(layer);
+    }
+
+    // the layers as Keras 2.1 model.to_json()
+    std::string json(const std::vector<std::string>& inputs, const std::string& output) const {
+      std::ostringstream out;
+      out << "{\"class_name\": \"Model\", \"keras_version\": \"2.1.5\", \"backend\": \"tensorflow\", \"config\": {\"name\": \"model\", \"layers\": [";
+      for(size_t l=0; l<layers_.size(); ++l) {
+        const auto& layer = layers_[l];
+        out << (l ? ", " : "") << "{\"class_name\": \"" << layer.type << "\", \"name\": \"" << layer.name << "\", \"config\": {\"name\": \"" << layer.name << "\"";
+        if(layer.type == "InputLayer") {
+          if(layer.size) out << ", \"batch_input_shape\": [null, " << layer.size << ", " << layer.size << ", " << layer.n << "]";
+          else out << ", \"batch_input_shape\": [null, " << layer.n << "]";
+          out << ", \"dtype\": \"float32\", \"sparse\": false";
+        }
+        else if(layer.type == "Conv2D")
+          out << ", \"filters\": " << layer.n << ", \"kernel_size\": [" << layer.size << ", " << layer.size << "], \"strides\": [1, 1], "
+              << "\"padding\": \"same\", \"data_format\": \"channels_last\", \"dilation_rate\": [1, 1], \"activation\": \""
+              << layer.activation << "\", \"use_bias\": true, \"kernel_initializer\": {\"class_name\": \"VarianceScaling\", "
+              << "\"config\": {\"distribution\": \"uniform\", \"scale\": 1.0, \"seed\": null, \"mode\": \"fan_avg\"}}";
+        else if(layer.type == "MaxPooling2D")
+          out << ", \"pool_size\": [" << layer.size << ", " << layer.size << "], \"padding\": \"same\", \"strides\": ["
+              << layer.size << ", " << layer.size << "], \"data_format\": \"channels_last\", \"trainable\": true";
+        else if(layer.type == "Dense")
+          out << ", \"units\": " << layer.n << ", \"activation\": \"" << layer.activation << "\", \"use_bias\": true, \"kernel_constraint\": "
+              << "{\"class_name\": \"MaxNorm\", \"config\": {\"max_value\": 2, \"axis\": 0}}";
+        else if(layer.type == "BatchNormalization")
+          out << ", \"axis\": -1, \"momentum\": 0.99, \"epsilon\": 0.001, \"center\": true, \"scale\": true";
+        else if(layer.type == "Dropout")
+          out << ", \"rate\": 0.5, \"noise_shape\": null, \"seed\": null";
+        else if(layer.type == "Activation")
+          out << ", \"activation\": \"" << layer.activation << "\"";
+        else if(layer.type == "Concatenate")
+          out << ", \"axis\": -1";
+        out << "}, \"inbound_nodes\": [";
+        if(!layer.inputs.empty()) {
+          out << "[";
+          for(size_t i=0; i<layer.inputs.size(); ++i) out << (i ? ", " : "") << "[\"" << layer.inputs[i] << "\", 0, 0, {}]";
+          out << "]";
+        }
+        out << "]}";
+      }
+      out << "], \"input_layers\": [";
+      for(size_t i=0; i<inputs.size(); ++i) out << (i ? ", " : "") << "[\"" << inputs[i] << "\", 0, 0]";
+      out << "], \"output_layers\": [[\"" << output << "\", 0, 0]]}}";
+      return out.str();
+    }
+
+    // as save() (model_weights group, fixed length strings) or save_weights() (variable length strings)
+    void h5(const std::string& fileName, bool full) const {
+      const hid_t file = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      const hid_t root = full ? H5Gcreate2(file, "model_weights", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT) : file;
+      std::vector<std::string> names;
+      for(const auto& layer: layers_) names.push_back(layer.name);
+      strings(root, "layer_names", names, full);
+      const hid_t intermediate = H5Pcreate(H5P_LINK_CREATE);
+      H5Pset_create_intermediate_group(intermediate, 1);
+      for(const auto& layer: layers_) {
+        const hid_t group = H5Gcreate2(root, layer.name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        std::vector<std::string> weightNames;
+        for(const auto& weight: layer.weights) {
+          // Keras adds _1 to the names of the variables of a rebuilt model
+          const std::string name = layer.name + "_1/" + weight.first + ":0";
+          weightNames.push_back(name);
+          const hid_t space = H5Screate_simple(weight.second.dims.size(), weight.second.dims.data(), nullptr);
+          const hid_t dataset = H5Dcreate2(group, name.c_str(), H5T_IEEE_F32LE, space, intermediate, H5P_DEFAULT, H5P_DEFAULT);
+          H5Dwrite(dataset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, weight.second.values.data());
+          H5Dclose(dataset);
+          H5Sclose(space);
+        }
+        if(!weightNames.empty()) strings(group, "weight_names", weightNames, full);
+        H5Gclose(group);
+      }
+      H5Pclose(intermediate);
+      if(full) H5Gclose(root);
+      H5Fclose(file);
+    }
+
+    // the Keras graph in inference mode
+    Value evaluate(const std::map<std::string, Value>& inputs) const {
+      std::map<std::string, Value> values;
+      Value last;
+      for(const auto& layer: layers_) {
+        Value y;
+        if(layer.type == "InputLayer") y = inputs.at(layer.name);
+        else {
+          const Value& x = values.at(layer.inputs[0]);
+          y = reference(layer, x, layer.inputs.size() > 1 ? &values.at(layer.inputs[1]) : nullptr);
+        }
+        values[layer.name] = y;
+        last = y;
+      }
+      return last;
+    }
+
+  private:
+    KerasLayer make(const std::string& type, const std::string& in) {
+      KerasLayer layer;
+      layer.type = type;
+      layer.name = type + "_" + std::to_string(layers_.size());
+      layer.inputs = {in};
+      return layer;
+    }
+    std::string add(const KerasLayer& layer) {
+      if(layer.type == "InputLayer") shape(layer, layer.size, layer.n);
+      layers_.push_back(layer);
+      return layer.name;
+    }
+    void shape(const KerasLayer& layer, unsigned int size, unsigned int n) {
+      values_[layer.name].size = size;
+      values_[layer.name].n = n;
+    }
+    Weight random(const std::vector<hsize_t>& dims, float lo, float hi) {
+      std::uniform_real_distribution<float> value(lo, hi);
+      Weight weight{dims, {}};
+      hsize_t n = 1;
+      for(auto d: dims) n *= d;
+      for(hsize_t i=0; i<n; ++i) weight.values.push_back(value(gen_));
+      return weight;
+    }
+
+    static void strings(hid_t object, const char *name, const std::vector<std::string>& values, bool fixed) {
+      const hsize_t n = values.size();
+      const hid_t space = H5Screate_simple(1, &n, nullptr);
+      const hid_t type = H5Tcopy(H5T_C_S1);
+      if(fixed) {
+        size_t length = 1;
+        for(const auto& v: values) length = std::max(length, v.size());
+        H5Tset_size(type, length);
+        std::vector<char> buffer(n*length, '\0');
+        for(size_t i=0; i<n; ++i) std::copy(values[i].begin(), values[i].end(), buffer.begin() + i*length);
+        const hid_t attr = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attr, type, buffer.data());
+        H5Aclose(attr);
+      }
+      else {
+        H5Tset_size(type, H5T_VARIABLE);
+        std::vector<const char *> buffer;
+        for(const auto& v: values) buffer.push_back(v.c_str());
+        const hid_t attr = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attr, type, buffer.data());
+        H5Aclose(attr);
+      }
+      H5Tclose(type);
+      H5Sclose(space);
+    }
+
+    static const Weight& weight(const KerasLayer& layer, const std::string& name) {
+      for(const auto& w: layer.weights)
+        if(w.first == name) return w.second;
+      throw std::runtime_error("no weight " + name);
+    }
+
+    static void activate(const std::string& activation, Value& v) {
+      if(activation == "relu")
+        for(auto& x: v.x) x = std::max(x, 0.f);
+      else if(activation == "sigmoid")
+        for(auto& x: v.x) x = 1.f/(1.f + std::exp(-x));
+      else if(activation == "softmax")
+        for(size_t i=0; i<v.x.size(); i+=v.n) {
+          double sum = 0;
+          for(unsigned int o=0; o<v.n; ++o) sum += std::exp(v.x[i+o]);
+          for(unsigned int o=0; o<v.n; ++o) v.x[i+o] = std::exp(v.x[i+o])/sum;
+        }
+    }
+
+    static Value reference(const KerasLayer& layer, const Value& x, const Value *other) {
+      Value y;
+      const int n = x.size;
+      if(layer.type == "Conv2D") {
+        const auto& w = weight(layer, "kernel").values;
+        const auto& b = weight(layer, "bias").values;
+        const int k = layer.size, before = (k-1)/2;
+        y.size = n;
+        y.n = layer.n;
+        y.x.assign(n*n*y.n, 0.f);
+        for(int r=0; r<n; ++r)
+          for(int c=0; c<n; ++c)
+            for(unsigned int o=0; o<y.n; ++o) {
+              double sum = b[o];
+              for(int dy=0; dy<k; ++dy)
+                for(int dx=0; dx<k; ++dx) {
+                  const int rr = r+dy-before, cc = c+dx-before;
+                  if(rr < 0 || rr >= n || cc < 0 || cc >= n) continue;
+                  for(unsigned int i=0; i<x.n; ++i) sum += x.x[(rr*n+cc)*x.n + i]*w[((dy*k+dx)*x.n + i)*y.n + o];
+                }
+              y.x[(r*n+c)*y.n + o] = sum;
+            }
+        activate(layer.activation, y);
+      }
+      else if(layer.type == "MaxPooling2D") {
+        const int s = layer.size, m = (n+s-1)/s, before = (m*s-n)/2;
+        y.size = m;
+        y.n = x.n;
+        y.x.assign(m*m*y.n, 0.f);
+        for(int r=0; r<m; ++r)
+          for(int c=0; c<m; ++c)
+            for(unsigned int i=0; i<y.n; ++i) {
+              float best = -1e30f;
+              for(int dy=0; dy<s; ++dy)
+                for(int dx=0; dx<s; ++dx) {
+                  const int rr = r*s+dy-before, cc = c*s+dx-before;
+                  if(rr >= 0 && rr < n && cc >= 0 && cc < n) best = std::max(best, x.x[(rr*n+cc)*x.n + i]);
+                }
+              y.x[(r*m+c)*y.n + i] = best;
+            }
+      }
+      else if(layer.type == "Dense") {
+        const auto& w = weight(layer, "kernel").values;
+        const auto& b = weight(layer, "bias").values;
+        y.n = layer.n;
+        y.x.assign(y.n, 0.f);
+        for(unsigned int o=0; o<y.n; ++o) {
+          double sum = b[o];
+          for(unsigned int i=0; i<x.n; ++i) sum += x.x[i]*w[i*y.n + o];
+          y.x[o] = sum;
+        }
+        activate(layer.activation, y);
+      }
+      else if(layer.type == "BatchNormalization") {
+        const auto& gamma = weight(layer, "gamma").values;
+        const auto& beta = weight(layer, "beta").values;
+        const auto& mean = weight(layer, "moving_mean").values;
+        const auto& variance = weight(layer, "moving_variance").values;
+        y = x;
+        for(size_t i=0; i<y.x.size(); ++i) {
+          const unsigned int c = i % y.n;
+          y.x[i] = (x.x[i] - mean[c])/std::sqrt(variance[c] + 1e-3)*gamma[c] + beta[c];
+        }
+      }
+      else if(layer.type == "Flatten") {
+        y.n = x.size*x.size*x.n;
+        y.x = x.x;
+      }
+      else if(layer.type == "Concatenate") {
+        y.n = x.n + other->n;
+        y.x = x.x;
+        y.x.insert(y.x.end(), other->x.begin(), other->x.end());
+      }
+      else {
+        // Dropout, Activation
+        y = x;
+        activate(layer.activation, y);
+      }
+      return y;
+    }
+
+    std::mt19937& gen_;
+    std::vector<KerasLayer> layers_;
+    std::map<std::string, Value> values_;
+  };
+
+  bool check(const char *name, std::mt19937& gen, const Model& model, const std::string& json, bool doubleEncoded,
+             bool full, unsigned int padSize, unsigned int channels, unsigned int infoSize) {
+    const std::string jsonFile = std::string("testDoubletCNNKeras_") + name + ".json";
+    const std::string h5File = std::string("testDoubletCNNKeras_") + name + ".h5";
+    const std::string textFile = std::string("testDoubletCNNKeras_") + name + ".txt";
+    {
+      std::ofstream out(jsonFile);
+      if(doubleEncoded) {
+        // json.dump(model.to_json(), f)
+        std::string escaped;
+        for(char c: json) {
+          if(c == '"' || c == '\\') escaped += '\\';
+          escaped += c;
+        }
+        out << '"' << escaped << '"';
+      }
+      else out << json;
+    }
+    model.h5(h5File, full);
+
+    const DoubletCNN cnn = DoubletCNN::fromKeras(jsonFile, h5File);
+    cnn.write(textFile);
+    const DoubletCNN text(textFile);
+
+    const unsigned int doublets = 40;
+    std::uniform_int_distribution<unsigned int> layer(0, std::max(channels/2, 1u) - 1);
+    std::uniform_int_distribution<unsigned int> pixel(0, padSize*padSize - 1);
+    std::uniform_real_distribution<float> value(-1.5f, 3.f);
+    DoubletCNN::Input input(cnn, doublets);
+    std::vector<std::map<std::string, Value> > inputs(doublets);
+    for(unsigned int i=0; i<doublets; ++i) {
+      Value image{padSize, channels, std::vector<float>(padSize*padSize*channels, 0.f)};
+      for(unsigned int j=0; j<2 && channels > 0; ++j) {
+        const unsigned int channel = j*channels/2 + layer(gen);
+        input.setChannel(i, j, channel);
+        float *pad = input.pad(i, j);
+        std::fill(pad, pad + padSize*padSize, 0.f);
+        if(i % 4 == 0)
+          for(unsigned int p=0; p<padSize*padSize; ++p) pad[p] = value(gen);
+        else
+          for(int k=0; k<6; ++k) pad[pixel(gen)] = value(gen);
+        for(unsigned int p=0; p<padSize*padSize; ++p) image.x[p*channels + channel] = pad[p];
+      }
+      Value info{0, infoSize, std::vector<float>(infoSize)};
+      for(auto& v: info.x) v = value(gen);
+      std::copy(info.x.begin(), info.x.end(), input.info(i));
+      if(channels > 0) inputs[i]["hit_shape_input"] = image;
+      inputs[i]["info_input"] = info;
+    }
+
+    std::vector<float> outputs, textOutputs;
+    cnn(input, outputs);
+    text(input, textOutputs);
+    for(unsigned int i=0; i<doublets; ++i) {
+      const Value expected = model.evaluate(inputs[i]);
+      for(unsigned int o=0; o<cnn.outputs(); ++o) {
+        const float v = outputs[i*cnn.outputs() + o], e = expected.x[o];
+        if(std::abs(v - e) > 2e-4f*std::max(1.f, std::abs(e)) || textOutputs[i*cnn.outputs() + o] != v) {
+          std::printf("%s: doublet %u output %u is %g (text %g), expected %g\n", name, i, o, v, textOutputs[i*cnn.outputs() + o], e);
+          return false;
+        }
+      }
+    }
+    std::remove(jsonFile.c_str());
+    std::remove(h5File.c_str());
+    std::remove(textFile.c_str());
+    std::printf("%s: %u layers, %u doublets OK\n", name, unsigned(cnn.layers().size()), doublets);
+    return true;
+  }
+
+  void print(const DoubletCNN& cnn) {
+    static const char *const types[] = {"conv", "maxpool", "dense"};
+    std::printf("input %u x %u x %u, %u features\n", cnn.padSize(), cnn.padSize(), cnn.channels(), cnn.infoSize());
+    for(const auto& layer: cnn.layers())
+      std::printf("  %-7s %2u %4u -> %4u%s\n", types[layer.type], layer.size, layer.nin, layer.nout, layer.scale.empty() ? "" : " + affine");
+  }
+
+}
+
+int main(int argc, char **argv) {
+  try {
+    if(argc == 3) {
+      print(DoubletCNN::fromKeras(argv[1], argv[2]));
+      return 0;
+    }
+
+    std::mt19937 gen(2018);
+
+    // as adam_small_doublet_model, smaller, with the normalizations in all the places
+    Model layerMap(gen);
+    {
+      std::string x = layerMap.input(10, 6, "hit_shape_input");
+      x = layerMap.same("Dropout", x);
+      x = layerMap.conv(x, 4, 8, "relu");
+      x = layerMap.conv(x, 3, 8, "relu");
+      x = layerMap.batchNorm(x, 0.5f, 1.5f);      // positive scales: after the pooling
+      x = layerMap.maxpool(x, 2);
+      x = layerMap.conv(x, 3, 6, "linear");
+      x = layerMap.batchNorm(x, -1.5f, 1.5f);     // in the weights
+      x = layerMap.same("Activation", x, "relu");
+      x = layerMap.conv(x, 2, 6, "relu");
+      x = layerMap.batchNorm(x, -1.5f, 1.5f);     // negative scales: kept before the pooling
+      x = layerMap.maxpool(x, 2);
+      x = layerMap.flatten(x);
+      std::string info = layerMap.input(0, 5, "info_input");
+      info = layerMap.batchNorm(info, 0.5f, 1.5f);
+      x = layerMap.concatenate(x, info);
+      x = layerMap.batchNorm(x, 0.5f, 1.5f);      // in the next dense
+      x = layerMap.dense(x, 12, "relu");
+      x = layerMap.same("Dropout", x);
+      x = layerMap.batchNorm(x, -1.5f, 1.5f);
+      x = layerMap.dense(x, 2, "softmax");
+      if(!check("layerMap", gen, layerMap, layerMap.json({"hit_shape_input", "info_input"}, x), true, true, 10, 6, 5)) return 1;
+    }
+
+    // as dense_model
+    Model dense(gen);
+    {
+      std::string x = dense.input(6, 4, "hit_shape_input");
+      x = dense.flatten(x);
+      std::string info = dense.input(0, 3, "info_input");
+      x = dense.concatenate(x, info);
+      x = dense.dense(x, 10, "linear");
+      x = dense.batchNorm(x, -1.5f, 1.5f);
+      x = dense.same("Activation", x, "relu");
+      x = dense.dense(x, 1, "sigmoid");
+      x = dense.batchNorm(x, 0.5f, 1.5f);         // after the output
+      if(!check("dense", gen, dense, dense.json({"hit_shape_input", "info_input"}, x), false, false, 6, 4, 3)) return 1;
+    }
+
+    // features only
+    Model info(gen);
+    {
+      std::string x = info.input(0, 7, "info_input");
+      x = info.batchNorm(x, 0.5f, 1.5f);
+      x = info.dense(x, 8, "relu");
+      x = info.dense(x, 2, "softmax");
+      if(!check("info", gen, info, info.json({"info_input"}, x), true, false, 0, 0, 7)) return 1;
+    }
+  }
+  catch(const std::exception& e) {
+    std::printf("exception: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Checks DoubletCellularAutomaton on synthetic layers: straight tracks give
+// their ntuplets through the layer pairs, misaligned combinations do not,
+// the keep mask drops doublets (with fewer cells than doublets), chains
+// longer than maxHits give their outermost maxHits hits and tracks bending
+// more than a ptMin one are not connected.
+
+#include "RecoTracker/TkHitPairs/interface/DoubletCellularAutomaton.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+  int failures = 0;
+
+  void check(bool ok, const char *what) {
+    if(!ok) {
+      std::printf("FAILED: %s\n", what);
+      ++failures;
+    }
+  }
+
+  const float radii[] = {4.f, 7.f, 11.f, 16.f, 20.f};
+  const unsigned int nLayers = 5;
+  const float ptMin = 0.9f, invBz = 87.8f, thetaCut = 0.002f; // 3.8 T
+
+  // hit of a straight track from the origin
+  RecHitsSortedInPhi::HitGlobalState trackHit(float r, float phi, float cotTheta) {
+    return RecHitsSortedInPhi::HitGlobalState{r*std::cos(phi), r*std::sin(phi), r*cotTheta, 0.01f, 0.01f, 0.01f};
+  }
+
+  // hit of a track from the origin bending on a circle of the given radius
+  RecHitsSortedInPhi::HitGlobalState curvedHit(float r, float phi, float radius, float cotTheta) {
+    return trackHit(r, phi + std::asin(0.5f*r/radius), cotTheta);
+  }
+
+  struct Event {
+    std::vector<std::vector<RecHitsSortedInPhi::HitGlobalState> > hits;
+    std::vector<std::unique_ptr<RecHitsSortedInPhi> > maps;
+    std::vector<std::unique_ptr<HitDoublets> > doublets;
+
+    Event(): hits(nLayers) {}
+
+    void addTrack(float phi, float cotTheta, unsigned int firstLayer, unsigned int lastLayer) {
+      for(unsigned int l=firstLayer; l<=lastLayer; ++l) hits[l].push_back(trackHit(radii[l], phi, cotTheta));
+    }
+
+    void addCurvedTrack(float phi, float radius, float cotTheta, unsigned int firstLayer, unsigned int lastLayer) {
+      for(unsigned int l=firstLayer; l<=lastLayer; ++l) hits[l].push_back(curvedHit(radii[l], phi, radius, cotTheta));
+    }
+
+    // all the combinations of the hits of consecutive layers
+    std::vector<const HitDoublets *> build() {
+      for(const auto& layer: hits)
+        maps.emplace_back(std::make_unique<RecHitsSortedInPhi>(layer, GlobalPoint(0, 0, 0), true));
+      std::vector<const HitDoublets *> result;
+      for(unsigned int l=0; l+1<nLayers; ++l) {
+        doublets.emplace_back(std::make_unique<HitDoublets>(*maps[l], *maps[l+1]));
+        for(unsigned int i=0; i<maps[l]->size(); ++i)
+          for(unsigned int o=0; o<maps[l+1]->size(); ++o) doublets.back()->add(i, o);
+        result.push_back(doublets.back().get());
+      }
+      return result;
+    }
+  };
+
+  // ntuplets as layer numbers from 1 (from the hit radii), e.g. 234 for the layers 1, 2, 3
+  std::vector<int> layerCodes(const DoubletCellularAutomaton& ca, const std::vector<DoubletCellularAutomaton::Ntuplet>& ntuplets) {
+    std::vector<int> result;
+    for(const auto& ntuplet: ntuplets) {
+      int code = 0;
+      for(unsigned int i=0; i<ntuplet.nHits; ++i) {
+        unsigned int l = 0;
+        while(l < nLayers && std::abs(ca.r(ntuplet.hits[i]) - radii[l]) > 1e-3f) ++l;
+        code = 10*code + l+1;
+      }
+      result.push_back(code);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  std::vector<int> run(DoubletCellularAutomaton& ca, const std::vector<const HitDoublets *>& layerPairs, const std::vector<bool> *keep,
+                       unsigned int& doubletOffset, unsigned int minHits, unsigned int maxHits) {
+    std::vector<DoubletCellularAutomaton::Ntuplet> ntuplets;
+    ca.build(layerPairs, keep, doubletOffset);
+    ca.connect(ptMin, invBz, thetaCut);
+    ca.evolve();
+    ca.findNtuplets(minHits, maxHits, ntuplets);
+    return layerCodes(ca, ntuplets);
+  }
+
+  void checkKeep() {
+    Event event;
+    event.addTrack(0.5f, 0.5f, 0, 3);   // quadruplet 1234
+    event.addTrack(2.0f, -1.0f, 0, 2);  // triplet 123
+    // misaligned hits, in RZ and in phi
+    for(unsigned int l=0; l<nLayers; ++l) event.hits[l].push_back(trackHit(radii[l], -2.f + 0.7f*l, l%2 ? 2.f : -2.f));
+    const auto layerPairs = event.build();
+
+    unsigned int ndoublets = 0;
+    for(const auto *doublets: layerPairs) ndoublets += doublets->size();
+
+    DoubletCellularAutomaton ca;
+    unsigned int offset = 0;
+    check(run(ca, layerPairs, nullptr, offset, 3, 4) == std::vector<int>({123, 1234}), "all the doublets");
+    check(offset == ndoublets && ca.nCells() == ndoublets, "cells without keep");
+
+    // two regions: all the doublets in the first one, in the second only
+    // the ones of the quadruplet but its innermost doublet
+    std::vector<bool> keep(2*ndoublets, true);
+    unsigned int k = ndoublets;
+    for(const auto *doublets: layerPairs) {
+      const auto& inner = doublets->innerLayer();
+      const auto& outer = doublets->outerLayer();
+      for(size_t i=0; i<doublets->size(); ++i, ++k) {
+        const float phiIn = inner.phi(doublets->innerHitId(i)), phiOut = outer.phi(doublets->outerHitId(i));
+        const bool quadruplet = std::abs(phiIn-0.5f) < 1e-3f && std::abs(phiOut-0.5f) < 1e-3f;
+        keep[k] = quadruplet && doublets != layerPairs[0];
+      }
+    }
+    offset = 0;
+    check(run(ca, layerPairs, &keep, offset, 3, 4) == std::vector<int>({123, 1234}), "keep, all the doublets");
+    check(run(ca, layerPairs, &keep, offset, 3, 4) == std::vector<int>({234}), "keep, dropped doublets");
+    check(offset == 2*ndoublets && ca.nCells() == 2, "cells with keep");
+  }
+
+  void checkLongChain() {
+    Event event;
+    event.addTrack(1.f, 0.3f, 0, 4);   // 5 hits, e.g. BPix1-4 and FPix1
+    event.addTrack(-1.f, 0.8f, 1, 3);  // triplet 234
+    const auto layerPairs = event.build();
+
+    DoubletCellularAutomaton ca;
+    unsigned int offset = 0;
+    check(run(ca, layerPairs, nullptr, offset, 3, 4) == std::vector<int>({234, 2345}), "5 hit chain, maxHits 4");
+    offset = 0;
+    check(run(ca, layerPairs, nullptr, offset, 3, 3) == std::vector<int>({234, 345}), "5 hit chain, maxHits 3");
+    offset = 0;
+    check(run(ca, layerPairs, nullptr, offset, 4, 4) == std::vector<int>({2345}), "5 hit chain, minHits 4");
+  }
+
+  void checkCurvature() {
+    // bending radius of a ptMin track
+    const float minRadius = ptMin*invBz;
+    Event event;
+    event.addCurvedTrack(0.3f, 0.25f*minRadius, 0.4f, 0, 2);  // pt 0.225 GeV, kinked in phi
+    event.addCurvedTrack(-2.f, 10.f*minRadius, -0.6f, 0, 2);  // pt 9 GeV
+    const auto layerPairs = event.build();
+
+    DoubletCellularAutomaton ca;
+    unsigned int offset = 0;
+    check(run(ca, layerPairs, nullptr, offset, 3, 3) == std::vector<int>({123}), "curvature cut");
+
+    Event highPt;
+    highPt.addCurvedTrack(0.3f, 1.2f*minRadius, 0.4f, 0, 2);  // pt 1.08 GeV
+    offset = 0;
+    check(run(ca, highPt.build(), nullptr, offset, 3, 3) == std::vector<int>({123}), "curvature cut, above ptMin");
+  }
+}
+
+int main() {
+  checkKeep();
+  checkLongChain();
+  checkCurvature();
+  if(failures) return 1;
+  std::printf("testDoubletCellularAutomaton: OK\n");
+  return 0;
+}
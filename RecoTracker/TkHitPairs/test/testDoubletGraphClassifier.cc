@@ -0,0 +1,200 @@
+// Checks DoubletGraphClassifier on a tiny graph (5 hits, 5 doublets, one
+// across phi = pi): with only biases the scores are the closed form
+// sigmoid(edgeOutput(tanh(edgeHidden biases))), with known weights and 2
+// iterations they are compared with a scalar reference written edge by edge
+// and node by node; malformed weight files must throw.
+
+#include "RecoTracker/TkHitPairs/interface/DoubletGraphClassifier.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+  int failures = 0;
+
+  void check(bool ok, const char *what) {
+    if(!ok) {
+      std::printf("FAILED: %s\n", what);
+      ++failures;
+    }
+  }
+
+  // the graph, edges grouped by inner node as in DoubletGraph
+  const std::vector<float> r   = {4.f, 4.f, 7.f, 7.f, 11.f};
+  const std::vector<float> phi = {0.1f, 3.1f, 0.12f, -3.12f, 0.15f};
+  const std::vector<float> z   = {1.f, -2.f, 1.8f, -3.5f, 2.9f};
+  const std::vector<unsigned int> edgeOffsets = {0, 2, 3, 4, 5, 5};
+  const std::vector<unsigned int> innerNodes  = {0, 0, 1, 2, 3};
+  const std::vector<unsigned int> outerNodes  = {2, 3, 3, 4, 4};
+  const double scales[3] = {10., M_PI, 20.};
+
+  struct Layer {
+    unsigned int nin, nout;
+    std::vector<double> weights;  // nout x nin
+    std::vector<double> biases;
+
+    Layer(unsigned int id, unsigned int in, unsigned int out, bool biasesOnly): nin(in), nout(out) {
+      for(unsigned int o=0; o<nout; ++o) {
+        for(unsigned int f=0; f<nin; ++f)
+          weights.push_back(biasesOnly ? 0. : 0.5*std::sin(1.3*id + 0.7*o + 0.37*f));
+        biases.push_back(0.3*std::cos(2.1*id + 0.9*o));
+      }
+    }
+
+    std::vector<double> operator()(const std::vector<double>& in, bool sigmoid) const {
+      std::vector<double> out(nout);
+      for(unsigned int o=0; o<nout; ++o) {
+        double sum = biases[o];
+        for(unsigned int f=0; f<nin; ++f) sum += weights[o*nin+f]*in[f];
+        out[o] = sigmoid ? 1./(1.+std::exp(-sum)) : std::tanh(sum);
+      }
+      return out;
+    }
+  };
+
+  struct Model {
+    unsigned int hidden, iterations;
+    Layer nodeEncoder, edgeHidden, edgeOutput, nodeHidden;
+
+    Model(unsigned int h, unsigned int n, bool biasesOnly):
+      hidden(h), iterations(n),
+      nodeEncoder(0, 3, h, biasesOnly), edgeHidden(1, 2*h+3, h, biasesOnly),
+      edgeOutput(2, h, 1, biasesOnly), nodeHidden(3, 3*h+3, h, biasesOnly) {}
+
+    void write(const std::string& fileName) const {
+      std::ofstream out(fileName);
+      out.precision(9);
+      out << "DoubletGraphClassifier 1\nhidden " << hidden << " iterations " << iterations << "\n";
+      out << "scales " << scales[0] << " " << scales[1] << " " << scales[2] << "\n";
+      for(const Layer *layer: {&nodeEncoder, &edgeHidden, &edgeOutput, &nodeHidden}) {
+        out << "dense " << layer->nin << " " << layer->nout << "\n";
+        for(double w: layer->weights) out << w << " ";
+        out << "\n";
+        for(double b: layer->biases) out << b << " ";
+        out << "\n";
+      }
+    }
+
+    std::vector<double> nodeFeatures(unsigned int i) const {
+      return {r[i]/scales[0], phi[i]/scales[1], z[i]/scales[2]};
+    }
+
+    std::vector<double> edgeFeatures(unsigned int k) const {
+      const unsigned int i = innerNodes[k], o = outerNodes[k];
+      double dphi = double(phi[o]) - double(phi[i]);
+      if(dphi > M_PI) dphi -= 2*M_PI;
+      if(dphi < -M_PI) dphi += 2*M_PI;
+      return {(double(r[o])-r[i])/scales[0], dphi/scales[1], (double(z[o])-z[i])/scales[2]};
+    }
+
+    std::vector<double> edgeWeights(const std::vector<std::vector<double> >& nodes) const {
+      std::vector<double> result;
+      for(unsigned int k=0; k<outerNodes.size(); ++k) {
+        std::vector<double> in = nodes[innerNodes[k]];
+        in.insert(in.end(), nodes[outerNodes[k]].begin(), nodes[outerNodes[k]].end());
+        const auto features = edgeFeatures(k);
+        in.insert(in.end(), features.begin(), features.end());
+        result.push_back(edgeOutput(edgeHidden(in, false), true)[0]);
+      }
+      return result;
+    }
+
+    std::vector<double> scores() const {
+      std::vector<std::vector<double> > nodes;
+      for(unsigned int i=0; i<r.size(); ++i) nodes.push_back(nodeEncoder(nodeFeatures(i), false));
+      for(unsigned int iteration=0; iteration<iterations; ++iteration) {
+        const auto weights = edgeWeights(nodes);
+        std::vector<std::vector<double> > next;
+        for(unsigned int i=0; i<nodes.size(); ++i) {
+          std::vector<double> fromInner(hidden, 0.), fromOuter(hidden, 0.);
+          for(unsigned int k=0; k<outerNodes.size(); ++k) {
+            for(unsigned int f=0; f<hidden; ++f) {
+              if(outerNodes[k] == i) fromInner[f] += weights[k]*nodes[innerNodes[k]][f];
+              if(innerNodes[k] == i) fromOuter[f] += weights[k]*nodes[outerNodes[k]][f];
+            }
+          }
+          std::vector<double> in = nodes[i];
+          in.insert(in.end(), fromInner.begin(), fromInner.end());
+          in.insert(in.end(), fromOuter.begin(), fromOuter.end());
+          const auto features = nodeFeatures(i);
+          in.insert(in.end(), features.begin(), features.end());
+          next.push_back(nodeHidden(in, false));
+        }
+        nodes = next;
+      }
+      return edgeWeights(nodes);
+    }
+  };
+
+  std::vector<float> classify(const std::string& fileName) {
+    const DoubletGraphClassifier classifier(fileName);
+    std::vector<float> scores;
+    classifier(r, phi, z, edgeOffsets, innerNodes, outerNodes, scores);
+    return scores;
+  }
+
+  bool close(const std::vector<float>& scores, const std::vector<double>& reference) {
+    if(scores.size() != reference.size()) return false;
+    for(unsigned int k=0; k<scores.size(); ++k) {
+      if(std::abs(scores[k] - reference[k]) > 1e-5) {
+        std::printf("edge %u: score %.7f, reference %.7f\n", k, scores[k], reference[k]);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool throws(const std::string& fileName, const std::string& content) {
+    std::ofstream(fileName) << content;
+    try {
+      DoubletGraphClassifier classifier(fileName);
+    }
+    catch(const cms::Exception&) {
+      return true;
+    }
+    return false;
+  }
+}
+
+int main() {
+  const std::string fileName = "testDoubletGraphClassifier.txt";
+
+  // only biases: every edge gets sigmoid(wOut.tanh(bHidden) + bOut), wOut = 0 too
+  const Model biases(2, 2, true);
+  biases.write(fileName);
+  const double constant = 1./(1.+std::exp(-biases.edgeOutput.biases[0]));
+  check(close(classify(fileName), std::vector<double>(outerNodes.size(), constant)), "biases only");
+
+  const Model model(2, 2, false);
+  model.write(fileName);
+  const auto scores = classify(fileName);
+  check(close(scores, model.scores()), "2 iterations, hidden 2");
+  // the node states must matter, the fake 0 -> 3 has the features of the wrap 1 -> 3 but in z
+  check(scores.size() == 5 && std::abs(scores[1] - scores[2]) > 1e-4, "edges to the same outer node differ");
+
+  const Model deeper(3, 4, false);
+  deeper.write(fileName);
+  check(close(classify(fileName), deeper.scores()), "4 iterations, hidden 3");
+
+  // empty graph
+  {
+    const DoubletGraphClassifier classifier(fileName);
+    std::vector<float> empty(3, 1.f);
+    classifier({}, {}, {}, {0}, {}, {}, empty);
+    check(empty.empty(), "empty graph");
+  }
+
+  check(throws(fileName, "DoubletGraphClassifier 2\nhidden 2 iterations 2\nscales 1 1 1\n"), "version");
+  check(throws(fileName, "DoubletGraphClassifier 1\nhidden 2 iterations 2\nscales 1 1 1\ndense 3 3\n"), "layer size");
+  check(throws(fileName, "DoubletGraphClassifier 1\nhidden 2 iterations 2\nscales 1 1 1\ndense 3 2\n0 0 0\n"), "truncated");
+  check(throws("does/not/exist.txt", ""), "missing file");
+  std::remove(fileName.c_str());
+
+  if(failures) return 1;
+  std::printf("testDoubletGraphClassifier: OK\n");
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Checks the DoubletPrefilter features, decisions and cut file parsing.
+
+#include "RecoTracker/TkHitPairs/interface/DoubletPrefilter.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace {
+  int failures = 0;
+
+  void check(bool ok, const char *what) {
+    if(!ok) {
+      std::printf("FAILED: %s\n", what);
+      ++failures;
+    }
+  }
+
+  bool close(float a, float b) { return std::abs(a-b) <= 1e-5f*std::max(1.f, std::abs(b)); }
+
+  std::string writeCuts(const char *name, const char *text) {
+    const std::string fileName = std::string("testDoubletPrefilter_") + name + ".txt";
+    std::ofstream(fileName) << text;
+    return fileName;
+  }
+
+  bool throws(const char *name, const char *text) {
+    try {
+      DoubletPrefilter prefilter(writeCuts(name, text));
+    } catch(cms::Exception&) {
+      return true;
+    }
+    return false;
+  }
+
+  void checkFeatures() {
+    const DoubletPrefilter::HitFeatures inner{4.f, 3.f, 2.f, 3.f, 20000.f, 1.5f}, outer{7.f, -3.f, 5.f, 5.f, 26000.f, 2.f};
+    const auto x = DoubletPrefilter::features(inner, outer);
+    check(close(x[DoubletPrefilter::deltaA], 2.f), "deltaA");
+    check(close(x[DoubletPrefilter::deltaADC], 6000.f), "deltaADC");
+    check(close(x[DoubletPrefilter::deltaS], 0.5f), "deltaS");
+    check(close(x[DoubletPrefilter::deltaR], 3.f), "deltaR");
+    check(close(x[DoubletPrefilter::deltaPhi], float(-6 + 2*M_PI)), "deltaPhi wrapped across -pi/pi");
+    check(close(x[DoubletPrefilter::deltaZ], 3.f), "deltaZ");
+    check(close(x[DoubletPrefilter::zZero], -2.f), "zZero");
+
+    const DoubletPrefilter::HitFeatures sameR{4.f, 3.1f, 9.f, 0.f, 0.f, 0.f};
+    check(close(DoubletPrefilter::features(inner, sameR)[DoubletPrefilter::zZero], 2.f), "zZero with deltaR = 0");
+  }
+
+  void checkCuts() {
+    DoubletPrefilter prefilter(writeCuts("cuts",
+      "# comment line\n"
+      "reject BPix1 BPix2 deltaPhi -0.1 0.1\n"
+      "reject BPix1 BPix2 zZero -20 20   # trailing comment\n"
+      "accept BPix1 BPix2 zZero -5 5\n"
+      "accept BPix1 BPix2 deltaA -1 1\n"
+      "\n"
+      "reject * * deltaPhi -0.3 0.3\n"));
+
+    const auto *pair = prefilter.cuts("BPix1", "BPix2");
+    const auto *fallback = prefilter.cuts("BPix2", "BPix3");
+    check(pair && pair->reject.size() == 2 && pair->accept.size() == 2, "layer pair cuts");
+    check(fallback && fallback != pair && fallback->reject.size() == 1 && fallback->accept.empty(), "* * cuts");
+
+    DoubletPrefilter::Features x{};
+    check(pair->decide(x) == DoubletPrefilter::accept, "inside all the cuts accepted");
+    x[DoubletPrefilter::deltaA] = 2;
+    check(pair->decide(x) == DoubletPrefilter::ambiguous, "outside an accept cut ambiguous");
+    x[DoubletPrefilter::zZero] = 30;
+    check(pair->decide(x) == DoubletPrefilter::reject, "outside a reject cut rejected");
+    x = DoubletPrefilter::Features{};
+    x[DoubletPrefilter::deltaPhi] = 0.1f;
+    check(pair->decide(x) == DoubletPrefilter::accept, "cut windows closed");
+    x[DoubletPrefilter::deltaPhi] = 0.2f;
+    check(pair->decide(x) == DoubletPrefilter::reject, "layer pair cuts instead of * *");
+    check(fallback->decide(x) == DoubletPrefilter::ambiguous, "no accept cuts ambiguous");
+
+    DoubletPrefilter noFallback(writeCuts("noFallback", "accept BPix1 BPix2 deltaR 0 10\n"));
+    check(noFallback.cuts("BPix1", "BPix2") != nullptr, "cuts without * *");
+    check(noFallback.cuts("BPix2", "BPix3") == nullptr, "no cuts without * *");
+
+    check(throws("type", "keep BPix1 BPix2 deltaR 0 10\n"), "unknown cut type");
+    check(throws("feature", "reject BPix1 BPix2 deltaX 0 10\n"), "unknown feature");
+    check(throws("columns", "reject BPix1 BPix2 deltaR 0\n"), "missing max");
+    check(throws("window", "reject BPix1 BPix2 deltaR 10 0\n"), "empty window");
+    check(throws("star", "reject * BPix2 deltaR 0 10\n"), "* for one layer only");
+    try {
+      DoubletPrefilter missing("testDoubletPrefilter_missing.txt");
+      check(false, "missing file");
+    } catch(cms::Exception&) {}
+  }
+}
+
+int main() {
+  checkFeatures();
+  checkCuts();
+  if(failures) return 1;
+  std::printf("testDoubletPrefilter: OK\n");
+  return 0;
+}
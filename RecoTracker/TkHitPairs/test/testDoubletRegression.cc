@@ -0,0 +1,324 @@
+// Differential regression test of the doublet search: the doublets of the
+// production kernel (hitPairKernels::addDoublets, run on the recorded
+// windows by hitPairRecord::doublets as by HitPairGeneratorFromLayerPair)
+// and, for recorded files, the doublets found online by
+// HitPairGeneratorFromLayerPair::doublets are compared for every layer pair
+// with a brute force reference, which checks every inner hit against the
+// phi window of every outer hit.
+//
+// usage: testDoubletRegression [file ...]
+//
+// With files recorded by HitPairEDProducer (recordFile parameter) the
+// recorded inputs are used, otherwise synthetic events covering the corner
+// cases (phi wrap-around, window edges at a hit, reversed RZ windows, empty
+// layers, maxElement overflow) are generated, so that the test runs in scram
+// b runtests.
+// The (inner, outer) lists are compared exactly and in order: outer hits in
+// order, for each the inner hits in phi from the low edge of its window.
+// The only exception are the phi-wrap boundary hits of the windows crossing
+// phi = +-pi, whose edges are shifted by 2 pi in float: inner hits within
+// the rounding of the shifted edges or at phi = +-pi may be found or not and
+// in either order, they are flagged, left out of the comparison and counted
+// separately. Without maxElement the search must give the reference; above
+// maxElement the doublets must be cleared, or with the keepBest policy of
+// the layer pair (maxElementOverflow) be the maxElement doublets of the
+// unbounded search with the lowest residual, ties to the earlier ones, in
+// their order. The first mismatch is reported with its context and the test
+// fails.
+
+#include "RecoTracker/TkHitPairs/interface/HitPairRecord.h"
+#include "RecoTracker/TkHitPairs/interface/HitPairKernels.h"
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+  typedef std::vector<std::pair<int,int> > Doublets;
+
+  // tolerance on the phi-wrap boundaries, a few float ulps at phi = pi
+  constexpr double phiTolerance = 2e-6;
+
+  /** -1 outside, 0 at a phi-wrap boundary, 1 inside the phi window; offset is the distance
+   *  in phi of the hit from the low edge of the window, in [0, 2 pi)
+   */
+  int referencePhi(const hitPairRecord::Window& w, float phi, double& offset) {
+    offset = double(phi) - double(w.phiMin);
+    offset -= 2*M_PI*std::floor(offset/(2*M_PI));
+    if (w.phiMin < w.phiMax && w.phiMin >= -M_PI && w.phiMax <= M_PI)
+      return w.phiMin <= phi && phi <= w.phiMax ? 1 : -1;
+
+    // the window crosses phi = +-pi (phiMax < phiMin is a window given across it)
+    const double phiMax = w.phiMax > w.phiMin ? double(w.phiMax) : double(w.phiMax) + 2*M_PI;
+    const double center = 0.5*(double(w.phiMin)+phiMax);
+    const double halfWidth = 0.5*(phiMax-double(w.phiMin));
+    const double dphi = std::abs(std::remainder(double(phi) - center, 2*M_PI));
+    if (std::abs(dphi-halfWidth) <= phiTolerance) return 0;
+    if (dphi < halfWidth && M_PI - std::abs(double(phi)) <= phiTolerance) return 0;
+    return dphi < halfWidth ? 1 : -1;
+  }
+
+  bool referenceRZ(const hitPairRecord::Window& w, const RecHitsSortedInPhi& hits, int i) {
+    const float u = hits.u[i];
+    const float lo = w.lo0+w.lo1*u, hi = w.hi0+w.hi1*u;
+    const float vErr = hitPairKernels::nSigmaRZ*hits.dv[i];
+    return std::max(lo, hits.v[i]-vErr) <= std::min(hi, hits.v[i]+vErr);
+  }
+
+  /// doublets in the order of the search and the flagged ones at a phi-wrap boundary (sorted), without maxElement
+  struct Reference {
+    Doublets doublets, boundary;
+  };
+
+  Reference reference(const RecHitsSortedInPhi& inner, const RecHitsSortedInPhi& outer,
+                      const std::vector<hitPairRecord::Window>& windows) {
+    Reference result;
+    if (inner.empty() || outer.empty()) return result;
+    std::vector<std::pair<double,int> > found;
+    for (int io=0; io!=int(outer.size()); ++io) {
+      const auto& w = windows[io];
+      if (w.skipped()) continue;
+      found.clear();
+      for (int i=0; i!=int(inner.size()); ++i) {
+        double offset;
+        const int phi = referencePhi(w, inner.phi(i), offset);
+        if (phi < 0 || !referenceRZ(w, inner, i)) continue;
+        if (phi == 0) result.boundary.emplace_back(i, io);
+        else found.emplace_back(offset, i);
+      }
+      std::sort(found.begin(), found.end());
+      for (const auto& f: found) result.doublets.emplace_back(f.second, io);
+    }
+    return result;
+  }
+
+  Doublets list(const HitDoublets& doublets) {
+    Doublets result;
+    for (size_t i=0; i!=doublets.size(); ++i) result.emplace_back(doublets.innerHitId(i), doublets.outerHitId(i));
+    return result;
+  }
+
+  /** the doublets expected with maxElement from the ones of the unbounded search: all, none
+   *  or with keepBest the maxElement of lowest residual, in their order
+   */
+  Doublets bounded(const HitDoublets& all, const std::vector<hitPairRecord::Window>& windows,
+                   unsigned int maxElement, bool keepBest) {
+    if (maxElement == 0 || all.size() <= maxElement) return list(all);
+    if (!keepBest) return Doublets();
+
+    std::vector<float> scores;
+    for (size_t b=0; b!=all.size();) {
+      const int io = all.outerHitId(b);
+      size_t e = b;
+      while (e!=all.size() && all.outerHitId(e) == io) ++e;
+      const auto& w = windows[io];
+      auto range = [&w](float u) { return hitPairKernels::Range(w.lo0+w.lo1*u, w.hi0+w.hi1*u); };
+      HitDoublets group(all.innerLayer(), all.outerLayer());
+      for (size_t i=b; i!=e; ++i) group.add(all.innerHitId(i), io);
+      hitPairKernels::residuals(w.phiMin, w.phiMax, range, 0, group, scores);
+      b = e;
+    }
+    std::vector<size_t> order(all.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&scores](size_t a, size_t b) { return scores[a] < scores[b]; });
+    order.resize(maxElement);
+    std::sort(order.begin(), order.end());
+    Doublets result;
+    for (auto i: order) result.emplace_back(all.innerHitId(i), all.outerHitId(i));
+    return result;
+  }
+
+  bool byOuter(const std::pair<int,int>& a, const std::pair<int,int>& b) {
+    return a.second < b.second || (a.second == b.second && a.first < b.first);
+  }
+
+  /// position of the first difference of the lists, npos if they are equal
+  size_t firstDifference(const Doublets& expected, const Doublets& doublets) {
+    const auto diff = std::mismatch(expected.begin(), expected.end(), doublets.begin(), doublets.end());
+    if (diff.first == expected.end() && diff.second == doublets.end()) return std::string::npos;
+    return diff.first - expected.begin();
+  }
+
+  struct Counters {
+    long long layerPairs = 0, doublets = 0, online = 0, boundary = 0, boundaryFound = 0, failures = 0;
+  };
+
+  void report(const hitPairRecord::Event& event, const hitPairRecord::Region& region, const hitPairRecord::LayerPair& pair,
+              const RecHitsSortedInPhi& inner, const RecHitsSortedInPhi& outer,
+              const char* name, const Doublets& expected, const Doublets& doublets, size_t position) {
+    std::cout << "MISMATCH run " << event.run << " lumi " << event.lumi << " event " << event.event
+              << " layers " << region.layers[pair.inner].index << "," << region.layers[pair.outer].index
+              << " (" << inner.size() << "," << outer.size() << " hits, maxElement " << pair.maxElement
+              << (pair.keepBest ? " keepBest" : "") << ")"
+              << ": expected " << expected.size() << " doublets, " << name << " " << doublets.size()
+              << ", first difference at " << position << std::endl;
+    auto print = [&](const char* what, const Doublets& from) {
+      if (position >= from.size()) {
+        std::cout << "  " << what << ": end of the list" << std::endl;
+        return;
+      }
+      const auto& d = from[position];
+      const auto& w = pair.windows[d.second];
+      std::cout << "  " << what << " (inner " << d.first << ", outer " << d.second << ")"
+                << " inner phi " << inner.phi(d.first) << " u " << inner.u[d.first] << " v " << inner.v[d.first]
+                << " dv " << inner.dv[d.first]
+                << "; outer phi " << outer.phi(d.second) << " window phi [" << w.phiMin << "," << w.phiMax << "]"
+                << " v [" << w.lo0 << "+" << w.lo1 << "*u," << w.hi0 << "+" << w.hi1 << "*u]" << std::endl;
+    };
+    print("expected", expected);
+    print(name, doublets);
+  }
+
+  bool check(const hitPairRecord::Event& event, bool online, Counters& counters) {
+    for (const auto& region: event.regions) {
+      std::vector<std::unique_ptr<RecHitsSortedInPhi> > maps;
+      for (const auto& layer: region.layers)
+        maps.emplace_back(std::make_unique<RecHitsSortedInPhi>(layer.hits, region.origin(), layer.barrel));
+
+      for (const auto& pair: region.layerPairs) {
+        const RecHitsSortedInPhi& inner = *maps.at(pair.inner);
+        const RecHitsSortedInPhi& outer = *maps.at(pair.outer);
+        ++counters.layerPairs;
+
+        // unbounded search against the reference, the flagged boundary doublets left out
+        const Reference ref = reference(inner, outer, pair.windows);
+        HitDoublets all(inner, outer);
+        hitPairRecord::doublets(inner, outer, pair.windows, 0, false, all);
+        Doublets found;
+        for (const auto& d: list(all)) {
+          if (std::binary_search(ref.boundary.begin(), ref.boundary.end(), d, byOuter)) ++counters.boundaryFound;
+          else found.push_back(d);
+        }
+        counters.boundary += ref.boundary.size();
+        size_t position = firstDifference(ref.doublets, found);
+        if (position != std::string::npos) {
+          ++counters.failures;
+          report(event, region, pair, inner, outer, "unbounded", ref.doublets, found, position);
+          return false;
+        }
+
+        // with maxElement and online, exactly
+        const Doublets expected = bounded(all, pair.windows, pair.maxElement, pair.keepBest);
+        HitDoublets result(inner, outer);
+        hitPairRecord::doublets(inner, outer, pair.windows, pair.maxElement, pair.keepBest, result);
+        const Doublets opt = list(result);
+        counters.doublets += opt.size();
+        position = firstDifference(expected, opt);
+        if (position != std::string::npos) {
+          ++counters.failures;
+          report(event, region, pair, inner, outer, "optimized", expected, opt, position);
+          return false;
+        }
+        if (!online) continue;
+        const Doublets& recorded = pair.doublets;
+        counters.online += recorded.size();
+        position = firstDifference(expected, recorded);
+        if (position != std::string::npos) {
+          ++counters.failures;
+          report(event, region, pair, inner, outer, "online", expected, recorded, position);
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  hitPairRecord::Layer syntheticLayer(int index, bool barrel, float pos, int nHits, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uphi(-M_PI, M_PI), uz(-26.7f, 26.7f), ur(4.5f, 16.f);
+    hitPairRecord::Layer layer{index, index, barrel, {}};
+    for (int i=0; i!=nHits; ++i) {
+      // a few hits exactly at the phi boundaries and duplicated in phi
+      float phi = i%50==0 ? float(M_PI) : i%50==1 ? -float(M_PI) : uphi(rng);
+      float r = barrel ? pos : ur(rng);
+      RecHitsSortedInPhi::HitGlobalState hs;
+      hs.x = r*std::cos(phi); hs.y = r*std::sin(phi);
+      hs.z = barrel ? uz(rng) : pos;
+      hs.errorRPhi = 0.0015f;
+      hs.errorR = barrel ? 0.f : 0.0025f;
+      hs.errorZ = barrel ? 0.0025f : 0.f;
+      layer.hits.push_back(hs);
+      if (i%97==0) layer.hits.push_back(hs);
+    }
+    return layer;
+  }
+
+  hitPairRecord::Event syntheticEvent(unsigned long long iev, std::mt19937& rng) {
+    hitPairRecord::Event event{1, 1, iev, {}};
+    hitPairRecord::Region region{0.f, 0.f, 0.f, 0.9f, 0.2f, 15.f, {}, {}};
+    region.layers.push_back(syntheticLayer(0, true, 2.9f, 1500, rng));
+    region.layers.push_back(syntheticLayer(1, true, 6.8f, 1000, rng));
+    region.layers.push_back(syntheticLayer(4, false, 32.f, 400, rng));
+    region.layers.push_back(syntheticLayer(2, true, 10.9f, iev%2 ? 0 : 300, rng)); // sometimes empty
+
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    const std::pair<unsigned int, unsigned int> pairs[] = {{0,1}, {0,2}, {1,2}, {1,3}, {3,1}};
+    for (const auto& lp: pairs) {
+      const auto& inner = region.layers[lp.first];
+      const auto& outer = region.layers[lp.second];
+      hitPairRecord::LayerPair pair{lp.first, lp.second, 0, false, {}, {}};
+      for (const auto& hs: outer.hits) {
+        float phi = std::atan2(hs.y, hs.x);
+        float dphi = 0.01f + 0.1f*uniform(rng);
+        float vo = inner.barrel ? hs.z : std::sqrt(hs.x*hs.x+hs.y*hs.y);
+        float width = 5.f + 20.f*uniform(rng);
+        float x = uniform(rng);
+        if (x < 0.05f) pair.windows.push_back(hitPairRecord::Window::skip());
+        else if (x < 0.1f) pair.windows.push_back(hitPairRecord::Window{phi-dphi, phi+dphi, vo+width, 0.f, vo-width, 0.f}); // reversed
+        else if (x < 0.15f && !inner.hits.empty()) {
+          // phi edges exactly at an inner hit, open in RZ
+          const auto& ih = inner.hits[rng() % inner.hits.size()];
+          const float edge = GlobalPoint(ih.x, ih.y, ih.z).barePhi();
+          if (x < 0.125f) pair.windows.push_back(hitPairRecord::Window{edge, edge+dphi, -1000.f, 0.f, 1000.f, 0.f});
+          else pair.windows.push_back(hitPairRecord::Window{edge-dphi, edge, -1000.f, 0.f, 1000.f, 0.f});
+        }
+        else pair.windows.push_back(hitPairRecord::Window{phi-dphi, phi+dphi, vo-width, 0.1f*uniform(rng), vo+width, -0.1f*uniform(rng)});
+      }
+      region.layerPairs.push_back(pair);
+    }
+    // maxElement overflow and exact limit
+    region.layerPairs.push_back(region.layerPairs[0]);
+    region.layerPairs.back().maxElement = 100;
+    region.layerPairs.push_back(region.layerPairs[2]);
+    region.layerPairs.back().maxElement = 1000000;
+    region.layerPairs.push_back(region.layerPairs[0]);
+    region.layerPairs.back().maxElement = 100;
+    region.layerPairs.back().keepBest = true;
+
+    event.regions.push_back(std::move(region));
+    return event;
+  }
+}
+
+int main(int argc, char ** argv) {
+  Counters counters;
+  bool ok = true;
+  try {
+    hitPairRecord::Event event;
+    for (int i=1; ok && i<argc; ++i) {
+      hitPairRecord::Reader reader(argv[i]);
+      while (ok && reader.read(event)) ok = check(event, true, counters);
+    }
+    if (argc == 1) {
+      std::mt19937 rng(4242);
+      for (unsigned long long iev=0; ok && iev!=10; ++iev) ok = check(syntheticEvent(iev, rng), false, counters);
+    }
+  } catch (cms::Exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::printf("testDoubletRegression: %lld layer pairs, %lld doublets and %lld online doublets compared, %s\n",
+              counters.layerPairs, counters.doublets, counters.online, ok ? "OK" : "FAILED");
+  std::printf("  %lld combinations at a phi-wrap boundary not compared, %lld of them found\n",
+              counters.boundary, counters.boundaryFound);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Checks DuplicateDoublets on overlapping regions: each doublet is kept in
+// the first region producing it, the scores follow the doublets kept and
+// DoubletOwners lists the regions producing each doublet kept.
+
+#include "RecoTracker/TkHitPairs/interface/DuplicateDoublets.h"
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace {
+  int failures = 0;
+
+  void check(bool ok, const char *what) {
+    if(!ok) {
+      std::printf("FAILED: %s\n", what);
+      ++failures;
+    }
+  }
+
+  // the hits of the event, two layers with hits at phi 0.1, 0.2, 0.3 and 0.4;
+  // the maps of the regions have no RecHits, the doublets are keyed by these hit states
+  struct Hits {
+    std::vector<RecHitsSortedInPhi::HitGlobalState> layers[2];
+    std::map<float, const void *> byPhi[2];
+
+    Hits() {
+      for(int l=0; l<2; ++l) {
+        const float r = l == 0 ? 4.f : 7.f;
+        for(int i=1; i<=4; ++i)
+          layers[l].push_back(RecHitsSortedInPhi::HitGlobalState{r*std::cos(0.1f*i), r*std::sin(0.1f*i), 0.f, 0.f, 0.01f, 0.01f});
+      }
+      for(int l=0; l<2; ++l) {
+        for(const auto& hs: layers[l]) byPhi[l][std::atan2(hs.y, hs.x)] = &hs;
+      }
+    }
+
+    // maps of a region seeing the hits from first to last
+    std::unique_ptr<RecHitsSortedInPhi> map(int layer, int first, int last) const {
+      std::vector<RecHitsSortedInPhi::HitGlobalState> hits(layers[layer].begin()+first, layers[layer].begin()+last+1);
+      return std::make_unique<RecHitsSortedInPhi>(hits, GlobalPoint(0, 0, 0), true);
+    }
+
+    // hit number (from 1) of the map hit
+    int number(int layer, const RecHitsSortedInPhi& map, int i) const {
+      const void *hit = byPhi[layer].at(map.phi(i));
+      return static_cast<const RecHitsSortedInPhi::HitGlobalState *>(hit) - &layers[layer][0] + 1;
+    }
+  };
+
+  // doublets as inner and outer hit numbers, e.g. 23
+  std::vector<int> codes(const Hits& hits, const HitDoublets& doublets) {
+    std::vector<int> result;
+    for(size_t i=0; i<doublets.size(); ++i)
+      result.push_back(10*hits.number(0, doublets.innerLayer(), doublets.innerHitId(i)) + hits.number(1, doublets.outerLayer(), doublets.outerHitId(i)));
+    return result;
+  }
+
+  std::vector<unsigned int> owners(const DoubletOwners& owners, unsigned int i) {
+    return std::vector<unsigned int>(owners.regions().begin()+owners.offsets()[i], owners.regions().begin()+owners.offsets()[i+1]);
+  }
+
+  void checkRegions() {
+    const Hits hits;
+    DuplicateDoublets duplicates;
+
+    // regions 0 (hits 1-2), 1 (hits 2-3), 2 (hits 1-3) and 3 (hits 4 only)
+    const int ranges[4][2] = {{0, 1}, {1, 2}, {0, 2}, {3, 3}};
+    std::vector<std::vector<int> > kept;
+    for(unsigned int region=0; region<4; ++region) {
+      auto inner = hits.map(0, ranges[region][0], ranges[region][1]);
+      auto outer = hits.map(1, ranges[region][0], ranges[region][1]);
+      HitDoublets doublets(*inner, *outer);
+      for(unsigned int i=0; i<inner->size(); ++i)
+        for(unsigned int o=0; o<outer->size(); ++o) doublets.add(i, o);
+      std::vector<float> scores;
+      for(size_t i=0; i<doublets.size(); ++i) scores.push_back(codes(hits, doublets)[i]);
+
+      duplicates.remove(doublets, region, [&](size_t i) {
+          return DuplicateDoublets::Key(hits.byPhi[0].at(inner->phi(doublets.innerHitId(i))), hits.byPhi[1].at(outer->phi(doublets.outerHitId(i))));
+        }, &scores);
+      kept.push_back(codes(hits, doublets));
+      check(scores == std::vector<float>(kept.back().begin(), kept.back().end()), "scores of the doublets kept");
+    }
+
+    check(kept[0] == std::vector<int>({11, 12, 21, 22}), "first region keeps all");
+    check(kept[1] == std::vector<int>({23, 32, 33}), "overlapping region");
+    check(kept[2] == std::vector<int>({13, 31}), "region covering the others");
+    check(kept[3] == std::vector<int>({44}), "separate region");
+    check(duplicates.nowned() == 10 && duplicates.nremoved() == 8, "counts");
+
+    const DoubletOwners result = duplicates.owners();
+    check(result.size() == 10, "owners of all the doublets kept");
+    // doublets in the order they are kept
+    const std::vector<std::vector<unsigned int> > expected = {
+      {0, 2}, {0, 2}, {0, 2}, {0, 1, 2},  // 11 12 21 22
+      {1, 2}, {1, 2}, {1, 2},             // 23 32 33
+      {2}, {2},                           // 13 31
+      {3}};                               // 44
+    bool same = true;
+    for(unsigned int i=0; i<result.size(); ++i) same &= owners(result, i) == expected[i] && result.keeper(i) == expected[i][0];
+    check(same, "owners");
+
+    duplicates.clear();
+    check(duplicates.owners().size() == 0 && duplicates.nremoved() == 0, "clear");
+  }
+}
+
+int main() {
+  checkRegions();
+  if(failures) return 1;
+  std::printf("testDuplicateDoublets: OK\n");
+  return 0;
+}
@@ -0,0 +1,83 @@
+"""
+Writes the weights of a trained doublet graph classifier (interaction network)
+in the text format read by DoubletGraphClassifier (RecoTracker/TkHitPairs).
+
+The model must have the dense layers nodeEncoder (3 -> H), edgeHidden
+(2H+3 -> H), edgeOutput (H -> 1) and nodeHidden (3H+3 -> H), with the inputs
+ordered as in DoubletGraphClassifier.h. They are read from
+  - a Keras model (.h5), layers found by name, kernels nin x nout;
+  - a .npz with <layer>_kernel (nin x nout) and <layer>_bias;
+  - a PyTorch state dict (.pt), <layer>.weight (nout x nin) and <layer>.bias.
+
+usage: export_doublet_graph_classifier.py model output --iterations N --scales r phi z
+"""
+import argparse
+import sys
+
+import numpy as np
+
+layers = ["nodeEncoder", "edgeHidden", "edgeOutput", "nodeHidden"]
+
+
+def load_keras(fname):
+    from keras.models import load_model
+    model = load_model(fname, compile=False)
+    weights = {}
+    for name in layers:
+        kernel, bias = model.get_layer(name).get_weights()
+        weights[name] = (kernel.T, bias)
+    return weights
+
+
+def load_npz(fname):
+    data = np.load(fname)
+    return {name: (data[name + "_kernel"].T, data[name + "_bias"]) for name in layers}
+
+
+def load_torch(fname):
+    import torch
+    state = torch.load(fname, map_location="cpu")
+    return {name: (state[name + ".weight"].numpy(), state[name + ".bias"].numpy()) for name in layers}
+
+
+def check_shapes(weights):
+    hidden = weights["nodeEncoder"][0].shape[0]
+    expected = {"nodeEncoder": (hidden, 3), "edgeHidden": (hidden, 2 * hidden + 3),
+                "edgeOutput": (1, hidden), "nodeHidden": (hidden, 3 * hidden + 3)}
+    for name in layers:
+        w, b = weights[name]
+        if w.shape != expected[name] or b.shape != (expected[name][0],):
+            sys.exit("layer %s: weights %s and biases %s, expected %s" % (name, w.shape, b.shape, expected[name]))
+    return hidden
+
+
+def write(fname, weights, hidden, iterations, scales):
+    with open(fname, "w") as out:
+        out.write("DoubletGraphClassifier 1\n")
+        out.write("hidden %d iterations %d\n" % (hidden, iterations))
+        out.write("scales %.9g %.9g %.9g\n" % tuple(scales))
+        for name in layers:
+            w, b = weights[name]
+            out.write("dense %d %d\n" % (w.shape[1], w.shape[0]))
+            out.write(" ".join("%.9g" % x for x in w.astype(np.float32).ravel()) + "\n")
+            out.write(" ".join("%.9g" % x for x in b.astype(np.float32)) + "\n")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("model", type=str, help="Keras .h5, .npz or PyTorch .pt")
+    parser.add_argument("output", type=str)
+    parser.add_argument("--iterations", type=int, required=True, help="message passing iterations of the training")
+    parser.add_argument("--scales", type=float, nargs=3, default=[1., 1., 1.],
+                        help="r, phi and z scales of the node features")
+    args = parser.parse_args()
+
+    if args.model.endswith(".npz"):
+        weights = load_npz(args.model)
+    elif args.model.endswith(".pt") or args.model.endswith(".pth"):
+        weights = load_torch(args.model)
+    else:
+        weights = load_keras(args.model)
+    hidden = check_shapes(weights)
+    write(args.output, weights, hidden, args.iterations, args.scales)
+    print("%s: hidden %d, %d iterations" % (args.output, hidden, args.iterations))